@@ -3,6 +3,8 @@
 #include "../../csp_semaphore.h"
 
 #include <sys/time.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
@@ -56,3 +58,7 @@ int csp_bin_sem_post(csp_bin_sem_handle_t * sem) {
 int csp_bin_sem_post_isr(csp_bin_sem_handle_t * sem, int * task_woken) {
 	return csp_mutex_unlock(sem);
 }
+
+void * csp_task_self(void) {
+	return (void *)(uintptr_t)pthread_self();
+}
@@ -3,6 +3,7 @@
 #include "../../csp_semaphore.h"
 
 #include <windows.h>
+#include <stdint.h>
 
 int csp_bin_sem_create(csp_bin_sem_handle_t * sem) {
 
@@ -49,3 +50,8 @@ int csp_bin_sem_post_isr(csp_bin_sem_handle_t * sem, int * task_woken) {
 	}
 	return csp_bin_sem_post(sem);
 }
+
+void * csp_task_self(void) {
+	/* GetCurrentThread() is a pseudo handle, the same in every thread */
+	return (void *)(uintptr_t)GetCurrentThreadId();
+}
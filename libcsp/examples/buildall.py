@@ -11,6 +11,9 @@ DEFAULT_BUILD_SYSTEM = 'waf'
 def build_with_meson():
     targets = ['examples/csp_server_client',
                'examples/csp_arch',
+               'examples/csp_crc32_bench',
+               'examples/csp_sha1_bench',
+               'examples/csp_mac_bench',
                'examples/zmqproxy']
     builddir = 'build'
 
@@ -23,6 +26,9 @@ def build_with_meson():
 def build_with_cmake():
     targets = ['examples/csp_server_client',
                'examples/csp_arch',
+               'examples/csp_crc32_bench',
+               'examples/csp_sha1_bench',
+               'examples/csp_mac_bench',
                'examples/zmqproxy']
     builddir = 'build'
 
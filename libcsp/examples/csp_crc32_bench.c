@@ -0,0 +1,115 @@
+#include <csp/csp.h>
+#include <csp/csp_crc32.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* CRC32 microbenchmark: checks that every kernel gives the same result, and reports its throughput */
+
+static const struct {
+	csp_crc32_kernel_t kernel;
+	const char * name;
+} kernels[] = {
+	{CSP_CRC32_KERNEL_BYTE, "byte"},
+	{CSP_CRC32_KERNEL_SLICE8, "slice8"},
+	{CSP_CRC32_KERNEL_SSE42, "sse4.2"},
+	{CSP_CRC32_KERNEL_ARMV8, "armv8"},
+};
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main(int argc, char * argv[]) {
+
+	const unsigned int sizes[] = {16, 64, 256, 1024, 16384};
+	const unsigned int total = 64 * 1024 * 1024;
+	static uint8_t buf[16384 + 8];
+
+	srand(1);
+	for (unsigned int i = 0; i < sizeof(buf); i++) {
+		buf[i] = rand();
+	}
+
+	/* Reference results with the byte-wise kernel, for every length and alignment */
+	static uint32_t ref[8][257];
+	csp_crc32_set_kernel(CSP_CRC32_KERNEL_BYTE);
+	for (unsigned int off = 0; off < 8; off++) {
+		for (unsigned int len = 0; len <= 256; len++) {
+			ref[off][len] = csp_crc32_memory(buf + off, len);
+		}
+	}
+
+	/* Known answer for "123456789" */
+	if (csp_crc32_memory((const uint8_t *)"123456789", 9) != 0xE3069283) {
+		printf("byte: known answer test failed\n");
+		return 1;
+	}
+
+	/* Streaming and combined checksums must match the one-shot checksum, for every split */
+	for (unsigned int len = 0; len <= 256; len++) {
+		uint32_t crc = ref[0][len];
+		for (unsigned int split = 0; split <= len; split++) {
+			uint32_t stream = csp_crc32_update(csp_crc32_update(csp_crc32_init(), buf, split), buf + split, len - split);
+			uint32_t combined = csp_crc32_combine(csp_crc32_memory(buf, split), csp_crc32_memory(buf + split, len - split), len - split);
+			if ((csp_crc32_final(stream) != crc) || (combined != crc)) {
+				printf("stream/combine mismatch, length %u split %u\n", len, split);
+				return 1;
+			}
+		}
+	}
+
+	int ret = 0;
+	for (unsigned int k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+
+		if (csp_crc32_set_kernel(kernels[k].kernel) != CSP_ERR_NONE) {
+			printf("%-8s not supported\n", kernels[k].name);
+			continue;
+		}
+
+		unsigned int errors = 0;
+		for (unsigned int off = 0; off < 8; off++) {
+			for (unsigned int len = 0; len <= 256; len++) {
+				if (csp_crc32_memory(buf + off, len) != ref[off][len]) {
+					errors++;
+				}
+			}
+		}
+		if (errors) {
+			printf("%-8s %u mismatches against byte kernel\n", kernels[k].name, errors);
+			ret = 1;
+			continue;
+		}
+
+		for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+			unsigned int rounds = total / sizes[s];
+			volatile uint32_t sink = 0;
+			uint64_t ns = now_ns();
+#if defined(__x86_64__) || defined(__i386__)
+			uint64_t cycles = __rdtsc();
+#endif
+			for (unsigned int r = 0; r < rounds; r++) {
+				sink ^= csp_crc32_memory(buf, sizes[s]);
+			}
+#if defined(__x86_64__) || defined(__i386__)
+			cycles = __rdtsc() - cycles;
+#endif
+			ns = now_ns() - ns;
+			(void)sink;
+
+			double bytes = (double)rounds * sizes[s];
+			printf("%-8s %6u bytes: %8.1f MB/s", kernels[k].name, sizes[s], bytes * 1000.0 / ns);
+#if defined(__x86_64__) || defined(__i386__)
+			printf(", %6.2f bytes/cycle", bytes / cycles);
+#endif
+			printf("\n");
+		}
+	}
+
+	return ret;
+}
@@ -0,0 +1,132 @@
+#include <csp/csp.h>
+#include <csp/crypto/csp_hmac.h>
+#include <csp/crypto/csp_siphash.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* Packet authentication microbenchmark: HMAC-SHA1 (CSP_O_HMAC) against SipHash-2-4 (CSP_O_SIPHASH).
+ * Each round appends the tag like the sender, and verifies and strips it like the router */
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int hmac_round(csp_packet_t * packet) {
+	if (csp_hmac_append(packet, false) != CSP_ERR_NONE) {
+		return CSP_ERR_TX;
+	}
+	return csp_hmac_verify(packet, false);
+}
+
+static int siphash_round(csp_packet_t * packet) {
+	if (csp_siphash_append(packet) != CSP_ERR_NONE) {
+		return CSP_ERR_TX;
+	}
+	return csp_siphash_verify(packet);
+}
+
+static const struct {
+	int (*round)(csp_packet_t * packet);
+	const char * name;
+} macs[] = {
+	{hmac_round, "hmac"},
+	{siphash_round, "siphash"},
+};
+
+int main(int argc, char * argv[]) {
+
+	const unsigned int sizes[] = {8, 20, 64, 200};
+	const unsigned int rounds = 1000000;
+
+	csp_init();
+	csp_hmac_set_key("benchmark", 9);
+
+	csp_packet_t * packet = csp_buffer_get(0);
+	if (packet == NULL) {
+		printf("no buffer\n");
+		return 1;
+	}
+
+	srand(1);
+	for (unsigned int i = 0; i < csp_buffer_data_size(); i++) {
+		packet->data[i] = rand();
+	}
+
+	/* Known answer for the SipHash-2-4 reference vector: key 00..0f, message 00..0e */
+	uint8_t key[CSP_SIPHASH_KEYSIZE], msg[15];
+	for (unsigned int i = 0; i < sizeof(key); i++) {
+		key[i] = i;
+	}
+	for (unsigned int i = 0; i < sizeof(msg); i++) {
+		msg[i] = i;
+	}
+	if (csp_siphash_memory(key, msg, sizeof(msg)) != 0xa129ca6149be45e5ULL) {
+		printf("siphash: known answer test failed\n");
+		return 1;
+	}
+
+	int ret = 0;
+	for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+
+		if (sizes[s] + CSP_HMAC_LENGTH > csp_buffer_data_size()) {
+			continue;
+		}
+
+		double hmac_ns = 0;
+		for (unsigned int m = 0; m < sizeof(macs) / sizeof(macs[0]); m++) {
+
+			unsigned int errors = 0;
+			uint64_t ns = now_ns();
+#if defined(__x86_64__) || defined(__i386__)
+			uint64_t cycles = __rdtsc();
+#endif
+			for (unsigned int r = 0; r < rounds; r++) {
+				packet->length = sizes[s];
+				if ((macs[m].round(packet) != CSP_ERR_NONE) || (packet->length != sizes[s])) {
+					errors++;
+				}
+			}
+#if defined(__x86_64__) || defined(__i386__)
+			cycles = __rdtsc() - cycles;
+#endif
+			ns = now_ns() - ns;
+
+			if (errors) {
+				printf("%-8s %u failed verifications\n", macs[m].name, errors);
+				ret = 1;
+			}
+
+			double per_packet = (double)ns / rounds;
+			if (m == 0) {
+				hmac_ns = per_packet;
+			}
+			printf("%-8s %4u bytes: %8.1f ns/packet", macs[m].name, sizes[s], per_packet);
+#if defined(__x86_64__) || defined(__i386__)
+			printf(", %7.1f cycles/packet", (double)cycles / rounds);
+#endif
+			if (m > 0) {
+				printf(", %5.1fx hmac", hmac_ns / per_packet);
+			}
+			printf("\n");
+		}
+	}
+
+	/* A wrong tag must be rejected */
+	packet->length = 20;
+	csp_siphash_append(packet);
+	packet->data[0] ^= 1;
+	if (csp_siphash_verify(packet) != CSP_ERR_HMAC) {
+		printf("siphash: corrupted packet accepted\n");
+		ret = 1;
+	}
+
+	csp_buffer_free(packet);
+	return ret;
+}
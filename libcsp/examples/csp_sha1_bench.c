@@ -0,0 +1,158 @@
+#include <csp/csp.h>
+#include <csp/crypto/csp_sha1.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* SHA1 microbenchmark: checks that every kernel gives the same result, and reports its throughput */
+
+static const struct {
+	csp_sha1_kernel_t kernel;
+	const char * name;
+} kernels[] = {
+	{CSP_SHA1_KERNEL_GENERIC, "generic"},
+	{CSP_SHA1_KERNEL_SSSE3, "ssse3"},
+	{CSP_SHA1_KERNEL_SHANI, "sha-ni"},
+	{CSP_SHA1_KERNEL_ARMV8, "armv8"},
+};
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main(int argc, char * argv[]) {
+
+	const unsigned int sizes[] = {16, 64, 256, 1024, 16384};
+	const unsigned int total = 32 * 1024 * 1024;
+	static uint8_t buf[16384 + 8];
+
+	srand(1);
+	for (unsigned int i = 0; i < sizeof(buf); i++) {
+		buf[i] = rand();
+	}
+
+	/* Reference results with the generic kernel, for lengths across several blocks and every alignment */
+	static uint8_t ref[8][300][CSP_SHA1_DIGESTSIZE];
+	csp_sha1_set_kernel(CSP_SHA1_KERNEL_GENERIC);
+	for (unsigned int off = 0; off < 8; off++) {
+		for (unsigned int len = 0; len < 300; len++) {
+			csp_sha1_memory(buf + off, len, ref[off][len]);
+		}
+	}
+
+	/* Known answer for "abc" */
+	const uint8_t abc[CSP_SHA1_DIGESTSIZE] = {0xa9, 0x99, 0x3e, 0x36, 0x47, 0x06, 0x81, 0x6a, 0xba, 0x3e,
+											  0x25, 0x71, 0x78, 0x50, 0xc2, 0x6c, 0x9c, 0xd0, 0xd8, 0x9d};
+	uint8_t hash[CSP_SHA1_DIGESTSIZE];
+	csp_sha1_memory("abc", 3, hash);
+	if (memcmp(hash, abc, sizeof(hash)) != 0) {
+		printf("generic: known answer test failed\n");
+		return 1;
+	}
+
+	int ret = 0;
+	for (unsigned int k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+
+		if (csp_sha1_set_kernel(kernels[k].kernel) != CSP_ERR_NONE) {
+			printf("%-8s not supported\n", kernels[k].name);
+			continue;
+		}
+
+		unsigned int errors = 0;
+		for (unsigned int off = 0; off < 8; off++) {
+			for (unsigned int len = 0; len < 300; len++) {
+				csp_sha1_memory(buf + off, len, hash);
+				if (memcmp(hash, ref[off][len], sizeof(hash)) != 0) {
+					errors++;
+				}
+			}
+		}
+		if (errors) {
+			printf("%-8s %u mismatches against generic kernel\n", kernels[k].name, errors);
+			ret = 1;
+			continue;
+		}
+
+		for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+			unsigned int rounds = total / sizes[s];
+			uint64_t ns = now_ns();
+#if defined(__x86_64__) || defined(__i386__)
+			uint64_t cycles = __rdtsc();
+#endif
+			for (unsigned int r = 0; r < rounds; r++) {
+				csp_sha1_memory(buf, sizes[s], hash);
+			}
+#if defined(__x86_64__) || defined(__i386__)
+			cycles = __rdtsc() - cycles;
+#endif
+			ns = now_ns() - ns;
+
+			double bytes = (double)rounds * sizes[s];
+			printf("%-8s %6u bytes: %8.1f MB/s", kernels[k].name, sizes[s], bytes * 1000.0 / ns);
+#if defined(__x86_64__) || defined(__i386__)
+			printf(", %6.2f bytes/cycle", bytes / cycles);
+#endif
+			printf("\n");
+		}
+	}
+
+	/* Multi-buffer: 8 messages at a time, checked against the reference.
+	 * Vector lanes are used when the single stream kernel has no SHA instructions */
+	for (unsigned int m = 0; m < 2; m++) {
+		const char * name = m ? "mb auto" : "mb lanes";
+		csp_sha1_set_kernel(m ? CSP_SHA1_KERNEL_AUTO : CSP_SHA1_KERNEL_GENERIC);
+		for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+
+			csp_sha1_state_t states[8];
+			const void * data[8];
+			uint32_t length[8];
+			uint8_t hashes[8][CSP_SHA1_DIGESTSIZE];
+			uint8_t * out[8];
+
+			for (unsigned int i = 0; i < 8; i++) {
+				data[i] = buf + i;
+				length[i] = (sizes[s] < 300) ? sizes[s] - i : sizes[s];
+				out[i] = hashes[i];
+			}
+
+			unsigned int rounds = total / (8 * sizes[s]);
+			uint64_t ns = now_ns();
+#if defined(__x86_64__) || defined(__i386__)
+			uint64_t cycles = __rdtsc();
+#endif
+			for (unsigned int r = 0; r < rounds; r++) {
+				for (unsigned int i = 0; i < 8; i++) {
+					csp_sha1_init(&states[i]);
+				}
+				csp_sha1_done_mb(states, data, length, out, 8);
+			}
+#if defined(__x86_64__) || defined(__i386__)
+			cycles = __rdtsc() - cycles;
+#endif
+			ns = now_ns() - ns;
+
+			for (unsigned int i = 0; i < 8; i++) {
+				csp_sha1_memory(data[i], length[i], hash);
+				if (memcmp(hash, hashes[i], sizeof(hash)) != 0) {
+					printf("multi-buffer mismatch, length %" PRIu32 "\n", length[i]);
+					ret = 1;
+				}
+			}
+
+			double bytes = (double)rounds * 8 * sizes[s];
+			printf("%-8s %6u bytes: %8.1f MB/s", name, sizes[s], bytes * 1000.0 / ns);
+#if defined(__x86_64__) || defined(__i386__)
+			printf(", %6.2f bytes/cycle", bytes / cycles);
+#endif
+			printf("\n");
+		}
+	}
+
+	return ret;
+}
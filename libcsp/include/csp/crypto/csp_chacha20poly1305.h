@@ -0,0 +1,49 @@
+
+
+#pragma once
+
+/**
+   @file
+   ChaCha20-Poly1305 AEAD support (RFC 8439).
+
+   Used by the tunnel interface to encrypt and authenticate packets in place.
+*/
+
+#include <csp/csp_types.h>
+
+
+
+/** The ChaCha20-Poly1305 key size in bytes */
+#define CSP_CHACHA20POLY1305_KEYSIZE	32
+
+/** The ChaCha20-Poly1305 nonce size in bytes */
+#define CSP_CHACHA20POLY1305_NONCESIZE	12
+
+/** The Poly1305 tag size in bytes */
+#define CSP_CHACHA20POLY1305_TAGSIZE	16
+
+/**
+   Encrypt and authenticate data in place.
+   @param[in] key key, #CSP_CHACHA20POLY1305_KEYSIZE bytes.
+   @param[in] nonce nonce, #CSP_CHACHA20POLY1305_NONCESIZE bytes. Must never be reused with the same key.
+   @param[in] ad additional data, authenticated but not encrypted (may be NULL when \a ad_length is 0).
+   @param[in] ad_length length of \a ad.
+   @param[in,out] data plaintext in, ciphertext out.
+   @param[in] length length of \a data.
+   @param[out] tag user supplied buffer of minimum #CSP_CHACHA20POLY1305_TAGSIZE bytes.
+*/
+void csp_chacha20poly1305_encrypt(const uint8_t * key, const uint8_t * nonce, const void * ad, uint32_t ad_length, uint8_t * data, uint32_t length, uint8_t * tag);
+
+/**
+   Verify and decrypt data in place.
+   The tag is checked before decryption, \a data is left untouched on failure.
+   @param[in] key key, #CSP_CHACHA20POLY1305_KEYSIZE bytes.
+   @param[in] nonce nonce, #CSP_CHACHA20POLY1305_NONCESIZE bytes.
+   @param[in] ad additional data (may be NULL when \a ad_length is 0).
+   @param[in] ad_length length of \a ad.
+   @param[in,out] data ciphertext in, plaintext out.
+   @param[in] length length of \a data.
+   @param[in] tag received tag, #CSP_CHACHA20POLY1305_TAGSIZE bytes.
+   @return #CSP_ERR_NONE on success, #CSP_ERR_HMAC if the tag does not match.
+*/
+int csp_chacha20poly1305_decrypt(const uint8_t * key, const uint8_t * nonce, const void * ad, uint32_t ad_length, uint8_t * data, uint32_t length, const uint8_t * tag);
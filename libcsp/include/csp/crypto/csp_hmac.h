@@ -35,6 +35,22 @@ int csp_hmac_append(csp_packet_t * packet, bool include_header);
  */
 int csp_hmac_verify(csp_packet_t * packet, bool include_header);
 
+/**
+   Maximum number of packets hashed together by csp_hmac_verify_batch().
+*/
+#define CSP_HMAC_BATCH_MAX	8
+
+/**
+ * Verify HMAC of several packets
+ *
+ * Same result as csp_hmac_verify() on each packet, but the packets are hashed together with csp_sha1_done_mb().
+ * @param packets CSP packets, must be valid.
+ * @param count number of packets
+ * @param include_header use header in hmac calculation (this will not modify the flags field)
+ * @param[out] results #CSP_ERR_NONE or #CSP_ERR_HMAC for each packet.
+ */
+void csp_hmac_verify_batch(csp_packet_t * packets[], unsigned int count, bool include_header, int results[]);
+
 /**
  * Calculate HMAC on buffer
  *
@@ -48,8 +64,15 @@ int csp_hmac_verify(csp_packet_t * packet, bool include_header);
  */
 int csp_hmac_memory(const void * key, uint32_t keylen, const void * data, uint32_t datalen, uint8_t * hmac);
 
+/**
+ * Prepare the default all zero key for the append/verify functions, called by csp_init().
+ * Does nothing if csp_hmac_set_key() was called before.
+ */
+void csp_hmac_key_init(void);
+
 /**
  * Save a copy of the key string for use by the append/verify functions
+ * The SipHash key is derived from the same string, see csp_siphash_set_key().
  * @param key HMAC key
  * @param keylen HMAC key length
  * @return #CSP_ERR_NONE on success, otherwise an error code.
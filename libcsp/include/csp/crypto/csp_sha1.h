@@ -61,3 +61,43 @@ void csp_sha1_done(csp_sha1_state_t * state, uint8_t * sha1);
    @param[out] sha1 user supplied buffer of minimum #CSP_SHA1_DIGESTSIZE bytes.
 */
 void csp_sha1_memory(const void * data, uint32_t length, uint8_t * sha1);
+
+/**
+   Terminate several independent hash calculations.
+
+   Equivalent to csp_sha1_process() and csp_sha1_done() on each message, but without SHA instructions in the CPU,
+   the messages are hashed side by side in vector lanes (8 lanes with AVX2).
+
+   @param[in] states hash states, one per message, consumed.
+   @param[in] data data, one per message.
+   @param[in] length length of \a data, one per message.
+   @param[out] hash user supplied buffers of minimum #CSP_SHA1_DIGESTSIZE bytes, one per message.
+   @param[in] count number of messages.
+*/
+void csp_sha1_done_mb(csp_sha1_state_t states[], const void * const data[], const uint32_t length[], uint8_t * const hash[], unsigned int count);
+
+/**
+   SHA1 compression kernels.
+   All kernels compute the same hash, only the speed differs.
+*/
+typedef enum {
+	CSP_SHA1_KERNEL_AUTO,     //!< Fastest kernel supported by the CPU
+	CSP_SHA1_KERNEL_GENERIC,  //!< Portable C
+	CSP_SHA1_KERNEL_SSSE3,    //!< x86-64 SSSE3 message schedule, scalar rounds
+	CSP_SHA1_KERNEL_SHANI,    //!< x86-64 SHA extensions
+	CSP_SHA1_KERNEL_ARMV8,    //!< ARMv8 SHA1 instructions
+} csp_sha1_kernel_t;
+
+/**
+   Select the kernel used for SHA1 compression.
+   The fastest available kernel is selected automatically on first use, so this is only needed for testing and benchmarking.
+   @param[in] kernel kernel to use
+   @return #CSP_ERR_NONE on success, #CSP_ERR_NOTSUP if the kernel is not built in or not supported by the CPU.
+*/
+int csp_sha1_set_kernel(csp_sha1_kernel_t kernel);
+
+/**
+   Get the kernel used for SHA1 compression.
+   @return selected kernel, never #CSP_SHA1_KERNEL_AUTO
+*/
+csp_sha1_kernel_t csp_sha1_get_kernel(void);
@@ -0,0 +1,55 @@
+
+
+#pragma once
+
+/**
+   @file
+   SipHash support.
+
+   SipHash-2-4 keyed MAC, a cheaper alternative to HMAC-SHA1 for short packets.
+*/
+
+#include <csp/csp_types.h>
+
+
+
+/**
+   Number of bytes from the SipHash calculation, that is appended to the CSP message (same as #CSP_HMAC_LENGTH).
+*/
+#define CSP_SIPHASH_LENGTH	4
+
+/** The SipHash key size in bytes */
+#define CSP_SIPHASH_KEYSIZE	16
+
+/**
+ * Append SipHash tag to packet
+ * The tag covers the CSP id (in a version independent form) and the data.
+ * @param packet CSP packet, must be valid.
+ * @return #CSP_ERR_NONE on success, otherwise an error code.
+ */
+int csp_siphash_append(csp_packet_t * packet);
+
+/**
+ * Verify SipHash tag of packet
+ * @param packet CSP packet, must be valid.
+ * @return #CSP_ERR_NONE on success, otherwise an error code.
+ */
+int csp_siphash_verify(csp_packet_t * packet);
+
+/**
+ * Calculate SipHash-2-4 on buffer
+ * @param key key, #CSP_SIPHASH_KEYSIZE bytes.
+ * @param data pointer to data
+ * @param datalen length of data
+ * @return 64 bit SipHash value.
+ */
+uint64_t csp_siphash_memory(const uint8_t * key, const void * data, uint32_t datalen);
+
+/**
+ * Derive the key used by the append/verify functions
+ * csp_hmac_set_key() also calls this, so one key configures both HMAC and SipHash.
+ * @param key key
+ * @param keylen key length
+ * @return #CSP_ERR_NONE on success, otherwise an error code.
+ */
+int csp_siphash_set_key(const void * key, uint32_t keylen);
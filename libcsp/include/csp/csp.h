@@ -14,6 +14,7 @@
 #include <csp/csp_iflist.h>
 #include <csp/csp_sfp.h>
 #include <csp/csp_promisc.h>
+#include <csp/csp_dedup.h>
 
 /** Max timeout */
 #define CSP_MAX_TIMEOUT (UINT32_MAX)
@@ -31,17 +32,31 @@ enum csp_dedup_types {
    CSP configuration.
 */
 typedef struct csp_conf_s {
-	uint8_t version;       /**< Protocol version to use (either 1 or 2) */
+	uint8_t version;       /**< Protocol version to use (either 1 or 2), set before csp_init() */
 	uint16_t address;      /**< CSP address of the system */
 	const char * hostname; /**< Host name, returned by the #CSP_CMP_IDENT request */
 	const char * model;    /**< Model, returned by the #CSP_CMP_IDENT request */
 	const char * revision; /**< Revision, returned by the #CSP_CMP_IDENT request */
 	uint32_t conn_dfl_so;  /**< Default connection options. Options will always be or'ed onto new connections, see csp_connect() */
 	uint8_t dedup;         /**< Enable CSP deduplication. 0 = off, 1 = always on, 2 = only on forwarded packets,  */
+	uint8_t fast_ping;     /**< Echo #CSP_PING requests from the router task, without a connection or service task. Takes precedence over any socket bound to #CSP_PING */
+	uint16_t conn_max;     /**< Number of connections, 0 for #CSP_CONN_MAX. More than #CSP_CONN_MAX requires conn_storage, without it csp_init() caps conn_max to #CSP_CONN_MAX and sets csp_dbg_errno to #CSP_DBG_ERR_CONN_MAX */
+	void * conn_storage;   /**< Memory for conn_max connections, of csp_conn_storage_size() bytes. NULL to use the built-in pool of #CSP_CONN_MAX */
+	uint32_t keepalive_idle; /**< Pooled transaction connections idle for this long (mS) are closed, see #CSP_O_KEEPALIVE */
+	uint16_t offload_threshold; /**< CRC32 and HMAC of packets of at least this many bytes are done by csp_offload_work() tasks, 0 to disable */
 } csp_conf_t;
 
 extern csp_conf_t csp_conf;
 
+/**
+   Size of the connection pool.
+   Outgoing connections are also limited by the number of free outgoing ports (above #CSP_PORT_MAX_BIND),
+   incoming connections are only limited by the pool size.
+   @param[in] conn_max number of connections.
+   @return bytes needed for csp_conf.conn_storage.
+*/
+size_t csp_conn_storage_size(unsigned int conn_max);
+
 /**
  * Initialize CSP.
  * This will configure basic structures.
@@ -98,6 +113,32 @@ csp_packet_t * csp_read(csp_conn_t * conn, uint32_t timeout);
 */
 void csp_send(csp_conn_t * conn, csp_packet_t * packet);
 
+/**
+   Send packet on a connection, without waiting for flow control.
+
+   On a connection with credit flow control (#CSP_O_CREDIT), the packet is only sent if the peer has room for it.
+   Other connections behave as csp_send().
+
+   @param[in] conn connection
+   @param[in] packet packet to send, consumed on success.
+   @return #CSP_ERR_NONE on success, #CSP_ERR_AGAIN if there are no credits (the packet is still owned by the caller),
+   otherwise an error code.
+*/
+int csp_send_nonblock(csp_conn_t * conn, csp_packet_t * packet);
+
+/**
+   Send several packets on a connection.
+
+   The route is looked up once for all packets, and an interface with a batched Tx function (nexthop_batch) gets them
+   in one call. RDP connections send the packets one by one, as csp_send() does.
+   The packet buffers are automatically freed, and cannot be used after the call.
+
+   @param[in] conn connection
+   @param[in] packets packets to send, in order. The array itself may be reordered.
+   @param[in] count number of packets
+*/
+void csp_send_batch(csp_conn_t * conn, csp_packet_t * packets[], unsigned int count);
+
 /**
    Change the default priority of the connection and send a packet.
    @note The priority of the connection will be changed. If you need to change it back, call csp_send_prio() again.
@@ -119,7 +160,9 @@ void csp_send_prio(uint8_t prio, csp_conn_t * conn, csp_packet_t * packet);
    @param[in] outlen length of data in \a outbuf (request)
    @param[out] inbuf user provided buffer for receiving data (reply)
    @param[in] inlen length of expected reply, -1 for unknown size (inbuf MUST be large enough), 0 for no reply.
-   @param[in] opts connection options, see @ref CSP_CONNECTION_OPTIONS.
+   @param[in] opts connection options, see @ref CSP_CONNECTION_OPTIONS. With #CSP_O_KEEPALIVE the connection is
+   kept open after a successful transaction, and reused by the next transaction with the same destination, port
+   and options. The server must keep the connection open between transactions for this to save round trips.
    @return 1 or reply size on success, 0 on failure (error, incoming length does not match, timeout)
 */
 int csp_transaction_w_opts(uint8_t prio, uint16_t dst, uint8_t dst_port, uint32_t timeout, void * outbuf, int outlen, void * inbuf, int inlen, uint32_t opts);
@@ -154,6 +197,12 @@ static inline int csp_transaction(uint8_t prio, uint16_t dest, uint8_t port, uin
 */
 int csp_transaction_persistent(csp_conn_t * conn, uint32_t timeout, void * outbuf, int outlen, void * inbuf, int inlen);
 
+/**
+   Close all idle keep-alive transaction connections.
+   @see #CSP_O_KEEPALIVE
+*/
+void csp_transaction_pool_flush(void);
+
 /**
    Read data from a connection-less server socket.
    @param[in] socket connection-less socket.
@@ -173,6 +222,18 @@ csp_packet_t * csp_recvfrom(csp_socket_t * socket, uint32_t timeout);
 */
 void csp_sendto(uint8_t prio, uint16_t dst, uint8_t dst_port, uint8_t src_port, uint32_t opts, csp_packet_t * packet);
 
+/**
+   Send several packets (without connection), see csp_send_batch().
+   @param[in] prio packet priority, see #csp_prio_t
+   @param[in] dst destination address
+   @param[in] dst_port destination port
+   @param[in] src_port source port
+   @param[in] opts connection options, see @ref CSP_CONNECTION_OPTIONS. With #CSP_O_SAME, the flags of the first packet are used for all.
+   @param[in] packets packets to send, in order. The array itself may be reordered.
+   @param[in] count number of packets
+*/
+void csp_sendto_batch(uint8_t prio, uint16_t dst, uint8_t dst_port, uint8_t src_port, uint32_t opts, csp_packet_t * packets[], unsigned int count);
+
 /**
    Send a packet as a reply to a request (without a connection).
    Calls csp_sendto() with the source address and port from the request.
@@ -186,6 +247,8 @@ void csp_sendto_reply(const csp_packet_t * request, csp_packet_t * reply, uint32
    Establish outgoing connection.
    The call will return immediately, unless it is a RDP connection (#CSP_O_RDP) in which case it will wait until the other
    end acknowleges the connection (timeout is determined by the current connection timeout set by csp_rdp_set_opt()).
+   With #CSP_O_NONBLOCK, a RDP connection is returned as soon as the SYN is sent, and the router task completes the
+   handshake. Use csp_conn_wait_open() before sending on it.
    @param[in] prio priority, see #csp_prio_t
    @param[in] dst Destination address
    @param[in] dst_port Destination port
@@ -203,6 +266,16 @@ csp_conn_t * csp_connect(uint8_t prio, uint16_t dst, uint8_t dst_port, uint32_t
 */
 int csp_close(csp_conn_t * conn);
 
+/**
+   Wait for a non-blocking connect (#CSP_O_NONBLOCK) to complete.
+   Several connects can be started first, and then waited for in turn, or polled with \a timeout 0.
+   @param[in] conn connection from csp_connect().
+   @param[in] timeout timeout in mS to wait for the handshake.
+   @return #CSP_ERR_NONE when the connection is open (always for non-RDP connections), #CSP_ERR_AGAIN if the handshake
+   is still in progress, #CSP_ERR_TIMEDOUT if the connect failed. A failed connection must still be closed with csp_close().
+*/
+int csp_conn_wait_open(csp_conn_t * conn, uint32_t timeout);
+
 /**
    Return destination port of connection.
    @param[in] conn connection
@@ -273,6 +346,21 @@ int csp_conn_flags_out(csp_conn_t * conn);
  */
 int csp_listen(csp_socket_t * socket, size_t backlog);
 
+/**
+   Receive packets for a socket into an application buffer pool.
+
+   The router moves each packet for the socket, and for connections accepted on it, to a buffer from \a pool before
+   queueing it. The global buffer is released at once, and the application can keep the packet as long as it needs.
+   Only packets with application data are moved, RDP and credit control packets stay in the global pool.
+   Packets are dropped when \a pool is empty. Multicast groups still share global buffers.
+   Set before csp_bind(), connections already accepted keep the pool they were accepted with.
+
+   @param[in] socket socket.
+   @param[in] pool pool set up with csp_buffer_pool_init(), or NULL for the global pool.
+   @return #CSP_ERR_NONE on success, otherwise an error code.
+*/
+int csp_socket_set_rx_pool(csp_socket_t * socket, csp_buffer_pool_t * pool);
+
 /**
    Bind port to socket.
    @param[in] socket socket to bind port to
@@ -281,6 +369,28 @@ int csp_listen(csp_socket_t * socket, size_t backlog);
 */
 int csp_bind(csp_socket_t * socket, uint8_t port);
 
+/**
+   Join multicast group.
+
+   Every socket in the group receives its own reference to each packet addressed to the group port. The buffer is
+   shared between the members (see csp_buffer_refc_inc()), so it must be treated as read-only, and freed with
+   csp_buffer_free() as usual.
+
+   @param[in] socket connection-less socket (#CSP_SO_CONN_LESS), with its queue created by csp_listen().
+   @param[in] port group port. The port cannot be bound by csp_bind() or csp_bind_callback() at the same time.
+   @return #CSP_ERR_NONE on success, otherwise an error code.
+*/
+int csp_join_group(csp_socket_t * socket, uint8_t port);
+
+/**
+   Leave multicast group.
+   The port is released when the last member leaves.
+   @param[in] socket socket
+   @param[in] port group port
+   @return #CSP_ERR_NONE on success, otherwise an error code.
+*/
+int csp_leave_group(csp_socket_t * socket, uint8_t port);
+
 /**
    Bind port to callback function.
    @param[in] callback pointer to callback function
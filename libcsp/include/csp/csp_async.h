@@ -0,0 +1,108 @@
+#pragma once
+
+/**
+   @file
+
+   Asynchronous transactions.
+
+   Several requests can be outstanding on one connection. Replies are matched to their requests either in order
+   (the server must reply to every request, in the order received), or by a tag in the first data byte (the server
+   must copy the tag from the request to its reply).
+
+   Completions are delivered through callbacks, from csp_async_poll() in the task of the caller. The reply packet
+   is handed over to the callback, without copying.
+
+   In #CSP_ASYNC_ORDERED mode, a request that timed out keeps its slot and its place in the order until its late
+   reply arrives, which is then dropped, so later replies still go to the right requests. A reply that is lost keeps
+   the slot until csp_async_cancel(), use #CSP_ASYNC_TAGGED if replies can be lost.
+*/
+
+#include <csp/csp_types.h>
+
+#ifndef CSP_ASYNC_MAX_PENDING
+#define CSP_ASYNC_MAX_PENDING 8  //!< Max number of outstanding requests per context
+#endif
+
+/** Match replies in the order the requests were sent */
+#define CSP_ASYNC_ORDERED 0
+/** Match replies by the tag in data[0] of request and reply */
+#define CSP_ASYNC_TAGGED 1
+
+/**
+   Completion callback.
+   @param[in] arg user argument, from csp_async_request().
+   @param[in] error #CSP_ERR_NONE on success, #CSP_ERR_TIMEDOUT if no reply came in time, #CSP_ERR_RESET if cancelled.
+   @param[in] reply reply packet, NULL on error. The callback takes over the packet, and must free it.
+*/
+typedef void (*csp_async_cb_t)(void * arg, int error, csp_packet_t * reply);
+
+/** Outstanding request, internal */
+typedef struct {
+	csp_async_cb_t callback;
+	void * arg;
+	uint32_t deadline;
+	uint8_t tag;
+	uint8_t used;
+	uint8_t expired;  //!< Timed out in ordered mode, waiting for the late reply to drop it
+} csp_async_request_t;
+
+/**
+   Asynchronous transaction context.
+   Not thread safe, requests and polling must be done from the same task (or serialized by the user).
+*/
+typedef struct {
+	csp_conn_t * conn;
+	uint8_t mode;
+	uint8_t next_tag;    //!< Tag of the next request, also orders the requests
+	unsigned int count;  //!< Number of outstanding requests
+	uint32_t unmatched;  //!< Replies without an outstanding request, e.g. late replies, dropped
+	csp_async_request_t request[CSP_ASYNC_MAX_PENDING];
+} csp_async_t;
+
+/**
+   Setup context for asynchronous transactions on a connection.
+   @param[out] ctx context.
+   @param[in] conn established connection, remains owned by the user.
+   @param[in] mode #CSP_ASYNC_ORDERED or #CSP_ASYNC_TAGGED.
+*/
+void csp_async_init(csp_async_t * ctx, csp_conn_t * conn, uint8_t mode);
+
+/**
+   Send request without waiting for the reply.
+
+   In #CSP_ASYNC_TAGGED mode, the tag is written to data[0] of \a request, which the application protocol must
+   reserve for it.
+
+   @param[in] ctx context.
+   @param[in] request request packet, consumed on success. On error the packet is still owned by the caller.
+   @param[in] timeout time in mS to wait for the reply.
+   @param[in] callback called on completion.
+   @param[in] arg user argument for \a callback.
+   @return #CSP_ERR_NONE on success, #CSP_ERR_BUSY if #CSP_ASYNC_MAX_PENDING requests are outstanding or waiting for
+   late replies, #CSP_ERR_INVAL
+   if the request has no room for the tag.
+*/
+int csp_async_request(csp_async_t * ctx, csp_packet_t * request, uint32_t timeout, csp_async_cb_t callback, void * arg);
+
+/**
+   Deliver completions.
+   Waits up to \a timeout mS for a reply, but not beyond the deadline of the oldest outstanding request.
+   Replies already received are all delivered, and requests past their deadline are completed with #CSP_ERR_TIMEDOUT.
+   @param[in] ctx context.
+   @param[in] timeout max time in mS to wait, 0 to only deliver what is already received.
+   @return number of completed requests.
+*/
+int csp_async_poll(csp_async_t * ctx, uint32_t timeout);
+
+/**
+   Number of outstanding requests.
+*/
+static inline unsigned int csp_async_pending(const csp_async_t * ctx) {
+	return ctx->count;
+}
+
+/**
+   Complete all outstanding requests with #CSP_ERR_RESET, e.g. before closing the connection.
+   Replies arriving later are dropped as unmatched.
+*/
+void csp_async_cancel(csp_async_t * ctx);
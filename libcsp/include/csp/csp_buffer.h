@@ -9,6 +9,17 @@
 
 #include <csp/csp_types.h>
 
+/**
+   Buffer pool.
+   Besides the global pool set up by csp_init(), applications can provide pools in their own memory, see
+   csp_buffer_pool_init(). Buffers from any pool are freed with csp_buffer_free(), and return to their own pool.
+*/
+typedef struct csp_buffer_pool_s {
+	csp_queue_handle_t queue;        //!< Free buffers
+	csp_static_queue_t queue_static; //!< Static storage for the queue
+	unsigned int count;              //!< Number of buffers in the pool
+} csp_buffer_pool_t;
+
 /**
    Get free buffer (from task context).
 
@@ -37,6 +48,14 @@ void csp_buffer_free(void *buffer);
 */
 void csp_buffer_free_isr(void *buffer);
 
+/**
+   Add a reference to a buffer.
+   The buffer is shared, and is only returned to the pool when csp_buffer_free() has been called once per reference.
+   A shared buffer must be treated as read-only.
+   @param[in] buffer buffer to reference.
+*/
+void csp_buffer_refc_inc(void * buffer);
+
 /**
    Clone an existing buffer.
    The existing \a buffer content is copied to the new buffer.
@@ -65,6 +84,55 @@ size_t csp_buffer_size(void);
 */
 size_t csp_buffer_data_size(void);
 
+/**
+   Return the storage needed for a buffer pool.
+   @param[in] count number of buffers.
+   @return size in bytes of the storage for csp_buffer_pool_init().
+*/
+size_t csp_buffer_pool_storage_size(unsigned int count);
+
+/**
+   Setup an application buffer pool.
+   The buffers have the same size as the global buffers, see csp_buffer_data_size().
+   @param[out] pool pool to setup.
+   @param[in] storage memory of at least csp_buffer_pool_storage_size() bytes, aligned for a pointer.
+   @param[in] count number of buffers.
+   @return #CSP_ERR_NONE on success, #CSP_ERR_INVAL on invalid arguments.
+*/
+int csp_buffer_pool_init(csp_buffer_pool_t * pool, void * storage, unsigned int count);
+
+/**
+   Get free buffer from a pool (from task context).
+   A driver that knows the destination of a frame can decode directly into the receive pool of the socket.
+   @param[in] pool pool.
+   @return Buffer (pointer to #csp_packet_t) or NULL if the pool is empty.
+*/
+void * csp_buffer_pool_get(csp_buffer_pool_t * pool);
+
+/**
+   Return number of free buffers in a pool.
+   @param[in] pool pool.
+   @return number of free buffers.
+*/
+int csp_buffer_pool_remaining(csp_buffer_pool_t * pool);
+
+/**
+   Move a buffer to a pool.
+   If \a buffer is from another pool, its header and data are copied to a buffer from \a pool, and \a buffer is freed.
+   @param[in] pool destination pool.
+   @param[in] buffer buffer to move, always consumed.
+   @return buffer from \a pool, or NULL if the pool is empty.
+*/
+void * csp_buffer_pool_move(csp_buffer_pool_t * pool, void * buffer);
+
+/**
+   Copy a buffer to a pool, like csp_buffer_pool_move(), but without freeing \a buffer.
+   @param[in] pool destination pool.
+   @param[in] buffer buffer to copy.
+   @return buffer from \a pool, \a buffer itself if it is already from \a pool, or NULL if the pool is empty.
+*/
+void * csp_buffer_pool_copy(csp_buffer_pool_t * pool, void * buffer);
+
 void csp_buffer_init(void);
 
 
@@ -60,6 +60,14 @@
    Set/configure routing.
 */
 #define CSP_CMP_ROUTE_SET_V2 7
+/**
+   Request routing table statistics.
+*/
+#define CSP_CMP_ROUTE_STATS 8
+/**
+   Request routing table lookup histogram.
+*/
+#define CSP_CMP_ROUTE_HITS 9
 /**@}*/
 
 /**
@@ -90,6 +98,11 @@
 */
 #define CSP_CMP_POKE_MAX_LEN 200
 
+/**
+   CMP routing table statistics - max routes per request.
+*/
+#define CSP_CMP_ROUTE_STATS_MAX 12
+
 /**
    CSP management protocol description.
 */
@@ -141,6 +154,23 @@ struct csp_cmp_message {
 			char data[CSP_CMP_POKE_MAX_LEN];
 		} poke;
 		csp_timestamp_t clock;
+		struct __attribute__((__packed__)) {
+			uint16_t index;  //!< First route to report (request), in order of network address
+			uint16_t total;  //!< Number of routes in the table
+			uint8_t count;   //!< Number of routes reported
+			uint32_t misses; //!< Lookups without a route
+			struct __attribute__((__packed__)) {
+				uint16_t address;
+				uint8_t netmask;
+				uint16_t via;
+				uint32_t packets;
+				uint32_t bytes;
+			} route[CSP_CMP_ROUTE_STATS_MAX];
+		} route_stats;
+		struct __attribute__((__packed__)) {
+			uint32_t misses;                     //!< Lookups without a route
+			uint32_t hits[CSP_RTABLE_HIST_LEN];  //!< Lookups matched, by netmask of the matching route
+		} route_hits;
 	};
 } __attribute__ ((packed));
 
@@ -173,6 +203,8 @@ CMP_MESSAGE(CSP_CMP_ROUTE_SET_V1, route_set_v1)
 CMP_MESSAGE(CSP_CMP_IF_STATS, if_stats)
 CMP_MESSAGE(CSP_CMP_CLOCK, clock)
 CMP_MESSAGE(CSP_CMP_ROUTE_SET_V2, route_set_v2)
+CMP_MESSAGE(CSP_CMP_ROUTE_STATS, route_stats)
+CMP_MESSAGE(CSP_CMP_ROUTE_HITS, route_hits)
 
 /**
    Peek (read) memory on remote node.
@@ -23,6 +23,52 @@ int csp_crc32_append(csp_packet_t * packet);
 */
 int csp_crc32_verify(csp_packet_t * packet);
 
+/**
+   Verify CRC32 checksum on packet, using a CRC32 already calculated over the packet data.
+
+   Receivers that feed the data through csp_crc32_update() as it arrives, can use this to avoid a second pass over the data.
+   As with csp_crc32_verify(), a checksum that includes the header is also accepted.
+
+   @param[in] packet CSP packet, must be valid.
+   @param[in] data_crc finalized CRC32 over the packet data, excluding the checksum itself.
+   @return #CSP_ERR_NONE on success, otherwise an error code.
+*/
+int csp_crc32_verify_precomputed(csp_packet_t * packet, uint32_t data_crc);
+
+/**
+   Start a streaming CRC32 calculation.
+   @return initial CRC32 state
+*/
+uint32_t csp_crc32_init(void);
+
+/**
+   Add data to a streaming CRC32 calculation.
+   @param[in] crc current state, from csp_crc32_init() or a previous csp_crc32_update()
+   @param[in] data data
+   @param[in] length length of data
+   @return updated state
+*/
+uint32_t csp_crc32_update(uint32_t crc, const void * data, uint32_t length);
+
+/**
+   Finish a streaming CRC32 calculation.
+   @param[in] crc current state
+   @return checksum, same as csp_crc32_memory() over all data passed to csp_crc32_update()
+*/
+uint32_t csp_crc32_final(uint32_t crc);
+
+/**
+   Combine two checksums.
+
+   Calculates the checksum of two concatenated memory areas from their separate checksums, without walking the data again.
+
+   @param[in] crc1 checksum of the first area
+   @param[in] crc2 checksum of the second area
+   @param[in] length2 length of the second area
+   @return checksum of the first area followed by the second
+*/
+uint32_t csp_crc32_combine(uint32_t crc1, uint32_t crc2, uint32_t length2);
+
 /**
    Calculate checksum for a given memory area.
    @param[in] addr memory address
@@ -31,3 +77,29 @@ int csp_crc32_verify(csp_packet_t * packet);
 */
 uint32_t csp_crc32_memory(const uint8_t * addr, uint32_t length);
 
+
+/**
+   CRC32 kernels.
+   All kernels compute the same CRC-32C (Castagnoli), only the speed differs.
+*/
+typedef enum {
+	CSP_CRC32_KERNEL_AUTO,    //!< Fastest kernel supported by the CPU
+	CSP_CRC32_KERNEL_BYTE,    //!< Portable byte-wise table lookup
+	CSP_CRC32_KERNEL_SLICE8,  //!< Portable slicing-by-8, not built on AVR
+	CSP_CRC32_KERNEL_SSE42,   //!< x86-64 SSE4.2 crc32 instruction
+	CSP_CRC32_KERNEL_ARMV8,   //!< ARMv8 CRC32 extension
+} csp_crc32_kernel_t;
+
+/**
+   Select the kernel used by csp_crc32_memory().
+   The fastest available kernel is selected automatically on first use, so this is only needed for testing and benchmarking.
+   @param[in] kernel kernel to use
+   @return #CSP_ERR_NONE on success, #CSP_ERR_NOTSUP if the kernel is not built in or not supported by the CPU.
+*/
+int csp_crc32_set_kernel(csp_crc32_kernel_t kernel);
+
+/**
+   Get the kernel used by csp_crc32_memory().
+   @return selected kernel, never #CSP_CRC32_KERNEL_AUTO
+*/
+csp_crc32_kernel_t csp_crc32_get_kernel(void);
@@ -38,6 +38,7 @@ extern uint8_t csp_dbg_errno;
 #define CSP_DBG_ERR_ALREADY_CLOSED 10
 #define CSP_DBG_ERR_INVALID_POINTER 11
 #define CSP_DBG_ERR_CLOCK_SET_FAIL 12
+#define CSP_DBG_ERR_CONN_MAX 13 //!< csp_conf.conn_max was capped, see csp_conf_t
 
 /* CAN protocol specific errno */
 extern uint8_t csp_dbg_can_errno;
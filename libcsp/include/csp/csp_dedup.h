@@ -0,0 +1,57 @@
+#pragma once
+
+/**
+   @file
+
+   Packet deduplication, enabled by csp_conf_t.dedup.
+
+   Packets are identified by a hash over header and data, kept in an open-addressing hash set for a time window.
+   A packet seen again within the window is dropped, and counted on the incoming interface (csp_iface_t.dup).
+*/
+
+#include <csp/csp_types.h>
+
+/** Default number of entries in the hash set, must be a power of two */
+#ifndef CSP_DEDUP_SIZE
+#define CSP_DEDUP_SIZE 64
+#endif
+
+/** Default window in mS, a packet is a duplicate if seen less than this ago */
+#ifndef CSP_DEDUP_WINDOW_MS
+#define CSP_DEDUP_WINDOW_MS 100
+#endif
+
+/** Hash set entry, internal */
+typedef struct {
+	uint32_t hash;       //!< Packet hash, 0 if the entry is free
+	uint32_t timestamp;  //!< Time the packet was seen
+} csp_dedup_entry_t;
+
+/** Size in bytes of the storage needed for \a entries entries, see csp_dedup_set_storage() */
+#define CSP_DEDUP_STORAGE_SIZE(entries) ((entries) * sizeof(csp_dedup_entry_t))
+
+/**
+   Set hash set storage.
+
+   By default the hash set holds #CSP_DEDUP_SIZE entries. It must hold the packets received within the window, with
+   room to spare, e.g. twice the peak packet rate times the window. The set is cleared.
+   Call before the router task is started, or while no packets are routed.
+
+   @param[in] storage memory for the hash set, e.g. a static array of #CSP_DEDUP_STORAGE_SIZE(entries) bytes.
+   Must remain valid as long as deduplication is in use.
+   @param[in] size size of \a storage in bytes, only a power of two number of entries is used.
+   @return #CSP_ERR_NONE on success, #CSP_ERR_INVAL if \a storage is too small.
+*/
+int csp_dedup_set_storage(void * storage, size_t size);
+
+/**
+   Set deduplication window.
+   @param[in] window_ms window in mS.
+*/
+void csp_dedup_set_window(uint32_t window_ms);
+
+/**
+   Return deduplication window.
+   @return window in mS.
+*/
+uint32_t csp_dedup_get_window(void);
@@ -2,14 +2,31 @@
 
 #include <csp/csp_interface.h>
 
+#ifndef CSP_IFLIST_MAX
+#define CSP_IFLIST_MAX 16  //! Maximum number of interfaces, at most 32
+#endif
+
 /**
    Add interface to the list.
 
+   The subnet index is updated here, see csp_iflist_update().
+
    @param[in] iface interface. The interface must remain valid as long as the application is running.
-   @return #CSP_ERR_NONE on success, otherwise an error code.
+   @return #CSP_ERR_NONE on success, #CSP_ERR_ALREADY if the interface (or its name) is already added,
+   #CSP_ERR_NOMEM if #CSP_IFLIST_MAX interfaces are added.
 */
 int csp_iflist_add(csp_iface_t * iface);
 
+/**
+   Rebuild the subnet index from the address and netmask of all added interfaces.
+
+   The masks are precomputed when an interface is added. Drivers add their interface in the *_open_and_add_*()
+   calls, so if the address or netmask is set or changed afterwards, call this to take it into account.
+   The new index is built aside and published atomically, lookups by the router are never blocked.
+   Not thread safe against csp_iflist_add(), call both from the same task.
+*/
+void csp_iflist_update(void);
+
 csp_iface_t * csp_iflist_get_by_name(const char *name);
 csp_iface_t * csp_iflist_get_by_addr(uint16_t addr);
 csp_iface_t * csp_iflist_get_by_subnet(uint16_t addr, csp_iface_t * from);
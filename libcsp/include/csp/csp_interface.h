@@ -10,6 +10,13 @@
  */
 typedef int (*nexthop_t)(csp_iface_t * iface, uint16_t via, csp_packet_t * packet);
 
+/**
+ * Interface batched Tx function, optional.
+ * Packets are sent in order, and each sent packet is consumed (freed) by the interface.
+ * @return number of packets sent, the remaining packets are still owned by the caller.
+ */
+typedef unsigned int (*nexthop_batch_t)(csp_iface_t * iface, uint16_t via, csp_packet_t * packets[], unsigned int count);
+
 /* This struct is referenced in documentation.  Update doc when you change this. */
 struct csp_iface_s {
 
@@ -19,6 +26,7 @@ struct csp_iface_s {
 	void * interface_data;      // Interface data, only known/used by the interface layer, e.g. state information.
 	void * driver_data;         // Driver data, only known/used by the driver layer, e.g. device/channel references.
 	nexthop_t nexthop;          // Next hop (Tx) function
+	nexthop_batch_t nexthop_batch; // Next hop (Tx) function for several packets, NULL to call nexthop for each
 	uint16_t mtu;               // Maximum Transmission Unit of interface
 	uint8_t split_horizon_off;  // Disable the route-loop prevention
 	uint32_t tx;                // Successfully transmitted packets
@@ -26,11 +34,14 @@ struct csp_iface_s {
 	uint32_t tx_error;          // Transmit errors (packets)
 	uint32_t rx_error;          // Receive errors, e.g. too large message
 	uint32_t drop;              // Dropped packets
+	uint32_t dup;               // Duplicates dropped, see csp_conf_t.dedup
 	uint32_t autherr;           // Authentication errors (packets)
 	uint32_t frame;             // Frame format errors (packets)
 	uint32_t txbytes;           // Transmitted bytes
 	uint32_t rxbytes;           // Received bytes
 	uint32_t irq;               // Interrupts
+	struct csp_qos_s * qos;     // Egress scheduler, NULL if packets are sent directly, see csp_qos_attach()
+	uint8_t iflist_pos;         // Internal, position in the subnet index, see csp_iflist_update()
 	struct csp_iface_s * next;  // Internal, interfaces are stored in a linked list
 };
 
@@ -0,0 +1,48 @@
+#pragma once
+
+/**
+   @file
+
+   Offload of checksum and authentication work.
+
+   CRC32, HMAC and SipHash are normally calculated by the task sending a packet, and verified by the router task.
+   When csp_conf.offload_threshold is set, packets of at least that many bytes are handed to worker tasks instead.
+   The router continues with other packets, and delivers a packet once a worker has verified it. A sending task
+   returns as soon as its packet is queued, the worker appends the checks and transmits it.
+
+   Each flow (peer address and both ports) is served by one worker. While a flow has packets at a worker, its
+   smaller packets follow them through the same worker, so packets of a flow stay in order.
+
+   The application runs csp_offload_work() in a loop for every worker number below #CSP_OFFLOAD_WORKERS, each from
+   its own task, before setting the threshold.
+*/
+
+#include <csp/csp_types.h>
+
+/** Number of worker tasks */
+#ifndef CSP_OFFLOAD_WORKERS
+#define CSP_OFFLOAD_WORKERS 2
+#endif
+
+/** Number of packets each worker can hold */
+#ifndef CSP_OFFLOAD_QUEUE_LEN
+#define CSP_OFFLOAD_QUEUE_LEN 16
+#endif
+
+/** Time in mS a sending task waits for room at a worker, before the packet is dropped. The router task never waits */
+#ifndef CSP_OFFLOAD_TX_TIMEOUT
+#define CSP_OFFLOAD_TX_TIMEOUT 100
+#endif
+
+/** Time in mS a worker waits for room in the router queue, before a verified packet is dropped */
+#ifndef CSP_OFFLOAD_RX_TIMEOUT
+#define CSP_OFFLOAD_RX_TIMEOUT 100
+#endif
+
+/**
+   Process offloaded packets.
+   @param[in] worker worker number, from 0 to #CSP_OFFLOAD_WORKERS - 1.
+   @param[in] timeout max time in mS to wait for a packet.
+   @return #CSP_ERR_NONE if a packet was processed, #CSP_ERR_TIMEDOUT if none came, #CSP_ERR_INVAL for a bad worker number.
+*/
+int csp_offload_work(unsigned int worker, uint32_t timeout);
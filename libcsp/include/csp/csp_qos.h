@@ -0,0 +1,108 @@
+#pragma once
+
+/**
+   @file
+
+   Egress QoS scheduler.
+
+   An interface with a scheduler attached no longer transmits packets in arrival order. Outgoing packets are
+   queued per priority class (csp_id_t.pri) and served strict priority, with a starvation guard that lets a
+   waiting lower class through after a configurable number of higher priority packets.
+
+   Output can be shaped with a token bucket (bytes per second, burst in bytes), so the link rate is never
+   exceeded. Packets held back by the shaper are released by the sending task when tokens are available, and
+   otherwise by the router task, see csp_route_work().
+*/
+
+#include <csp/csp_interface.h>
+#include <csp/arch/csp_queue.h>
+
+/** Number of priority classes, one per #csp_prio_t */
+#define CSP_QOS_CLASSES 4
+
+/** Number of packets each priority class can hold, before packets are dropped */
+#ifndef CSP_QOS_QUEUE_LEN
+#define CSP_QOS_QUEUE_LEN 8
+#endif
+
+/**
+   Per class counters.
+*/
+typedef struct {
+	uint32_t enqueued;          //!< Packets accepted into the class queue
+	uint32_t sent;              //!< Packets sent by the interface, failed transmissions count in csp_iface_t.tx_error
+	uint32_t dropped;           //!< Packets dropped, because the class queue was full
+	uint32_t bytes;             //!< Bytes sent by the interface
+} csp_qos_stats_t;
+
+/**
+   Queue element, internal.
+*/
+typedef struct {
+	csp_packet_t * packet;
+	uint16_t via;
+} csp_qos_item_t;
+
+/**
+   QoS scheduler.
+
+   The configuration must be set before calling csp_qos_attach(), all other fields are internal.
+   The scheduler must remain valid as long as it is attached.
+*/
+typedef struct csp_qos_s {
+
+	/* Configuration */
+	uint32_t rate;              //!< Link rate in bytes per second, 0 disables shaping
+	uint32_t burst;             //!< Bucket depth in bytes, e.g. a few MTU
+	uint16_t overhead;          //!< Bytes added per packet below the scheduler, e.g. CSP header and link framing
+	uint8_t starvation_limit;   //!< Packets served ahead of a waiting class before it gets a turn, 0 = pure strict priority
+
+	/* Counters */
+	csp_qos_stats_t stats[CSP_QOS_CLASSES];
+
+	/* Internal */
+	csp_queue_handle_t queue[CSP_QOS_CLASSES];
+	csp_static_queue_t queue_static[CSP_QOS_CLASSES];
+	char queue_buffer[CSP_QOS_CLASSES][sizeof(csp_qos_item_t) * CSP_QOS_QUEUE_LEN];
+	csp_qos_item_t head[CSP_QOS_CLASSES];   // Dequeued, waiting for tokens
+	uint8_t waited[CSP_QOS_CLASSES];        // Packets served while this class was waiting
+	int64_t tokens;                         // Token bucket level in milli-bytes
+	int64_t deficit;                        // Tokens missing for the blocked packet, in milli-bytes
+	uint32_t last_refill;                   // Time of last refill [ms]
+	uint8_t busy;                           // Set while a task is dispatching
+} csp_qos_t;
+
+/**
+   Attach egress scheduler to interface.
+
+   Set the configuration in \a qos before calling this. The token bucket starts full.
+
+   @param[in] iface interface, packets sent to this interface will be scheduled.
+   @param[in] qos scheduler. Must remain valid as long as the interface is in use.
+   @return #CSP_ERR_NONE on success, otherwise an error code.
+*/
+int csp_qos_attach(csp_iface_t * iface, csp_qos_t * qos);
+
+/**
+   Detach egress scheduler from interface.
+
+   Packets still held by the scheduler are dropped.
+
+   @param[in] iface interface.
+*/
+void csp_qos_detach(csp_iface_t * iface);
+
+/**
+   Reset the per class counters of an interface scheduler.
+   @param[in] iface interface.
+*/
+void csp_qos_reset_stats(csp_iface_t * iface);
+
+#if (CSP_ENABLE_CSP_PRINT)
+/**
+   Print the per class counters of all scheduled interfaces.
+*/
+void csp_qos_print(void);
+#else
+inline void csp_qos_print(void) {}
+#endif
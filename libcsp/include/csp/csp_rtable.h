@@ -20,9 +20,68 @@ typedef struct csp_route_s {
 	uint16_t netmask;
    uint16_t via;
    csp_iface_t * iface;
+   uint32_t packets;  //!< Packets routed, kept across table changes as long as the subnet has a route
+   uint32_t bytes;    //!< Bytes routed
 } csp_route_t;
 
-csp_route_t * csp_rtable_find_route(uint16_t dest_address);
+/**
+   Number of netmasks in the lookup histogram, 0 to the host bits of CSP 2.0.
+*/
+#define CSP_RTABLE_HIST_LEN 15
+
+/**
+   Routing table lookup statistics.
+*/
+typedef struct {
+	uint32_t hits[CSP_RTABLE_HIST_LEN];  //!< Lookups matched, by netmask of the matching route. hits[0] is the default route.
+	uint32_t misses;                     //!< Lookups without a route
+} csp_rtable_stats_t;
+
+/**
+   Lookup index entry, internal.
+   The address space is split into ranges, each served by one route.
+*/
+typedef struct {
+	uint16_t start;
+	uint16_t route;
+} csp_rtable_range_t;
+
+/**
+   Size in bytes of the storage needed for \a routes routes, see csp_rtable_set_storage().
+*/
+#define CSP_RTABLE_STORAGE_SIZE(routes) (2 * (routes) * (sizeof(csp_route_t) + 2 * sizeof(csp_rtable_range_t)) + sizeof(void *))
+
+/**
+   Find route to destination address.
+   Longest prefix match, O(log n) in the number of routes.
+   The route is returned by value, like csp_rtable_lookup(), so it stays valid while the table is changed.
+   @param[in] dest_address destination address.
+   @return copy of the matching route, with \a iface set to NULL if no route matches.
+*/
+csp_route_t csp_rtable_find_route(uint16_t dest_address);
+
+/**
+   Find route to destination address, and copy it.
+   Lookups never lock, and always see a complete table, also while the table is being changed.
+   @param[in] dest_address destination address.
+   @param[out] route copy of the matching route.
+   @return true if a route matches.
+*/
+bool csp_rtable_lookup(uint16_t dest_address, csp_route_t * route);
+
+/**
+   Set routing table storage.
+
+   By default the routing table holds #CSP_RTABLE_SIZE routes. Use this to provide a larger (or smaller) table at
+   runtime, existing routes are moved to the new storage.
+
+   @param[in] storage memory for the table (both copies, see csp_rtable_import()), e.g. a static array of
+   #CSP_RTABLE_STORAGE_SIZE(routes) bytes.
+   Must remain valid as long as the routing table is in use.
+   @param[in] size size of \a storage in bytes.
+   @return #CSP_ERR_NONE on success, #CSP_ERR_NOMEM if the existing routes do not fit.
+*/
+int csp_rtable_set_storage(void * storage, size_t size);
 
 /**
    Set route to destination address/node.
@@ -30,7 +89,7 @@ csp_route_t * csp_rtable_find_route(uint16_t dest_address);
    @param[in] mask number of bits in netmask (set to -1 for maximum number of bits)
    @param[in] ifc interface.
    @param[in] via assosicated via address.
-   @return #CSP_ERR_NONE on success, or an error code.
+   @return #CSP_ERR_NONE on success, #CSP_ERR_NOMEM if the table is full, or an error code.
 */
 int csp_rtable_set(uint16_t dest_address, int netmask, csp_iface_t *ifc, uint16_t via);
 
@@ -49,12 +108,36 @@ int csp_rtable_save(char * buffer, size_t buffer_size);
    Table will be loaded on-top of existing routes, possibly overwriting existing entries.
    Format: \<address\>[/mask] \<interface\> [via][, next entry]
    Example: "0/0 CAN, 8 KISS, 10 I2C 10", same as "0/0 CAN, 8/5 KISS, 10/5 I2C 10".
+   The routes are applied as one update, see csp_rtable_import().
    @see csp_rtable_save(), csp_rtable_clear(), csp_rtable_free()
    @param[in] rtable routing table (nul terminated)
    @return @ref CSP_ERR or number of entries.
 */
 int csp_rtable_load(const char * rtable);
 
+/**
+   Import routes from a buffer.
+
+   All entries are validated and added to a copy of the routing table, which is then published in one atomic
+   update. If any entry is invalid, or the table is full, the routing table is left unchanged.
+   Format as csp_rtable_load(), entries may also be separated by newlines.
+
+   @param[in] buffer routes, does not have to be nul terminated.
+   @param[in] len length of \a buffer.
+   @param[in] replace replace all existing routes, otherwise routes are added on-top of the existing.
+   @return @ref CSP_ERR or number of entries.
+*/
+int csp_rtable_import(const char * buffer, size_t len, bool replace);
+
+/**
+   Import routes from a file.
+   Same as csp_rtable_import(), reading the file a line at a time.
+   @param[in] path file name.
+   @param[in] replace replace all existing routes, otherwise routes are added on-top of the existing.
+   @return @ref CSP_ERR or number of entries.
+*/
+int csp_rtable_import_file(const char * path, bool replace);
+
 /**
    Check string for valid routing elements.
    @param[in] rtable routing table (nul terminated)
@@ -65,6 +148,8 @@ int csp_rtable_check(const char * rtable);
 #else
 inline int csp_rtable_save(char * buffer, size_t buffer_size) { return CSP_ERR_NOSYS; }
 inline int csp_rtable_load(const char * rtable) { return CSP_ERR_NOSYS; }
+inline int csp_rtable_import(const char * buffer, size_t len, bool replace) { return CSP_ERR_NOSYS; }
+inline int csp_rtable_import_file(const char * path, bool replace) { return CSP_ERR_NOSYS; }
 inline int csp_rtable_check(const char * rtable) { return CSP_ERR_NOSYS; }
 #endif
 
@@ -79,11 +164,24 @@ void csp_rtable_clear(void);
 */
 void csp_rtable_free(void);
 
+/**
+   Get routing table lookup statistics.
+   Per route counters are part of the route, see csp_rtable_iterate().
+   @param[out] stats statistics.
+*/
+void csp_rtable_get_stats(csp_rtable_stats_t * stats);
+
+/**
+   Reset lookup statistics, and the counters of all routes.
+*/
+void csp_rtable_reset_stats(void);
+
 /** Iterator for looping through the routing table. */
 typedef bool (*csp_rtable_iterator_t)(void * ctx, csp_route_t * route);
 
 /**
    Iterate routing table.
+   Routes are visited in order of network address. Iteration stops when \a iter returns false.
 */
 void csp_rtable_iterate(csp_rtable_iterator_t iter, void * ctx);
 
@@ -62,9 +62,11 @@ typedef struct  __attribute__((packed)) {
 */
 #define CSP_FRES1			0x80 //!< Reserved for future use
 #define CSP_FRES2			0x40 //!< Reserved for future use
-#define CSP_FRES3			0x20 //!< Reserved for future use
+#define CSP_FCREDIT			0x20 //!< Use credit flow control
+#define CSP_FRES3			CSP_FCREDIT //!< Deprecated, was reserved before #CSP_FCREDIT
 #define CSP_FFRAG			0x10 //!< Use fragmentation
 #define CSP_FHMAC			0x08 //!< Use HMAC verification
+#define CSP_FSIPHASH			0x04 //!< Use SipHash verification. Sent as #CSP_FRES2 in CSP 1.x headers, where 0x04 is XTEA
 #define CSP_FRDP			0x02 //!< Use RDP protocol
 #define CSP_FCRC32			0x01 //!< Use CRC32 checksum
 /**@}*/
@@ -78,6 +80,8 @@ typedef struct  __attribute__((packed)) {
 #define CSP_SO_RDPPROHIB		0x0002 //!< Prohibit RDP
 #define CSP_SO_HMACREQ			0x0004 //!< Require HMAC
 #define CSP_SO_HMACPROHIB		0x0008 //!< Prohibit HMAC
+#define CSP_SO_SIPHASHREQ		0x0010 //!< Require SipHash
+#define CSP_SO_SIPHASHPROHIB		0x0020 //!< Prohibit SipHash
 #define CSP_SO_CRC32REQ			0x0040 //!< Require CRC32
 #define CSP_SO_CRC32PROHIB		0x0080 //!< Prohibit CRC32
 #define CSP_SO_CONN_LESS		0x0100 //!< Enable Connection Less mode
@@ -91,8 +95,13 @@ typedef struct  __attribute__((packed)) {
 #define CSP_O_NORDP			CSP_SO_RDPPROHIB   //!< Disable RDP
 #define CSP_O_HMAC			CSP_SO_HMACREQ     //!< Enable HMAC
 #define CSP_O_NOHMAC			CSP_SO_HMACPROHIB  //!< Disable HMAC
+#define CSP_O_SIPHASH			CSP_SO_SIPHASHREQ  //!< Enable SipHash (instead of HMAC)
+#define CSP_O_NOSIPHASH			CSP_SO_SIPHASHPROHIB //!< Disable SipHash
 #define CSP_O_CRC32			CSP_SO_CRC32REQ    //!< Enable CRC32
 #define CSP_O_NOCRC32			CSP_SO_CRC32PROHIB //!< Disable CRC32
+#define CSP_O_KEEPALIVE			0x0200             //!< Reuse connections for transactions, see csp_transaction_w_opts()
+#define CSP_O_NONBLOCK			0x0400             //!< Return from csp_connect() before the RDP handshake, see csp_conn_wait_open()
+#define CSP_O_CREDIT			0x0800             //!< Enable credit flow control (ignored with RDP), see csp_send_nonblock()
 #define CSP_O_SAME			CSP_SO_SAME
 
 #ifndef CSP_PACKET_PADDING_BYTES
@@ -186,6 +195,7 @@ struct csp_socket_s {
 	char rx_queue_static_data[sizeof(csp_packet_t *) * CSP_CONN_RXQUEUE_LEN];
 
 	uint32_t opts;              /* Connection or socket options */
+	struct csp_buffer_pool_s * rx_pool; /* Application pool for received packets, NULL for the global pool */
 };
 
 /** Forward declaration of socket structure */
@@ -51,6 +51,10 @@ typedef struct {
 	bool rx_first;
 	/** CSP packet for storing Rx data. */
 	csp_packet_t * rx_packet;
+	/** Rx CRC32 state, updated as data arrives */
+	uint32_t rx_crc;
+	/** Number of Rx bytes included in rx_crc */
+	unsigned int rx_crc_length;
 } csp_kiss_interface_data_t;
 
 /**
@@ -70,6 +74,13 @@ int csp_kiss_add_interface(csp_iface_t * iface);
 */
 int csp_kiss_tx(csp_iface_t * iface, uint16_t via, csp_packet_t * packet);
 
+/**
+   Send several CSP packets over KISS (nexthop_batch), locking the driver once.
+
+   @return number of packets sent, always \a count.
+*/
+unsigned int csp_kiss_tx_batch(csp_iface_t * iface, uint16_t via, csp_packet_t * packets[], unsigned int count);
+
 /**
    Process received CAN frame.
 
@@ -6,6 +6,15 @@ typedef struct {
 	/* Should be set before calling if_tun_init */
 	int tun_src;
 	int tun_dst;
+
+	/* Built-in ChaCha20-Poly1305 key (CSP_CHACHA20POLY1305_KEYSIZE bytes), or NULL to use csp_crypto_encrypt/decrypt */
+	const uint8_t * key;
+	/* Nonce prefix, non-zero and different for the two ends of a tunnel sharing a key. Nonces must never repeat
+	 * under a key: use a new random salt on every boot, or a fixed salt with tx_counter persisted across boots */
+	uint32_t salt;
+
+	/* Next nonce counter, 0 or restored from persistent storage. Transmission stops when it is exhausted */
+	uint64_t tx_counter;
 } csp_if_tun_conf_t;
 
 void csp_if_tun_init(csp_iface_t * iface, csp_if_tun_conf_t * ifconf);
@@ -63,3 +63,7 @@ int csp_bin_sem_post(csp_bin_sem_t * sem) {
 }
 
 #endif
+
+void * csp_task_self(void) {
+	return (void *)xTaskGetCurrentTaskHandle();
+}
@@ -4,6 +4,7 @@
 #include <csp/csp.h>
 #include <csp/csp_debug.h>
 
+#include <pthread.h>
 #include <semaphore.h>
 #include <time.h>
 
@@ -58,3 +59,7 @@ int csp_bin_sem_post(csp_bin_sem_t * sem) {
 
 	return CSP_SEMAPHORE_ERROR;
 }
+
+void * csp_task_self(void) {
+	return (void *)(uintptr_t)pthread_self();
+}
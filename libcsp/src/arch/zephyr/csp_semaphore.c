@@ -46,3 +46,7 @@ int csp_bin_sem_post_isr(csp_bin_sem_t * sem, int * unused) {
 
 	return csp_bin_sem_post(sem);
 }
+
+void * csp_task_self(void) {
+	return (void *)k_current_get();
+}
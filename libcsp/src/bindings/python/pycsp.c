@@ -1038,6 +1038,7 @@ PyMODINIT_FUNC PyInit_libcsp_py3(void) {
 	/* FLAGS */
 	PyModule_AddIntConstant(m, "CSP_FFRAG", CSP_FFRAG);
 	PyModule_AddIntConstant(m, "CSP_FHMAC", CSP_FHMAC);
+	PyModule_AddIntConstant(m, "CSP_FSIPHASH", CSP_FSIPHASH);
 	PyModule_AddIntConstant(m, "CSP_FRDP", CSP_FRDP);
 	PyModule_AddIntConstant(m, "CSP_FCRC32", CSP_FCRC32);
 
@@ -1047,6 +1048,8 @@ PyMODINIT_FUNC PyInit_libcsp_py3(void) {
 	PyModule_AddIntConstant(m, "CSP_SO_RDPPROHIB", CSP_SO_RDPPROHIB);
 	PyModule_AddIntConstant(m, "CSP_SO_HMACREQ", CSP_SO_HMACREQ);
 	PyModule_AddIntConstant(m, "CSP_SO_HMACPROHIB", CSP_SO_HMACPROHIB);
+	PyModule_AddIntConstant(m, "CSP_SO_SIPHASHREQ", CSP_SO_SIPHASHREQ);
+	PyModule_AddIntConstant(m, "CSP_SO_SIPHASHPROHIB", CSP_SO_SIPHASHPROHIB);
 	PyModule_AddIntConstant(m, "CSP_SO_CRC32REQ", CSP_SO_CRC32REQ);
 	PyModule_AddIntConstant(m, "CSP_SO_CRC32PROHIB", CSP_SO_CRC32PROHIB);
 	PyModule_AddIntConstant(m, "CSP_SO_CONN_LESS", CSP_SO_CONN_LESS);
@@ -1057,6 +1060,8 @@ PyMODINIT_FUNC PyInit_libcsp_py3(void) {
 	PyModule_AddIntConstant(m, "CSP_O_NORDP", CSP_O_NORDP);
 	PyModule_AddIntConstant(m, "CSP_O_HMAC", CSP_O_HMAC);
 	PyModule_AddIntConstant(m, "CSP_O_NOHMAC", CSP_O_NOHMAC);
+	PyModule_AddIntConstant(m, "CSP_O_SIPHASH", CSP_O_SIPHASH);
+	PyModule_AddIntConstant(m, "CSP_O_NOSIPHASH", CSP_O_NOSIPHASH);
 	PyModule_AddIntConstant(m, "CSP_O_CRC32", CSP_O_CRC32);
 	PyModule_AddIntConstant(m, "CSP_O_NOCRC32", CSP_O_NOCRC32);
 
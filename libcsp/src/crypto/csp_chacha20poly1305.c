@@ -0,0 +1,416 @@
+/* ChaCha20-Poly1305 AEAD (RFC 8439), Poly1305 based on poly1305-donna */
+
+#include <csp/crypto/csp_chacha20poly1305.h>
+
+#include <string.h>
+
+#include <csp/csp_error.h>
+
+/* Rotate left macro, works on scalars and vectors */
+#define ROL(x, y) (((x) << (y)) | ((x) >> (32 - y)))
+
+/* Little endian load and store, independent of host endianness and alignment */
+#define LOAD32L(y)                        \
+	(((uint32_t)((y)[0] & 0xff) << 0) |  \
+	 ((uint32_t)((y)[1] & 0xff) << 8) |  \
+	 ((uint32_t)((y)[2] & 0xff) << 16) | \
+	 ((uint32_t)((y)[3] & 0xff) << 24))
+
+#define STORE32L(x, y)                          \
+	do {                                        \
+		(y)[0] = (uint8_t)(((x) >> 0) & 0xff);  \
+		(y)[1] = (uint8_t)(((x) >> 8) & 0xff);  \
+		(y)[2] = (uint8_t)(((x) >> 16) & 0xff); \
+		(y)[3] = (uint8_t)(((x) >> 24) & 0xff); \
+	} while (0)
+
+#ifndef MIN
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CSP_CHACHA20_HAVE_X86 1
+#endif
+
+#define CSP_CHACHA20_BLOCKSIZE 64
+
+#define QR(a, b, c, d)     \
+	do {                   \
+		a += b;            \
+		d ^= a;            \
+		d = ROL(d, 16);    \
+		c += d;            \
+		b ^= c;            \
+		b = ROL(b, 12);    \
+		a += b;            \
+		d ^= a;            \
+		d = ROL(d, 8);     \
+		c += d;            \
+		b ^= c;            \
+		b = ROL(b, 7);     \
+	} while (0)
+
+/* 20 rounds: 10 column and diagonal double rounds */
+#define CHACHA20_ROUNDS(x)                       \
+	do {                                         \
+		for (unsigned int r = 0; r < 10; r++) {  \
+			QR(x[0], x[4], x[8], x[12]);         \
+			QR(x[1], x[5], x[9], x[13]);         \
+			QR(x[2], x[6], x[10], x[14]);        \
+			QR(x[3], x[7], x[11], x[15]);        \
+			QR(x[0], x[5], x[10], x[15]);        \
+			QR(x[1], x[6], x[11], x[12]);        \
+			QR(x[2], x[7], x[8], x[13]);         \
+			QR(x[3], x[4], x[9], x[14]);         \
+		}                                        \
+	} while (0)
+
+static void csp_chacha20_setup(uint32_t in[16], const uint8_t * key, uint32_t counter, const uint8_t * nonce) {
+
+	/* "expand 32-byte k" */
+	in[0] = 0x61707865;
+	in[1] = 0x3320646e;
+	in[2] = 0x79622d32;
+	in[3] = 0x6b206574;
+	for (unsigned int i = 0; i < 8; i++) {
+		in[4 + i] = LOAD32L(key + (4 * i));
+	}
+	in[12] = counter;
+	for (unsigned int i = 0; i < 3; i++) {
+		in[13 + i] = LOAD32L(nonce + (4 * i));
+	}
+}
+
+/* One 64 byte keystream block for the counter in in[12] */
+static void csp_chacha20_block(const uint32_t in[16], uint8_t * ks) {
+
+	uint32_t x[16];
+	memcpy(x, in, sizeof(x));
+
+	CHACHA20_ROUNDS(x);
+
+	for (unsigned int i = 0; i < 16; i++) {
+		STORE32L(x[i] + in[i], ks + (4 * i));
+	}
+}
+
+/* Vector engine: consecutive blocks side by side, one counter per vector lane */
+#define CSP_CHACHA20_LANES 8
+
+typedef uint32_t csp_chacha20_vec_t __attribute__((vector_size(4 * CSP_CHACHA20_LANES)));
+
+static inline __attribute__((always_inline)) void csp_chacha20_lanes(const uint32_t in[16], uint8_t * ks) {
+
+	csp_chacha20_vec_t x[16], lane;
+	unsigned int i, l;
+
+	for (l = 0; l < CSP_CHACHA20_LANES; l++) {
+		lane[l] = l;
+	}
+	for (i = 0; i < 16; i++) {
+		x[i] = (csp_chacha20_vec_t){0} + in[i];
+	}
+	x[12] += lane;
+
+	CHACHA20_ROUNDS(x);
+
+	for (i = 0; i < 16; i++) {
+		x[i] += in[i];
+	}
+	x[12] += lane;
+
+	/* Transpose: lane l of x[i] is word i of block l */
+	for (l = 0; l < CSP_CHACHA20_LANES; l++) {
+		for (i = 0; i < 16; i++) {
+			STORE32L(x[i][l], ks + (CSP_CHACHA20_BLOCKSIZE * l) + (4 * i));
+		}
+	}
+}
+
+typedef void (*csp_chacha20_lanes_fn_t)(const uint32_t in[16], uint8_t * ks);
+
+/* Lowered to whatever vector width the target has (SSE2, NEON) or to scalar code */
+static void csp_chacha20_lanes_generic(const uint32_t in[16], uint8_t * ks) {
+	csp_chacha20_lanes(in, ks);
+}
+
+#if (CSP_CHACHA20_HAVE_X86)
+__attribute__((target("avx2")))
+static void csp_chacha20_lanes_avx2(const uint32_t in[16], uint8_t * ks) {
+	csp_chacha20_lanes(in, ks);
+}
+#endif
+
+static csp_chacha20_lanes_fn_t csp_chacha20_lanes_fn(void) {
+
+#if (CSP_CHACHA20_HAVE_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return csp_chacha20_lanes_avx2;
+	}
+#endif
+#if defined(__SSE2__) || defined(__ARM_NEON)
+	return csp_chacha20_lanes_generic;
+#else
+	(void)csp_chacha20_lanes_generic;
+	return NULL;
+#endif
+}
+
+/* XOR keystream into data, starting at the block counter in in[12] */
+static void csp_chacha20_xor(uint32_t in[16], uint8_t * data, uint32_t length) {
+
+	uint8_t ks[CSP_CHACHA20_LANES * CSP_CHACHA20_BLOCKSIZE];
+
+	/* Lanes pay off from three blocks, a few spare blocks of keystream are cheaper than scalar rounds */
+	csp_chacha20_lanes_fn_t lanes = NULL;
+	if (length > 2 * CSP_CHACHA20_BLOCKSIZE) {
+		lanes = csp_chacha20_lanes_fn();
+	}
+
+	while (length > 0) {
+		uint32_t n;
+		if ((lanes != NULL) && (length > 2 * CSP_CHACHA20_BLOCKSIZE)) {
+			lanes(in, ks);
+			n = MIN(length, sizeof(ks));
+			in[12] += CSP_CHACHA20_LANES;
+		} else {
+			csp_chacha20_block(in, ks);
+			n = MIN(length, CSP_CHACHA20_BLOCKSIZE);
+			in[12] += 1;
+		}
+		for (uint32_t i = 0; i < n; i++) {
+			data[i] ^= ks[i];
+		}
+		data += n;
+		length -= n;
+	}
+
+	memset(ks, 0, sizeof(ks));
+}
+
+/* Poly1305 with 26 bit limbs */
+typedef struct {
+	uint32_t r[5];
+	uint32_t h[5];
+	uint32_t pad[4];
+} csp_poly1305_state_t;
+
+static void csp_poly1305_init(csp_poly1305_state_t * st, const uint8_t * key) {
+
+	/* r &= 0xffffffc0ffffffc0ffffffc0fffffff */
+	st->r[0] = (LOAD32L(key + 0)) & 0x3ffffff;
+	st->r[1] = (LOAD32L(key + 3) >> 2) & 0x3ffff03;
+	st->r[2] = (LOAD32L(key + 6) >> 4) & 0x3ffc0ff;
+	st->r[3] = (LOAD32L(key + 9) >> 6) & 0x3f03fff;
+	st->r[4] = (LOAD32L(key + 12) >> 8) & 0x00fffff;
+
+	memset(st->h, 0, sizeof(st->h));
+
+	for (unsigned int i = 0; i < 4; i++) {
+		st->pad[i] = LOAD32L(key + 16 + (4 * i));
+	}
+}
+
+/* Full 16 byte blocks only, the AEAD construction zero pads everything */
+static void csp_poly1305_blocks(csp_poly1305_state_t * st, const uint8_t * m, uint32_t blocks) {
+
+	const uint32_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2], r3 = st->r[3], r4 = st->r[4];
+	const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+	uint32_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2], h3 = st->h[3], h4 = st->h[4];
+
+	while (blocks--) {
+		uint64_t d0, d1, d2, d3, d4;
+		uint32_t c;
+
+		/* h += m[i] */
+		h0 += (LOAD32L(m + 0)) & 0x3ffffff;
+		h1 += (LOAD32L(m + 3) >> 2) & 0x3ffffff;
+		h2 += (LOAD32L(m + 6) >> 4) & 0x3ffffff;
+		h3 += (LOAD32L(m + 9) >> 6) & 0x3ffffff;
+		h4 += (LOAD32L(m + 12) >> 8) | (1UL << 24);
+
+		/* h *= r */
+		d0 = ((uint64_t)h0 * r0) + ((uint64_t)h1 * s4) + ((uint64_t)h2 * s3) + ((uint64_t)h3 * s2) + ((uint64_t)h4 * s1);
+		d1 = ((uint64_t)h0 * r1) + ((uint64_t)h1 * r0) + ((uint64_t)h2 * s4) + ((uint64_t)h3 * s3) + ((uint64_t)h4 * s2);
+		d2 = ((uint64_t)h0 * r2) + ((uint64_t)h1 * r1) + ((uint64_t)h2 * r0) + ((uint64_t)h3 * s4) + ((uint64_t)h4 * s3);
+		d3 = ((uint64_t)h0 * r3) + ((uint64_t)h1 * r2) + ((uint64_t)h2 * r1) + ((uint64_t)h3 * r0) + ((uint64_t)h4 * s4);
+		d4 = ((uint64_t)h0 * r4) + ((uint64_t)h1 * r3) + ((uint64_t)h2 * r2) + ((uint64_t)h3 * r1) + ((uint64_t)h4 * r0);
+
+		/* (partial) h %= p */
+		c = (uint32_t)(d0 >> 26);
+		h0 = (uint32_t)d0 & 0x3ffffff;
+		d1 += c;
+		c = (uint32_t)(d1 >> 26);
+		h1 = (uint32_t)d1 & 0x3ffffff;
+		d2 += c;
+		c = (uint32_t)(d2 >> 26);
+		h2 = (uint32_t)d2 & 0x3ffffff;
+		d3 += c;
+		c = (uint32_t)(d3 >> 26);
+		h3 = (uint32_t)d3 & 0x3ffffff;
+		d4 += c;
+		c = (uint32_t)(d4 >> 26);
+		h4 = (uint32_t)d4 & 0x3ffffff;
+		h0 += c * 5;
+		c = h0 >> 26;
+		h0 &= 0x3ffffff;
+		h1 += c;
+
+		m += 16;
+	}
+
+	st->h[0] = h0;
+	st->h[1] = h1;
+	st->h[2] = h2;
+	st->h[3] = h3;
+	st->h[4] = h4;
+}
+
+/* Blocks of data, the last one zero padded */
+static void csp_poly1305_pad16(csp_poly1305_state_t * st, const uint8_t * m, uint32_t length) {
+
+	csp_poly1305_blocks(st, m, length / 16);
+
+	uint32_t rem = length % 16;
+	if (rem > 0) {
+		uint8_t block[16] = {0};
+		memcpy(block, m + (length - rem), rem);
+		csp_poly1305_blocks(st, block, 1);
+	}
+}
+
+static void csp_poly1305_done(csp_poly1305_state_t * st, uint8_t * tag) {
+
+	uint32_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2], h3 = st->h[3], h4 = st->h[4];
+	uint32_t g0, g1, g2, g3, g4, c, mask;
+	uint64_t f;
+
+	/* Fully carry h */
+	c = h1 >> 26;
+	h1 &= 0x3ffffff;
+	h2 += c;
+	c = h2 >> 26;
+	h2 &= 0x3ffffff;
+	h3 += c;
+	c = h3 >> 26;
+	h3 &= 0x3ffffff;
+	h4 += c;
+	c = h4 >> 26;
+	h4 &= 0x3ffffff;
+	h0 += c * 5;
+	c = h0 >> 26;
+	h0 &= 0x3ffffff;
+	h1 += c;
+
+	/* Compute h + -p */
+	g0 = h0 + 5;
+	c = g0 >> 26;
+	g0 &= 0x3ffffff;
+	g1 = h1 + c;
+	c = g1 >> 26;
+	g1 &= 0x3ffffff;
+	g2 = h2 + c;
+	c = g2 >> 26;
+	g2 &= 0x3ffffff;
+	g3 = h3 + c;
+	c = g3 >> 26;
+	g3 &= 0x3ffffff;
+	g4 = h4 + c - (1UL << 26);
+
+	/* Select h if h < p, or h + -p if h >= p, without branching */
+	mask = (g4 >> 31) - 1;
+	g0 &= mask;
+	g1 &= mask;
+	g2 &= mask;
+	g3 &= mask;
+	g4 &= mask;
+	mask = ~mask;
+	h0 = (h0 & mask) | g0;
+	h1 = (h1 & mask) | g1;
+	h2 = (h2 & mask) | g2;
+	h3 = (h3 & mask) | g3;
+	h4 = (h4 & mask) | g4;
+
+	/* h = h % (2^128) */
+	h0 = (h0) | (h1 << 26);
+	h1 = (h1 >> 6) | (h2 << 20);
+	h2 = (h2 >> 12) | (h3 << 14);
+	h3 = (h3 >> 18) | (h4 << 8);
+
+	/* tag = (h + pad) % (2^128) */
+	f = (uint64_t)h0 + st->pad[0];
+	h0 = (uint32_t)f;
+	f = (uint64_t)h1 + st->pad[1] + (f >> 32);
+	h1 = (uint32_t)f;
+	f = (uint64_t)h2 + st->pad[2] + (f >> 32);
+	h2 = (uint32_t)f;
+	f = (uint64_t)h3 + st->pad[3] + (f >> 32);
+	h3 = (uint32_t)f;
+
+	STORE32L(h0, tag + 0);
+	STORE32L(h1, tag + 4);
+	STORE32L(h2, tag + 8);
+	STORE32L(h3, tag + 12);
+
+	memset(st, 0, sizeof(*st));
+}
+
+/* Poly1305 over pad16(ad) | pad16(ciphertext) | le64(ad_length) | le64(length), keyed from block 0 */
+static void csp_chacha20poly1305_tag(uint32_t in[16], const void * ad, uint32_t ad_length, const uint8_t * data, uint32_t length, uint8_t * tag) {
+
+	uint8_t block0[CSP_CHACHA20_BLOCKSIZE];
+	csp_poly1305_state_t st;
+
+	in[12] = 0;
+	csp_chacha20_block(in, block0);
+	csp_poly1305_init(&st, block0);
+	memset(block0, 0, sizeof(block0));
+
+	csp_poly1305_pad16(&st, ad, ad_length);
+	csp_poly1305_pad16(&st, data, length);
+
+	uint8_t lengths[16] = {0};
+	STORE32L(ad_length, lengths);
+	STORE32L(length, lengths + 8);
+	csp_poly1305_blocks(&st, lengths, 1);
+
+	csp_poly1305_done(&st, tag);
+}
+
+void csp_chacha20poly1305_encrypt(const uint8_t * key, const uint8_t * nonce, const void * ad, uint32_t ad_length, uint8_t * data, uint32_t length, uint8_t * tag) {
+
+	uint32_t in[16];
+	csp_chacha20_setup(in, key, 1, nonce);
+
+	csp_chacha20_xor(in, data, length);
+	csp_chacha20poly1305_tag(in, ad, ad_length, data, length, tag);
+
+	memset(in, 0, sizeof(in));
+}
+
+int csp_chacha20poly1305_decrypt(const uint8_t * key, const uint8_t * nonce, const void * ad, uint32_t ad_length, uint8_t * data, uint32_t length, const uint8_t * tag) {
+
+	uint32_t in[16];
+	uint8_t calc[CSP_CHACHA20POLY1305_TAGSIZE];
+	csp_chacha20_setup(in, key, 0, nonce);
+
+	csp_chacha20poly1305_tag(in, ad, ad_length, data, length, calc);
+
+	/* Constant time compare */
+	uint8_t diff = 0;
+	for (unsigned int i = 0; i < CSP_CHACHA20POLY1305_TAGSIZE; i++) {
+		diff |= calc[i] ^ tag[i];
+	}
+
+	if (diff != 0) {
+		memset(in, 0, sizeof(in));
+		return CSP_ERR_HMAC;
+	}
+
+	in[12] = 1;
+	csp_chacha20_xor(in, data, length);
+
+	memset(in, 0, sizeof(in));
+	return CSP_ERR_NONE;
+}
@@ -8,20 +8,26 @@
 
 #include <csp/csp_buffer.h>
 #include <csp/crypto/csp_sha1.h>
+#include <csp/crypto/csp_siphash.h>
 
 #define HMAC_KEY_LENGTH 16
 
 /* HMAC key */
 static uint8_t csp_hmac_key[HMAC_KEY_LENGTH];
 
-/* HMAC state structure */
+/* HMAC state structure: SHA1 states with the inner and outer key blocks already processed */
 typedef struct {
-	csp_sha1_state_t md;
-	uint8_t key[CSP_SHA1_BLOCKSIZE];
+	csp_sha1_state_t inner;
+	csp_sha1_state_t outer;
 } hmac_state;
 
+/* Keyed state for csp_hmac_key, built by csp_hmac_key_init() and updated by csp_hmac_set_key() */
+static hmac_state csp_hmac_state;
+static bool csp_hmac_state_valid;
+
 static int csp_hmac_init(hmac_state * hmac, const uint8_t * key, uint32_t keylen) {
 	uint32_t i;
+	uint8_t hkey[CSP_SHA1_BLOCKSIZE];
 	uint8_t buf[CSP_SHA1_BLOCKSIZE];
 
 	/* NULL pointer and key check */
@@ -30,64 +36,55 @@ static int csp_hmac_init(hmac_state * hmac, const uint8_t * key, uint32_t keylen
 
 	/* Make sure we have a large enough key */
 	if (keylen > CSP_SHA1_BLOCKSIZE) {
-		csp_sha1_memory(key, keylen, hmac->key);
+		csp_sha1_memory(key, keylen, hkey);
 		if (CSP_SHA1_DIGESTSIZE < CSP_SHA1_BLOCKSIZE)
-			memset((hmac->key) + CSP_SHA1_DIGESTSIZE, 0, (CSP_SHA1_BLOCKSIZE - CSP_SHA1_DIGESTSIZE));
+			memset(hkey + CSP_SHA1_DIGESTSIZE, 0, (CSP_SHA1_BLOCKSIZE - CSP_SHA1_DIGESTSIZE));
 	} else {
-		memcpy(hmac->key, key, keylen);
+		memcpy(hkey, key, keylen);
 		if (keylen < CSP_SHA1_BLOCKSIZE)
-			memset((hmac->key) + keylen, 0, (CSP_SHA1_BLOCKSIZE - keylen));
+			memset(hkey + keylen, 0, (CSP_SHA1_BLOCKSIZE - keylen));
 	}
 
 	/* Create the initial vector */
 	for (i = 0; i < CSP_SHA1_BLOCKSIZE; i++) {
-		buf[i] = hmac->key[i] ^ 0x36;
+		buf[i] = hkey[i] ^ 0x36;
 	}
 
-	/* Prepend to the hash data */
-	csp_sha1_init(&hmac->md);
-	csp_sha1_process(&hmac->md, buf, CSP_SHA1_BLOCKSIZE);
-
-	return CSP_ERR_NONE;
-}
+	/* Prepend to the inner hash data */
+	csp_sha1_init(&hmac->inner);
+	csp_sha1_process(&hmac->inner, buf, CSP_SHA1_BLOCKSIZE);
 
-static int csp_hmac_process(hmac_state * hmac, const uint8_t * in, uint32_t inlen) {
+	/* Create the second HMAC vector */
+	for (i = 0; i < CSP_SHA1_BLOCKSIZE; i++) {
+		buf[i] = hkey[i] ^ 0x5C;
+	}
 
-	/* NULL pointer check */
-	if (!hmac || !in)
-		return CSP_ERR_INVAL;
+	/* Prepend to the outer hash data */
+	csp_sha1_init(&hmac->outer);
+	csp_sha1_process(&hmac->outer, buf, CSP_SHA1_BLOCKSIZE);
 
-	/* Process data */
-	csp_sha1_process(&hmac->md, in, inlen);
+	/* Don't leave key material on the stack */
+	memset(hkey, 0, sizeof(hkey));
+	memset(buf, 0, sizeof(buf));
 
 	return CSP_ERR_NONE;
 }
 
-static int csp_hmac_done(hmac_state * hmac, uint8_t * out) {
+/* Calculate HMAC from a keyed state, which is not modified */
+static void csp_hmac_keyed(const hmac_state * hmac, const void * data, uint32_t datalen, uint8_t * out) {
 
-	if (!hmac || !out)
-		return CSP_ERR_INVAL;
+	csp_sha1_state_t md;
 
 	/* Get the hash of the first HMAC vector plus the data */
 	uint8_t isha[CSP_SHA1_DIGESTSIZE];
-	csp_sha1_done(&hmac->md, isha);
-
-	/* Create the second HMAC vector vector */
-	uint8_t buf[CSP_SHA1_BLOCKSIZE];
-	for (unsigned int i = 0; i < sizeof(buf); i++) {
-		buf[i] = hmac->key[i] ^ 0x5C;
-	}
+	md = hmac->inner;
+	csp_sha1_process(&md, data, datalen);
+	csp_sha1_done(&md, isha);
 
 	/* Now calculate the outer hash */
-	csp_sha1_init(&hmac->md);
-	csp_sha1_process(&hmac->md, buf, sizeof(buf));
-	csp_sha1_process(&hmac->md, isha, sizeof(isha));
-	csp_sha1_done(&hmac->md, buf);
-
-	/* Copy to output  */
-	memcpy(out, buf, CSP_SHA1_DIGESTSIZE);
-
-	return CSP_ERR_NONE;
+	md = hmac->outer;
+	csp_sha1_process(&md, isha, sizeof(isha));
+	csp_sha1_done(&md, out);
 }
 
 int csp_hmac_memory(const void * key, uint32_t keylen, const void * data, uint32_t datalen, uint8_t * hmac) {
@@ -101,17 +98,21 @@ int csp_hmac_memory(const void * key, uint32_t keylen, const void * data, uint32
 	if (csp_hmac_init(&state, key, keylen) != 0)
 		return CSP_ERR_INVAL;
 
-	/* Process data */
-	if (csp_hmac_process(&state, data, datalen) != 0)
-		return CSP_ERR_INVAL;
-
-	/* Output HMAC */
-	if (csp_hmac_done(&state, hmac) != 0)
-		return CSP_ERR_INVAL;
+	/* Process data and output HMAC */
+	csp_hmac_keyed(&state, data, datalen, hmac);
 
 	return CSP_ERR_NONE;
 }
 
+void csp_hmac_key_init(void) {
+
+	/* No key set yet, use the all zero default key */
+	if (!csp_hmac_state_valid) {
+		csp_hmac_init(&csp_hmac_state, csp_hmac_key, sizeof(csp_hmac_key));
+		csp_hmac_state_valid = true;
+	}
+}
+
 int csp_hmac_set_key(const void * key, uint32_t keylen) {
 
 	/* Use SHA1 as KDF */
@@ -121,7 +122,12 @@ int csp_hmac_set_key(const void * key, uint32_t keylen) {
 	/* Copy key */
 	memcpy(csp_hmac_key, hash, sizeof(csp_hmac_key));
 
-	return CSP_ERR_NONE;
+	/* Hash the inner and outer key blocks once, instead of for every packet */
+	csp_hmac_init(&csp_hmac_state, csp_hmac_key, sizeof(csp_hmac_key));
+	csp_hmac_state_valid = true;
+
+	/* The same key configures the SipHash option */
+	return csp_siphash_set_key(key, keylen);
 }
 
 int csp_hmac_append(csp_packet_t * packet, bool include_header) {
@@ -136,13 +142,13 @@ int csp_hmac_append(csp_packet_t * packet, bool include_header) {
 	if (include_header) {
 
 		/* If header is included, csp_id_prepend() must be called beforehand */
-		csp_hmac_memory(csp_hmac_key, sizeof(csp_hmac_key), packet->frame_begin, packet->frame_length, hmac);
+		csp_hmac_keyed(&csp_hmac_state, packet->frame_begin, packet->frame_length, hmac);
 		memcpy(&packet->frame_begin[packet->frame_length], hmac, CSP_HMAC_LENGTH);
 		packet->frame_length += CSP_HMAC_LENGTH;
 
 	} else {
 
-		csp_hmac_memory(csp_hmac_key, sizeof(csp_hmac_key), packet->data, packet->length, hmac);
+		csp_hmac_keyed(&csp_hmac_state, packet->data, packet->length, hmac);
 		memcpy(&packet->data[packet->length], hmac, CSP_HMAC_LENGTH);
 		packet->length += CSP_HMAC_LENGTH;
 	}
@@ -161,7 +167,7 @@ int csp_hmac_verify(csp_packet_t * packet, bool include_header) {
 	/* Calculate HMAC */
 	if (include_header) {
 
-		csp_hmac_memory(csp_hmac_key, sizeof(csp_hmac_key), packet->frame_begin, packet->frame_length - CSP_HMAC_LENGTH, hmac);
+		csp_hmac_keyed(&csp_hmac_state, packet->frame_begin, packet->frame_length - CSP_HMAC_LENGTH, hmac);
 
 		/* Compare calculated HMAC with packet header */
 		if (memcmp(&packet->frame_begin[packet->frame_length] - CSP_HMAC_LENGTH, hmac, CSP_HMAC_LENGTH) != 0) {
@@ -173,7 +179,7 @@ int csp_hmac_verify(csp_packet_t * packet, bool include_header) {
 		packet->frame_length -= CSP_HMAC_LENGTH;
 
 	} else {
-		csp_hmac_memory(csp_hmac_key, sizeof(csp_hmac_key), packet->data, packet->length - CSP_HMAC_LENGTH, hmac);
+		csp_hmac_keyed(&csp_hmac_state, packet->data, packet->length - CSP_HMAC_LENGTH, hmac);
 
 		/* Compare calculated HMAC with packet header */
 		if (memcmp(&packet->data[packet->length] - CSP_HMAC_LENGTH, hmac, CSP_HMAC_LENGTH) != 0) {
@@ -187,3 +193,70 @@ int csp_hmac_verify(csp_packet_t * packet, bool include_header) {
 
 	return CSP_ERR_NONE;
 }
+
+void csp_hmac_verify_batch(csp_packet_t * packets[], unsigned int count, bool include_header, int results[]) {
+
+	const hmac_state * hmac = &csp_hmac_state;
+
+	while (count) {
+
+		unsigned int n = (count < CSP_HMAC_BATCH_MAX) ? count : CSP_HMAC_BATCH_MAX;
+		csp_sha1_state_t md[CSP_HMAC_BATCH_MAX];
+		const void * data[CSP_HMAC_BATCH_MAX];
+		uint32_t length[CSP_HMAC_BATCH_MAX];
+		uint8_t isha[CSP_HMAC_BATCH_MAX][CSP_SHA1_DIGESTSIZE];
+		uint8_t osha[CSP_HMAC_BATCH_MAX][CSP_SHA1_DIGESTSIZE];
+		uint8_t * out[CSP_HMAC_BATCH_MAX];
+		unsigned int idx[CSP_HMAC_BATCH_MAX];
+		unsigned int m = 0;
+
+		/* Inner hashes of all packets long enough to carry a HMAC */
+		for (unsigned int i = 0; i < n; i++) {
+			csp_packet_t * packet = packets[i];
+			if (packet->length < (unsigned int)CSP_HMAC_LENGTH) {
+				results[i] = CSP_ERR_HMAC;
+				continue;
+			}
+			md[m] = hmac->inner;
+			if (include_header) {
+				data[m] = packet->frame_begin;
+				length[m] = packet->frame_length - CSP_HMAC_LENGTH;
+			} else {
+				data[m] = packet->data;
+				length[m] = packet->length - CSP_HMAC_LENGTH;
+			}
+			out[m] = isha[m];
+			idx[m++] = i;
+		}
+		csp_sha1_done_mb(md, data, length, out, m);
+
+		/* Outer hashes */
+		for (unsigned int j = 0; j < m; j++) {
+			md[j] = hmac->outer;
+			data[j] = isha[j];
+			length[j] = CSP_SHA1_DIGESTSIZE;
+			out[j] = osha[j];
+		}
+		csp_sha1_done_mb(md, data, length, out, m);
+
+		/* Compare and strip, as csp_hmac_verify() */
+		for (unsigned int j = 0; j < m; j++) {
+			csp_packet_t * packet = packets[idx[j]];
+			uint8_t * mac = include_header ? &packet->frame_begin[packet->frame_length] : &packet->data[packet->length];
+			if (memcmp(mac - CSP_HMAC_LENGTH, osha[j], CSP_HMAC_LENGTH) != 0) {
+				results[idx[j]] = CSP_ERR_HMAC;
+				continue;
+			}
+			if (include_header) {
+				packet->frame_length -= CSP_HMAC_LENGTH;
+			} else {
+				packet->length -= CSP_HMAC_LENGTH;
+			}
+			results[idx[j]] = CSP_ERR_NONE;
+		}
+
+		packets += n;
+		results += n;
+		count -= n;
+	}
+}
@@ -69,24 +69,37 @@
 		b = ROL(b, 30);                                          \
 	} while (0)
 
-static void csp_sha1_compress(csp_sha1_state_t * sha1, const uint8_t * buf) {
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CSP_SHA1_HAVE_X86 1
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
 
-	uint32_t a, b, c, d, e, W[80], i;
+#if defined(__aarch64__) && defined(__GNUC__) && (defined(__ARM_FEATURE_SHA2) || defined(__linux__))
+#define CSP_SHA1_HAVE_ARMV8 1
+#include <arm_neon.h>
+#if !defined(__ARM_FEATURE_SHA2)
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA1
+#define HWCAP_SHA1 (1 << 5)
+#endif
+#endif
+#endif
 
-	/* Copy the state into 512-bits into W[0..15] */
-	for (i = 0; i < 16; i++)
-		LOAD32H(W[i], buf + (4 * i));
+/* Kernels compress a number of consecutive 64 byte blocks into the state */
+typedef void (*csp_sha1_fn_t)(uint32_t * state, const uint8_t * buf, uint32_t blocks);
 
-	/* Copy state */
-	a = sha1->state[0];
-	b = sha1->state[1];
-	c = sha1->state[2];
-	d = sha1->state[3];
-	e = sha1->state[4];
+/* The 80 rounds on an expanded message schedule */
+static inline __attribute__((always_inline)) void csp_sha1_rounds(uint32_t * state, const uint32_t * W) {
 
-	/* Expand it */
-	for (i = 16; i < 80; i++)
-		W[i] = ROL(W[i - 3] ^ W[i - 8] ^ W[i - 14] ^ W[i - 16], 1);
+	uint32_t a, b, c, d, e, i;
+
+	/* Copy state */
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
 
 	/* Compress */
 	i = 0;
@@ -128,11 +141,303 @@ static void csp_sha1_compress(csp_sha1_state_t * sha1, const uint8_t * buf) {
 	}
 
 	/* Store */
-	sha1->state[0] += a;
-	sha1->state[1] += b;
-	sha1->state[2] += c;
-	sha1->state[3] += d;
-	sha1->state[4] += e;
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+static void csp_sha1_compress_generic(uint32_t * state, const uint8_t * buf, uint32_t blocks) {
+
+	uint32_t W[80], i;
+
+	for (; blocks; blocks--, buf += CSP_SHA1_BLOCKSIZE) {
+
+		/* Copy the state into 512-bits into W[0..15] */
+		for (i = 0; i < 16; i++)
+			LOAD32H(W[i], buf + (4 * i));
+
+		/* Expand it */
+		for (i = 16; i < 80; i++)
+			W[i] = ROL(W[i - 3] ^ W[i - 8] ^ W[i - 14] ^ W[i - 16], 1);
+
+		csp_sha1_rounds(state, W);
+	}
+}
+
+#if (CSP_SHA1_HAVE_X86)
+
+#define SSE_ROL(x, n) _mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - (n)))
+
+/* Scalar rounds, with the message schedule expanded 4 words at a time */
+__attribute__((target("ssse3")))
+static void csp_sha1_compress_ssse3(uint32_t * state, const uint8_t * buf, uint32_t blocks) {
+
+	uint32_t W[80] __attribute__((aligned(16)));
+	const __m128i bswap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+	for (; blocks; blocks--, buf += CSP_SHA1_BLOCKSIZE) {
+
+		for (unsigned int i = 0; i < 16; i += 4) {
+			__m128i w = _mm_loadu_si128((const __m128i *)(buf + 4 * i));
+			_mm_store_si128((__m128i *)&W[i], _mm_shuffle_epi8(w, bswap));
+		}
+
+		/* W[i + 3] depends on W[i], which is patched in from lane 0 */
+		for (unsigned int i = 16; i < 32; i += 4) {
+			__m128i t = _mm_xor_si128(_mm_load_si128((const __m128i *)&W[i - 16]),
+									  _mm_loadu_si128((const __m128i *)&W[i - 14]));
+			t = _mm_xor_si128(t, _mm_load_si128((const __m128i *)&W[i - 8]));
+			t = _mm_xor_si128(t, _mm_srli_si128(_mm_loadu_si128((const __m128i *)&W[i - 4]), 4));
+			__m128i fix = _mm_slli_si128(t, 12);
+			__m128i w = _mm_xor_si128(SSE_ROL(t, 1), SSE_ROL(fix, 2));
+			_mm_store_si128((__m128i *)&W[i], w);
+		}
+
+		/* W[i] = (W[i-6] ^ W[i-16] ^ W[i-28] ^ W[i-32]) rol 2, no dependency within a vector */
+		for (unsigned int i = 32; i < 80; i += 4) {
+			__m128i t = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&W[i - 6]),
+									  _mm_load_si128((const __m128i *)&W[i - 16]));
+			t = _mm_xor_si128(t, _mm_load_si128((const __m128i *)&W[i - 28]));
+			t = _mm_xor_si128(t, _mm_load_si128((const __m128i *)&W[i - 32]));
+			_mm_store_si128((__m128i *)&W[i], SSE_ROL(t, 2));
+		}
+
+		csp_sha1_rounds(state, W);
+	}
+}
+
+/* One group of 4 rounds with the SHA extensions, g = 0..19 */
+#define SHANI_ROUNDS(g)                                                            \
+	do {                                                                           \
+		if ((g) == 0)                                                              \
+			E[0] = _mm_add_epi32(E[0], M[0]);                                      \
+		else                                                                       \
+			E[(g)&1] = _mm_sha1nexte_epu32(E[(g)&1], M[(g)&3]);                    \
+		E[((g) + 1) & 1] = abcd;                                                   \
+		if ((g) >= 3 && (g) <= 18)                                                 \
+			M[((g) + 1) & 3] = _mm_sha1msg2_epu32(M[((g) + 1) & 3], M[(g)&3]);     \
+		abcd = _mm_sha1rnds4_epu32(abcd, E[(g)&1], (g) / 5);                       \
+		if ((g) >= 1 && (g) <= 16)                                                 \
+			M[((g) + 3) & 3] = _mm_sha1msg1_epu32(M[((g) + 3) & 3], M[(g)&3]);     \
+		if ((g) >= 2 && (g) <= 17)                                                 \
+			M[((g) + 2) & 3] = _mm_xor_si128(M[((g) + 2) & 3], M[(g)&3]);          \
+	} while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void csp_sha1_compress_shani(uint32_t * state, const uint8_t * buf, uint32_t blocks) {
+
+	const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	__m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1B);
+	__m128i e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+	for (; blocks; blocks--, buf += CSP_SHA1_BLOCKSIZE) {
+
+		__m128i abcd_save = abcd;
+		__m128i e_save = e0;
+		__m128i E[2] = {e0, e0};
+		__m128i M[4];
+
+		for (unsigned int i = 0; i < 4; i++) {
+			M[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(buf + 16 * i)), bswap);
+		}
+
+		SHANI_ROUNDS(0);
+		SHANI_ROUNDS(1);
+		SHANI_ROUNDS(2);
+		SHANI_ROUNDS(3);
+		SHANI_ROUNDS(4);
+		SHANI_ROUNDS(5);
+		SHANI_ROUNDS(6);
+		SHANI_ROUNDS(7);
+		SHANI_ROUNDS(8);
+		SHANI_ROUNDS(9);
+		SHANI_ROUNDS(10);
+		SHANI_ROUNDS(11);
+		SHANI_ROUNDS(12);
+		SHANI_ROUNDS(13);
+		SHANI_ROUNDS(14);
+		SHANI_ROUNDS(15);
+		SHANI_ROUNDS(16);
+		SHANI_ROUNDS(17);
+		SHANI_ROUNDS(18);
+		SHANI_ROUNDS(19);
+
+		/* Combine state */
+		e0 = _mm_sha1nexte_epu32(E[0], e_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+	}
+
+	_mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1B));
+	state[4] = _mm_extract_epi32(e0, 3);
+}
+
+static bool csp_sha1_cpu_has_sha(void) {
+
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+		return false;
+	}
+	return (ebx & bit_SHA) != 0;
+}
+#endif
+
+#if (CSP_SHA1_HAVE_ARMV8)
+
+/* One group of 4 rounds with the ARMv8 SHA1 instructions, g = 0..19 */
+#define ARMV8_ROUNDS(g)                                                                     \
+	do {                                                                                    \
+		E[((g) + 1) & 1] = vsha1h_u32(vgetq_lane_u32(abcd, 0));                             \
+		if ((g) < 5)                                                                        \
+			abcd = vsha1cq_u32(abcd, E[(g)&1], T[(g)&1]);                                   \
+		else if ((g) >= 10 && (g) < 15)                                                     \
+			abcd = vsha1mq_u32(abcd, E[(g)&1], T[(g)&1]);                                   \
+		else                                                                                \
+			abcd = vsha1pq_u32(abcd, E[(g)&1], T[(g)&1]);                                   \
+		if ((g) <= 17)                                                                      \
+			T[(g)&1] = vaddq_u32(M[((g) + 2) & 3], K[((g) + 2) / 5]);                        \
+		if ((g) >= 1 && (g) <= 16)                                                          \
+			M[((g) + 3) & 3] = vsha1su1q_u32(M[((g) + 3) & 3], M[((g) + 2) & 3]);            \
+		if ((g) <= 15)                                                                      \
+			M[(g)&3] = vsha1su0q_u32(M[(g)&3], M[((g) + 1) & 3], M[((g) + 2) & 3]);          \
+	} while (0)
+
+__attribute__((target("arch=armv8-a+crypto")))
+static void csp_sha1_compress_armv8(uint32_t * state, const uint8_t * buf, uint32_t blocks) {
+
+	const uint32x4_t K[4] = {vdupq_n_u32(0x5a827999UL), vdupq_n_u32(0x6ed9eba1UL),
+							 vdupq_n_u32(0x8f1bbcdcUL), vdupq_n_u32(0xca62c1d6UL)};
+	uint32x4_t abcd = vld1q_u32(state);
+	uint32_t e0 = state[4];
+
+	for (; blocks; blocks--, buf += CSP_SHA1_BLOCKSIZE) {
+
+		uint32x4_t abcd_save = abcd;
+		uint32_t E[2] = {e0, e0};
+		uint32x4_t M[4];
+		uint32x4_t T[2];
+
+		for (unsigned int i = 0; i < 4; i++) {
+			M[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(buf + 16 * i)));
+		}
+		T[0] = vaddq_u32(M[0], K[0]);
+		T[1] = vaddq_u32(M[1], K[0]);
+
+		ARMV8_ROUNDS(0);
+		ARMV8_ROUNDS(1);
+		ARMV8_ROUNDS(2);
+		ARMV8_ROUNDS(3);
+		ARMV8_ROUNDS(4);
+		ARMV8_ROUNDS(5);
+		ARMV8_ROUNDS(6);
+		ARMV8_ROUNDS(7);
+		ARMV8_ROUNDS(8);
+		ARMV8_ROUNDS(9);
+		ARMV8_ROUNDS(10);
+		ARMV8_ROUNDS(11);
+		ARMV8_ROUNDS(12);
+		ARMV8_ROUNDS(13);
+		ARMV8_ROUNDS(14);
+		ARMV8_ROUNDS(15);
+		ARMV8_ROUNDS(16);
+		ARMV8_ROUNDS(17);
+		ARMV8_ROUNDS(18);
+		ARMV8_ROUNDS(19);
+
+		/* Combine state */
+		e0 += E[0];
+		abcd = vaddq_u32(abcd, abcd_save);
+	}
+
+	vst1q_u32(state, abcd);
+	state[4] = e0;
+}
+#endif
+
+static void csp_sha1_resolve(uint32_t * state, const uint8_t * buf, uint32_t blocks);
+
+static csp_sha1_fn_t csp_sha1_fn = csp_sha1_resolve;
+static csp_sha1_kernel_t csp_sha1_kernel = CSP_SHA1_KERNEL_AUTO;
+
+int csp_sha1_set_kernel(csp_sha1_kernel_t kernel) {
+
+	csp_sha1_fn_t fn = NULL;
+
+	if (kernel == CSP_SHA1_KERNEL_AUTO) {
+		if (csp_sha1_set_kernel(CSP_SHA1_KERNEL_SHANI) == CSP_ERR_NONE) {
+			return CSP_ERR_NONE;
+		}
+		if (csp_sha1_set_kernel(CSP_SHA1_KERNEL_ARMV8) == CSP_ERR_NONE) {
+			return CSP_ERR_NONE;
+		}
+		if (csp_sha1_set_kernel(CSP_SHA1_KERNEL_SSSE3) == CSP_ERR_NONE) {
+			return CSP_ERR_NONE;
+		}
+		return csp_sha1_set_kernel(CSP_SHA1_KERNEL_GENERIC);
+	}
+
+	switch (kernel) {
+		case CSP_SHA1_KERNEL_GENERIC:
+			fn = csp_sha1_compress_generic;
+			break;
+#if (CSP_SHA1_HAVE_X86)
+		case CSP_SHA1_KERNEL_SSSE3:
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("ssse3")) {
+				fn = csp_sha1_compress_ssse3;
+			}
+			break;
+		case CSP_SHA1_KERNEL_SHANI:
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("sse4.1") && csp_sha1_cpu_has_sha()) {
+				fn = csp_sha1_compress_shani;
+			}
+			break;
+#endif
+#if (CSP_SHA1_HAVE_ARMV8)
+		case CSP_SHA1_KERNEL_ARMV8:
+#if defined(__ARM_FEATURE_SHA2)
+			fn = csp_sha1_compress_armv8;
+#else
+			if (getauxval(AT_HWCAP) & HWCAP_SHA1) {
+				fn = csp_sha1_compress_armv8;
+			}
+#endif
+			break;
+#endif
+		default:
+			break;
+	}
+
+	if (fn == NULL) {
+		return CSP_ERR_NOTSUP;
+	}
+
+	__atomic_store_n(&csp_sha1_kernel, kernel, __ATOMIC_RELAXED);
+	__atomic_store_n(&csp_sha1_fn, fn, __ATOMIC_RELEASE);
+	return CSP_ERR_NONE;
+}
+
+csp_sha1_kernel_t csp_sha1_get_kernel(void) {
+
+	if (__atomic_load_n(&csp_sha1_fn, __ATOMIC_ACQUIRE) == csp_sha1_resolve) {
+		csp_sha1_set_kernel(CSP_SHA1_KERNEL_AUTO);
+	}
+	return __atomic_load_n(&csp_sha1_kernel, __ATOMIC_RELAXED);
+}
+
+/* Initial kernel: selects the fastest one available on first use, then forwards to it */
+static void csp_sha1_resolve(uint32_t * state, const uint8_t * buf, uint32_t blocks) {
+
+	csp_sha1_set_kernel(CSP_SHA1_KERNEL_AUTO);
+	__atomic_load_n(&csp_sha1_fn, __ATOMIC_ACQUIRE)(state, buf, blocks);
+}
+
+static void csp_sha1_compress(csp_sha1_state_t * sha1, const uint8_t * buf, uint32_t blocks) {
+
+	csp_sha1_fn_t fn = __atomic_load_n(&csp_sha1_fn, __ATOMIC_ACQUIRE);
+	fn(sha1->state, buf, blocks);
 }
 
 void csp_sha1_init(csp_sha1_state_t * sha1) {
@@ -152,10 +457,12 @@ void csp_sha1_process(csp_sha1_state_t * sha1, const void * data, uint32_t inlen
 	uint32_t n;
 	while (inlen > 0) {
 		if (sha1->curlen == 0 && inlen >= CSP_SHA1_BLOCKSIZE) {
-			csp_sha1_compress(sha1, in);
-			sha1->length += (CSP_SHA1_BLOCKSIZE * 8);
-			in += CSP_SHA1_BLOCKSIZE;
-			inlen -= CSP_SHA1_BLOCKSIZE;
+			/* Compress all whole blocks directly from the input */
+			uint32_t blocks = inlen / CSP_SHA1_BLOCKSIZE;
+			csp_sha1_compress(sha1, in, blocks);
+			sha1->length += ((uint64_t)blocks * CSP_SHA1_BLOCKSIZE * 8);
+			in += blocks * CSP_SHA1_BLOCKSIZE;
+			inlen -= blocks * CSP_SHA1_BLOCKSIZE;
 		} else {
 			n = MIN(inlen, (CSP_SHA1_BLOCKSIZE - sha1->curlen));
 			memcpy(sha1->buf + sha1->curlen, in, (size_t)n);
@@ -163,7 +470,7 @@ void csp_sha1_process(csp_sha1_state_t * sha1, const void * data, uint32_t inlen
 			in += n;
 			inlen -= n;
 			if (sha1->curlen == CSP_SHA1_BLOCKSIZE) {
-				csp_sha1_compress(sha1, sha1->buf);
+				csp_sha1_compress(sha1, sha1->buf, 1);
 				sha1->length += (CSP_SHA1_BLOCKSIZE * 8);
 				sha1->curlen = 0;
 			}
@@ -188,7 +495,7 @@ void csp_sha1_done(csp_sha1_state_t * sha1, uint8_t * out) {
 	if (sha1->curlen > 56) {
 		while (sha1->curlen < 64)
 			sha1->buf[sha1->curlen++] = 0;
-		csp_sha1_compress(sha1, sha1->buf);
+		csp_sha1_compress(sha1, sha1->buf, 1);
 		sha1->curlen = 0;
 	}
 
@@ -198,7 +505,7 @@ void csp_sha1_done(csp_sha1_state_t * sha1, uint8_t * out) {
 
 	/* Store length */
 	STORE64H(sha1->length, sha1->buf + 56);
-	csp_sha1_compress(sha1, sha1->buf);
+	csp_sha1_compress(sha1, sha1->buf, 1);
 
 	/* Copy output */
 	for (i = 0; i < 5; i++)
@@ -212,3 +519,226 @@ void csp_sha1_memory(const void * msg, uint32_t len, uint8_t * hash) {
 	csp_sha1_process(&md, msg, len);
 	csp_sha1_done(&md, hash);
 }
+
+/* Multi-buffer engine: independent messages are hashed side by side, one per vector lane */
+#define CSP_SHA1_MB_LANES 8
+
+typedef uint32_t csp_sha1_vec_t __attribute__((vector_size(4 * CSP_SHA1_MB_LANES)));
+
+/* Message word i, expanded in place in a 16 word ring */
+#define MB_W(i) \
+	(((i) < 16) ? W[(i)&15] : (W[(i)&15] = ROL(W[((i)-3) & 15] ^ W[((i)-8) & 15] ^ W[((i)-14) & 15] ^ W[(i)&15], 1)))
+
+#define MB_ROUND(f, k, i)                                                  \
+	do {                                                                   \
+		csp_sha1_vec_t t = ROL(a, 5) + (f) + e + (uint32_t)(k) + MB_W(i); \
+		e = d;                                                             \
+		d = c;                                                             \
+		c = ROL(b, 30);                                                    \
+		b = a;                                                             \
+		a = t;                                                             \
+	} while (0)
+
+static inline __attribute__((always_inline)) void csp_sha1_mb_rounds(uint32_t st[5][CSP_SHA1_MB_LANES], const uint8_t * const block[]) {
+
+	csp_sha1_vec_t W[16], a, b, c, d, e;
+	unsigned int i;
+
+	/* Transpose: lane l of W[i] is word i of block l */
+	for (i = 0; i < 16; i++) {
+		for (unsigned int l = 0; l < CSP_SHA1_MB_LANES; l++) {
+			uint32_t w;
+			LOAD32H(w, block[l] + (4 * i));
+			W[i][l] = w;
+		}
+	}
+
+	memcpy(&a, st[0], sizeof(a));
+	memcpy(&b, st[1], sizeof(b));
+	memcpy(&c, st[2], sizeof(c));
+	memcpy(&d, st[3], sizeof(d));
+	memcpy(&e, st[4], sizeof(e));
+
+	const csp_sha1_vec_t a0 = a, b0 = b, c0 = c, d0 = d, e0 = e;
+
+	for (i = 0; i < 20; i++)
+		MB_ROUND(F0(b, c, d), 0x5a827999UL, i);
+	for (; i < 40; i++)
+		MB_ROUND(F1(b, c, d), 0x6ed9eba1UL, i);
+	for (; i < 60; i++)
+		MB_ROUND(F2(b, c, d), 0x8f1bbcdcUL, i);
+	for (; i < 80; i++)
+		MB_ROUND(F3(b, c, d), 0xca62c1d6UL, i);
+
+	a += a0;
+	b += b0;
+	c += c0;
+	d += d0;
+	e += e0;
+
+	memcpy(st[0], &a, sizeof(a));
+	memcpy(st[1], &b, sizeof(b));
+	memcpy(st[2], &c, sizeof(c));
+	memcpy(st[3], &d, sizeof(d));
+	memcpy(st[4], &e, sizeof(e));
+}
+
+typedef void (*csp_sha1_mb_fn_t)(uint32_t st[5][CSP_SHA1_MB_LANES], const uint8_t * const block[]);
+
+/* Lowered to whatever vector width the target has (SSE2, NEON) or to scalar code */
+static void csp_sha1_mb_generic(uint32_t st[5][CSP_SHA1_MB_LANES], const uint8_t * const block[]) {
+	csp_sha1_mb_rounds(st, block);
+}
+
+#if (CSP_SHA1_HAVE_X86)
+__attribute__((target("avx2")))
+static void csp_sha1_mb_avx2(uint32_t st[5][CSP_SHA1_MB_LANES], const uint8_t * const block[]) {
+	csp_sha1_mb_rounds(st, block);
+}
+#endif
+
+static csp_sha1_mb_fn_t csp_sha1_mb_fn(void) {
+
+	/* A single stream on SHA instructions beats the lanes */
+	csp_sha1_kernel_t kernel = csp_sha1_get_kernel();
+	if ((kernel == CSP_SHA1_KERNEL_SHANI) || (kernel == CSP_SHA1_KERNEL_ARMV8)) {
+		return NULL;
+	}
+
+#if (CSP_SHA1_HAVE_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return csp_sha1_mb_avx2;
+	}
+#endif
+#if defined(__SSE2__) || defined(__ARM_NEON)
+	return csp_sha1_mb_generic;
+#else
+	return NULL;
+#endif
+}
+
+/* Per lane progress through one message: whole blocks from the input, then the padded tail */
+typedef struct {
+	unsigned int job;
+	const uint8_t * data;
+	uint32_t blocks;
+	uint32_t tail_blocks;
+	const uint8_t * tail;
+	uint8_t tail_buf[2 * CSP_SHA1_BLOCKSIZE];
+} csp_sha1_lane_t;
+
+static void csp_sha1_lane_setup(csp_sha1_lane_t * lane, unsigned int job, const csp_sha1_state_t * state, const uint8_t * data, uint32_t length) {
+
+	uint32_t rem = length % CSP_SHA1_BLOCKSIZE;
+
+	lane->job = job;
+	lane->data = data;
+	lane->blocks = length / CSP_SHA1_BLOCKSIZE;
+	lane->tail = lane->tail_buf;
+	lane->tail_blocks = (rem < 56) ? 1 : 2;
+
+	/* Same padding as csp_sha1_done() */
+	uint8_t * end = lane->tail_buf + (lane->tail_blocks * CSP_SHA1_BLOCKSIZE);
+	memcpy(lane->tail_buf, data + (length - rem), rem);
+	lane->tail_buf[rem] = 0x80;
+	memset(lane->tail_buf + rem + 1, 0, (end - 8) - (lane->tail_buf + rem + 1));
+	STORE64H(state->length + ((uint64_t)length * 8), end - 8);
+}
+
+static const uint8_t * csp_sha1_lane_next(csp_sha1_lane_t * lane) {
+
+	const uint8_t * block;
+
+	if (lane->blocks) {
+		block = lane->data;
+		lane->data += CSP_SHA1_BLOCKSIZE;
+		lane->blocks--;
+	} else {
+		block = lane->tail;
+		lane->tail += CSP_SHA1_BLOCKSIZE;
+		lane->tail_blocks--;
+	}
+
+	return block;
+}
+
+void csp_sha1_done_mb(csp_sha1_state_t states[], const void * const data[], const uint32_t length[], uint8_t * const hash[], unsigned int count) {
+
+	csp_sha1_mb_fn_t mb_fn = (count > 1) ? csp_sha1_mb_fn() : NULL;
+	csp_sha1_fn_t fn = __atomic_load_n(&csp_sha1_fn, __ATOMIC_ACQUIRE);
+	static const uint8_t idle_block[CSP_SHA1_BLOCKSIZE];
+
+	csp_sha1_lane_t lanes[CSP_SHA1_MB_LANES];
+	uint32_t st[5][CSP_SHA1_MB_LANES];
+	unsigned int next = 0;
+	unsigned int active = 0;
+
+	for (unsigned int l = 0; l < CSP_SHA1_MB_LANES; l++) {
+		lanes[l].job = count;
+	}
+
+	while (mb_fn != NULL) {
+
+		/* Feed idle lanes with the next message. States with a partial block take the normal path */
+		for (unsigned int l = 0; l < CSP_SHA1_MB_LANES; l++) {
+			while ((lanes[l].job == count) && (next < count)) {
+				unsigned int job = next++;
+				if (states[job].curlen != 0) {
+					csp_sha1_process(&states[job], data[job], length[job]);
+					csp_sha1_done(&states[job], hash[job]);
+					continue;
+				}
+				csp_sha1_lane_setup(&lanes[l], job, &states[job], data[job], length[job]);
+				for (unsigned int w = 0; w < 5; w++) {
+					st[w][l] = states[job].state[w];
+				}
+				active++;
+			}
+		}
+
+		/* Lanes don't pay off for the last message, finish it on its own */
+		if (active <= 1) {
+			for (unsigned int l = 0; l < CSP_SHA1_MB_LANES; l++) {
+				if (lanes[l].job != count) {
+					uint32_t state[5];
+					for (unsigned int w = 0; w < 5; w++) {
+						state[w] = st[w][l];
+					}
+					if (lanes[l].blocks) {
+						fn(state, lanes[l].data, lanes[l].blocks);
+					}
+					fn(state, lanes[l].tail, lanes[l].tail_blocks);
+					for (unsigned int w = 0; w < 5; w++) {
+						STORE32H(state[w], hash[lanes[l].job] + (4 * w));
+					}
+				}
+			}
+			break;
+		}
+
+		const uint8_t * block[CSP_SHA1_MB_LANES];
+		for (unsigned int l = 0; l < CSP_SHA1_MB_LANES; l++) {
+			block[l] = (lanes[l].job != count) ? csp_sha1_lane_next(&lanes[l]) : idle_block;
+		}
+
+		mb_fn(st, block);
+
+		/* Output finished messages */
+		for (unsigned int l = 0; l < CSP_SHA1_MB_LANES; l++) {
+			if ((lanes[l].job != count) && (lanes[l].blocks == 0) && (lanes[l].tail_blocks == 0)) {
+				for (unsigned int w = 0; w < 5; w++) {
+					STORE32H(st[w][l], hash[lanes[l].job] + (4 * w));
+				}
+				lanes[l].job = count;
+				active--;
+			}
+		}
+	}
+
+	/* One at a time, for the messages not handled above */
+	for (; next < count; next++) {
+		csp_sha1_process(&states[next], data[next], length[next]);
+		csp_sha1_done(&states[next], hash[next]);
+	}
+}
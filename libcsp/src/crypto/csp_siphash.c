@@ -0,0 +1,179 @@
+/* SipHash-2-4, from the reference implementation by Jean-Philippe Aumasson and Daniel J. Bernstein */
+
+#include <csp/crypto/csp_siphash.h>
+
+#include <string.h>
+
+#include <csp/csp_buffer.h>
+#include <csp/crypto/csp_sha1.h>
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define LOAD64L(y)                             \
+	(((uint64_t)(y)[0] << 0) | ((uint64_t)(y)[1] << 8) |   \
+	 ((uint64_t)(y)[2] << 16) | ((uint64_t)(y)[3] << 24) | \
+	 ((uint64_t)(y)[4] << 32) | ((uint64_t)(y)[5] << 40) | \
+	 ((uint64_t)(y)[6] << 48) | ((uint64_t)(y)[7] << 56))
+
+#define SIPROUND           \
+	do {                   \
+		v0 += v1;          \
+		v1 = ROTL(v1, 13); \
+		v1 ^= v0;          \
+		v0 = ROTL(v0, 32); \
+		v2 += v3;          \
+		v3 = ROTL(v3, 16); \
+		v3 ^= v2;          \
+		v0 += v3;          \
+		v3 = ROTL(v3, 21); \
+		v3 ^= v0;          \
+		v2 += v1;          \
+		v1 = ROTL(v1, 17); \
+		v1 ^= v2;          \
+		v2 = ROTL(v2, 32); \
+	} while (0)
+
+#define SIPCOMPRESS(m) \
+	do {               \
+		v3 ^= (m);     \
+		SIPROUND;      \
+		SIPROUND;      \
+		v0 ^= (m);     \
+	} while (0)
+
+/* Key for append/verify, all zero until csp_siphash_set_key() or csp_hmac_set_key() */
+static uint64_t csp_siphash_key[2];
+
+/* SipHash of an optional 8 byte prefix word followed by data */
+static uint64_t csp_siphash_keyed(const uint64_t * key, const uint64_t * prefix, const uint8_t * data, uint32_t length) {
+
+	uint64_t v0 = key[0] ^ 0x736f6d6570736575ULL;
+	uint64_t v1 = key[1] ^ 0x646f72616e646f6dULL;
+	uint64_t v2 = key[0] ^ 0x6c7967656e657261ULL;
+	uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+	uint64_t b = (uint64_t)length;
+
+	if (prefix != NULL) {
+		SIPCOMPRESS(*prefix);
+		b += 8;
+	}
+
+	const uint8_t * end = data + (length - (length % 8));
+	for (; data != end; data += 8) {
+		SIPCOMPRESS(LOAD64L(data));
+	}
+
+	/* Last block: remaining bytes, total length in the top byte */
+	b <<= 56;
+	switch (length % 8) {
+		case 7:
+			b |= ((uint64_t)data[6]) << 48;
+			/* fallthrough */
+		case 6:
+			b |= ((uint64_t)data[5]) << 40;
+			/* fallthrough */
+		case 5:
+			b |= ((uint64_t)data[4]) << 32;
+			/* fallthrough */
+		case 4:
+			b |= ((uint64_t)data[3]) << 24;
+			/* fallthrough */
+		case 3:
+			b |= ((uint64_t)data[2]) << 16;
+			/* fallthrough */
+		case 2:
+			b |= ((uint64_t)data[1]) << 8;
+			/* fallthrough */
+		case 1:
+			b |= ((uint64_t)data[0]);
+			break;
+		case 0:
+			break;
+	}
+	SIPCOMPRESS(b);
+
+	/* Finalization */
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/* CSP id as one word, independent of the header version. Only the flags that fit the 2.x header are used */
+static uint64_t csp_siphash_id(const csp_id_t * id) {
+	return ((uint64_t)id->pri) |
+		   ((uint64_t)(id->flags & 0x3f) << 8) |
+		   ((uint64_t)id->src << 16) |
+		   ((uint64_t)id->dst << 32) |
+		   ((uint64_t)id->dport << 48) |
+		   ((uint64_t)id->sport << 56);
+}
+
+static void csp_siphash_packet(const csp_packet_t * packet, uint16_t length, uint8_t * tag) {
+
+	uint64_t id = csp_siphash_id(&packet->id);
+	uint64_t hash = csp_siphash_keyed(csp_siphash_key, &id, packet->data, length);
+
+	for (unsigned int i = 0; i < CSP_SIPHASH_LENGTH; i++) {
+		tag[i] = (uint8_t)(hash >> (8 * i));
+	}
+}
+
+uint64_t csp_siphash_memory(const uint8_t * key, const void * data, uint32_t datalen) {
+
+	const uint64_t k[2] = {LOAD64L(key), LOAD64L(key + 8)};
+	return csp_siphash_keyed(k, NULL, data, datalen);
+}
+
+int csp_siphash_set_key(const void * key, uint32_t keylen) {
+
+	/* Use SHA1 as KDF, with a label so the key differs from the HMAC key */
+	static const char label[] = "csp siphash";
+	uint8_t hash[CSP_SHA1_DIGESTSIZE];
+	csp_sha1_state_t state;
+	csp_sha1_init(&state);
+	csp_sha1_process(&state, label, sizeof(label));
+	csp_sha1_process(&state, key, keylen);
+	csp_sha1_done(&state, hash);
+
+	csp_siphash_key[0] = LOAD64L(hash);
+	csp_siphash_key[1] = LOAD64L(hash + 8);
+
+	memset(hash, 0, sizeof(hash));
+	return CSP_ERR_NONE;
+}
+
+int csp_siphash_append(csp_packet_t * packet) {
+
+	if ((packet->length + (unsigned int)CSP_SIPHASH_LENGTH) > csp_buffer_data_size()) {
+		return CSP_ERR_NOMEM;
+	}
+
+	csp_siphash_packet(packet, packet->length, &packet->data[packet->length]);
+	packet->length += CSP_SIPHASH_LENGTH;
+
+	return CSP_ERR_NONE;
+}
+
+int csp_siphash_verify(csp_packet_t * packet) {
+
+	if (packet->length < (unsigned int)CSP_SIPHASH_LENGTH) {
+		return CSP_ERR_HMAC;
+	}
+
+	uint8_t tag[CSP_SIPHASH_LENGTH];
+	csp_siphash_packet(packet, packet->length - CSP_SIPHASH_LENGTH, tag);
+
+	/* Compare calculated tag with packet */
+	if (memcmp(&packet->data[packet->length] - CSP_SIPHASH_LENGTH, tag, CSP_SIPHASH_LENGTH) != 0) {
+		return CSP_ERR_HMAC;
+	}
+
+	/* Strip tag */
+	packet->length -= CSP_SIPHASH_LENGTH;
+
+	return CSP_ERR_NONE;
+}
@@ -0,0 +1,215 @@
+#include <csp/csp_async.h>
+
+#include <csp/csp.h>
+#include <csp/arch/csp_time.h>
+
+#include "csp_conn.h"
+#include "csp_io.h"
+
+void csp_async_init(csp_async_t * ctx, csp_conn_t * conn, uint8_t mode) {
+
+	ctx->conn = conn;
+	ctx->mode = mode;
+	ctx->next_tag = 0;
+	ctx->count = 0;
+	ctx->unmatched = 0;
+
+	for (unsigned int i = 0; i < CSP_ASYNC_MAX_PENDING; i++) {
+		ctx->request[i].used = 0;
+		ctx->request[i].expired = 0;
+	}
+}
+
+static csp_async_request_t * csp_async_find_tag(csp_async_t * ctx, uint8_t tag) {
+
+	for (unsigned int i = 0; i < CSP_ASYNC_MAX_PENDING; i++) {
+		if (ctx->request[i].used && (ctx->request[i].tag == tag)) {
+			return &ctx->request[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* Oldest outstanding request, tags are handed out in order and at most CSP_ASYNC_MAX_PENDING apart */
+static csp_async_request_t * csp_async_oldest(csp_async_t * ctx) {
+
+	csp_async_request_t * oldest = NULL;
+
+	for (unsigned int i = 0; i < CSP_ASYNC_MAX_PENDING; i++) {
+		csp_async_request_t * req = &ctx->request[i];
+		if (!req->used) {
+			continue;
+		}
+		if ((oldest == NULL) || ((uint8_t)(ctx->next_tag - req->tag) > (uint8_t)(ctx->next_tag - oldest->tag))) {
+			oldest = req;
+		}
+	}
+
+	return oldest;
+}
+
+static void csp_async_complete(csp_async_t * ctx, csp_async_request_t * req, int error, csp_packet_t * reply) {
+
+	/* Free the slot first, the callback may send the next request */
+	req->used = 0;
+	ctx->count--;
+
+	req->callback(req->arg, error, reply);
+}
+
+/* Ordered mode: the reply to a timed out request is still to come, keep its place in the order */
+static void csp_async_complete_expired(csp_async_t * ctx, csp_async_request_t * req) {
+
+	req->expired = 1;
+	ctx->count--;
+
+	req->callback(req->arg, CSP_ERR_TIMEDOUT, NULL);
+}
+
+int csp_async_request(csp_async_t * ctx, csp_packet_t * request, uint32_t timeout, csp_async_cb_t callback, void * arg) {
+
+	if (ctx->count >= CSP_ASYNC_MAX_PENDING) {
+		return CSP_ERR_BUSY;
+	}
+
+	if ((ctx->mode == CSP_ASYNC_TAGGED) && (request->length == 0)) {
+		return CSP_ERR_INVAL;
+	}
+
+	csp_async_request_t * req = NULL;
+	for (unsigned int i = 0; i < CSP_ASYNC_MAX_PENDING; i++) {
+		if (!ctx->request[i].used) {
+			req = &ctx->request[i];
+			break;
+		}
+	}
+
+	/* The other slots wait for late replies */
+	if (req == NULL) {
+		return CSP_ERR_BUSY;
+	}
+
+	/* A request may be outstanding for long, do not reuse its tag */
+	while (csp_async_find_tag(ctx, ctx->next_tag) != NULL) {
+		ctx->next_tag++;
+	}
+
+	req->tag = ctx->next_tag++;
+	req->callback = callback;
+	req->arg = arg;
+	req->deadline = csp_get_ms() + timeout;
+	req->used = 1;
+	ctx->count++;
+
+	if (ctx->mode == CSP_ASYNC_TAGGED) {
+		request->data[0] = req->tag;
+	}
+
+	csp_send(ctx->conn, request);
+
+	return CSP_ERR_NONE;
+}
+
+static int csp_async_expire(csp_async_t * ctx, uint32_t now) {
+
+	int completed = 0;
+
+	for (unsigned int i = 0; i < CSP_ASYNC_MAX_PENDING; i++) {
+		csp_async_request_t * req = &ctx->request[i];
+		if (req->used && !req->expired && ((int32_t)(now - req->deadline) >= 0)) {
+			if (ctx->mode == CSP_ASYNC_ORDERED) {
+				csp_async_complete_expired(ctx, req);
+			} else {
+				csp_async_complete(ctx, req, CSP_ERR_TIMEDOUT, NULL);
+			}
+			completed++;
+		}
+	}
+
+	return completed;
+}
+
+static int csp_async_deliver(csp_async_t * ctx, csp_packet_t * packet) {
+
+	csp_async_request_t * req;
+	if (ctx->mode == CSP_ASYNC_TAGGED) {
+		req = (packet->length > 0) ? csp_async_find_tag(ctx, packet->data[0]) : NULL;
+	} else {
+		req = csp_async_oldest(ctx);
+	}
+
+	if ((req == NULL) || req->expired) {
+		if (req != NULL) {
+			/* Late reply to a timed out request */
+			req->used = 0;
+			req->expired = 0;
+		}
+		ctx->unmatched++;
+		csp_buffer_free(packet);
+		return 0;
+	}
+
+	csp_async_complete(ctx, req, CSP_ERR_NONE, packet);
+
+	return 1;
+}
+
+int csp_async_poll(csp_async_t * ctx, uint32_t timeout) {
+
+	int completed = 0;
+	const uint32_t start = csp_get_ms();
+
+	for (;;) {
+
+		uint32_t now = csp_get_ms();
+		completed += csp_async_expire(ctx, now);
+
+		uint32_t elapsed = now - start;
+		uint32_t wait = (elapsed < timeout) ? (timeout - elapsed) : 0;
+
+		/* Wake up for the next deadline */
+		for (unsigned int i = 0; i < CSP_ASYNC_MAX_PENDING; i++) {
+			csp_async_request_t * req = &ctx->request[i];
+			if (req->used && !req->expired && ((req->deadline - now) < wait)) {
+				wait = req->deadline - now;
+			}
+		}
+
+		/* csp_read() would stretch the timeout to the RDP connection timeout */
+		csp_packet_t * packet = csp_read_exact(ctx->conn, wait);
+		if (packet == NULL) {
+			if (ctx->conn->state != CONN_OPEN) {
+				/* No replies will come, and no waiting was done */
+				completed += ctx->count;
+				csp_async_cancel(ctx);
+				break;
+			}
+			if ((csp_get_ms() - start) >= timeout) {
+				completed += csp_async_expire(ctx, csp_get_ms());
+				break;
+			}
+			continue;
+		}
+
+		completed += csp_async_deliver(ctx, packet);
+
+		/* Deliver what is already received, without waiting for more */
+		timeout = 0;
+	}
+
+	return completed;
+}
+
+void csp_async_cancel(csp_async_t * ctx) {
+
+	for (unsigned int i = 0; i < CSP_ASYNC_MAX_PENDING; i++) {
+		csp_async_request_t * req = &ctx->request[i];
+		if (req->expired) {
+			req->used = 0;
+			req->expired = 0;
+		} else if (req->used) {
+			csp_async_complete(ctx, req, CSP_ERR_RESET, NULL);
+		}
+	}
+}
@@ -1,4 +1,5 @@
 #include "csp_qfifo.h"
+#include "csp_qos.h"
 #include "csp_io.h"
 #include "csp_promisc.h"
 #include "csp_dedup.h"
@@ -20,9 +21,12 @@ __attribute__((weak)) void csp_input_hook(csp_iface_t * iface, csp_packet_t * pa
 
 void csp_bridge_work(void) {
 
+	/* Release shaped egress traffic, and wake up in time for the next packet */
+	uint32_t timeout = csp_qos_work(FIFO_TIMEOUT);
+
 	/* Get next packet to route */
 	csp_qfifo_t input;
-	if (csp_qfifo_read(&input) != CSP_ERR_NONE) {
+	if (csp_qfifo_read(&input, timeout) != CSP_ERR_NONE) {
 		return;
 	}
 
@@ -32,6 +36,8 @@ void csp_bridge_work(void) {
 	}
 
 	if (csp_dedup_is_duplicate(packet)) {
+		input.iface->drop++;
+		input.iface->dup++;
 		csp_buffer_free(packet);
 		return;
 	}
@@ -13,13 +13,28 @@
 typedef struct csp_skbf_s {
 	unsigned int refcount;
 	void * skbf_addr;
+	csp_buffer_pool_t * pool;  // Pool the buffer is returned to
 	char skbf_data[];  // -> csp_packet_t
 } csp_skbf_t;
 
 #define SKBUF_SIZE CSP_BUFFER_ALIGN *((sizeof(csp_skbf_t) + CSP_BUFFER_SIZE + CSP_BUFFER_PACKET_OVERHEAD + (CSP_BUFFER_ALIGN - 1)) / CSP_BUFFER_ALIGN)
 
-// Queue of free CSP buffers
-static csp_queue_handle_t csp_buffers;
+// Global pool of CSP buffers
+static csp_buffer_pool_t csp_buffers;
+
+static void csp_buffer_pool_setup(csp_buffer_pool_t * pool, char * buffers, char * queue_data, unsigned int count) {
+
+	pool->queue = csp_queue_create_static(count, sizeof(csp_skbf_t *), queue_data, &pool->queue_static);
+	pool->count = count;
+
+	for (unsigned int i = 0; i < count; i++) {
+		csp_skbf_t * buf = (void *)&buffers[i * SKBUF_SIZE];
+		buf->skbf_addr = buf;
+		buf->pool = pool;
+		buf->refcount = 0;
+		csp_queue_enqueue(pool->queue, &buf, 0);
+	}
+}
 
 void csp_buffer_init(void) {
 
@@ -28,16 +43,9 @@ void csp_buffer_init(void) {
 	 * This is marked as .noinit, because csp buffers can never be assumed zeroed out
 	 * Putting this section in a separate non .bss area, saves some boot time */
 	static char csp_buffer_pool[SKBUF_SIZE * CSP_BUFFER_COUNT] __attribute__((section(".noinit")));
-	static csp_static_queue_t csp_buffers_queue __attribute__((section(".noinit")));
 	static char csp_buffer_queue_data[CSP_BUFFER_COUNT * sizeof(csp_skbf_t *)] __attribute__((section(".noinit")));
 
-	csp_buffers = csp_queue_create_static(CSP_BUFFER_COUNT, sizeof(csp_skbf_t *), csp_buffer_queue_data, &csp_buffers_queue);
-
-	for (unsigned int i = 0; i < CSP_BUFFER_COUNT; i++) {
-		csp_skbf_t * buf = (void *)&csp_buffer_pool[i * SKBUF_SIZE];
-		buf->skbf_addr = buf;
-		csp_queue_enqueue(csp_buffers, &buf, 0);
-	}
+	csp_buffer_pool_setup(&csp_buffers, csp_buffer_pool, csp_buffer_queue_data, CSP_BUFFER_COUNT);
 }
 
 void * csp_buffer_get_isr(size_t _data_size) {
@@ -47,7 +55,7 @@ void * csp_buffer_get_isr(size_t _data_size) {
 
 	csp_skbf_t * buffer = NULL;
 	int task_woken = 0;
-	csp_queue_dequeue_isr(csp_buffers, &buffer, &task_woken);
+	csp_queue_dequeue_isr(csp_buffers.queue, &buffer, &task_woken);
 	if (buffer == NULL) {
 		csp_dbg_buffer_out++;
 		return NULL;
@@ -63,17 +71,14 @@ void * csp_buffer_get_isr(size_t _data_size) {
 	return buffer->skbf_data;
 }
 
-void * csp_buffer_get(size_t _data_size) {
-
-	if (_data_size > CSP_BUFFER_SIZE) {
-		csp_dbg_errno = CSP_DBG_ERR_MTU_EXCEEDED;
-		return NULL;
-	}
+void * csp_buffer_pool_get(csp_buffer_pool_t * pool) {
 
 	csp_skbf_t * buffer = NULL;
-	csp_queue_dequeue(csp_buffers, &buffer, 0);
+	csp_queue_dequeue(pool->queue, &buffer, 0);
 	if (buffer == NULL) {
-		csp_dbg_buffer_out++;
+		if (pool == &csp_buffers) {
+			csp_dbg_buffer_out++;
+		}
 		return NULL;
 	}
 
@@ -86,6 +91,16 @@ void * csp_buffer_get(size_t _data_size) {
 	return buffer->skbf_data;
 }
 
+void * csp_buffer_get(size_t _data_size) {
+
+	if (_data_size > CSP_BUFFER_SIZE) {
+		csp_dbg_errno = CSP_DBG_ERR_MTU_EXCEEDED;
+		return NULL;
+	}
+
+	return csp_buffer_pool_get(&csp_buffers);
+}
+
 void csp_buffer_free_isr(void * packet) {
 
 	if (packet == NULL) {
@@ -110,13 +125,13 @@ void csp_buffer_free_isr(void * packet) {
 		return;
 	}
 
-	if (--(buf->refcount) > 0) {
-		csp_dbg_errno = CSP_DBG_ERR_CORRUPT_BUFFER;;
+	/* Shared buffer, still referenced elsewhere */
+	if (__atomic_sub_fetch(&buf->refcount, 1, __ATOMIC_ACQ_REL) > 0) {
 		return;
 	}
 
 	int task_woken = 0;
-	csp_queue_enqueue_isr(csp_buffers, &buf, &task_woken);
+	csp_queue_enqueue_isr(buf->pool->queue, &buf, &task_woken);
 }
 
 void csp_buffer_free(void * packet) {
@@ -143,12 +158,29 @@ void csp_buffer_free(void * packet) {
 		return;
 	}
 
-	if (--(buf->refcount) > 0) {
-		csp_dbg_errno = CSP_DBG_ERR_REFCOUNT;
+	/* Shared buffer, still referenced elsewhere */
+	if (__atomic_sub_fetch(&buf->refcount, 1, __ATOMIC_ACQ_REL) > 0) {
 		return;
 	}
 
-	csp_queue_enqueue(csp_buffers, &buf, 0);
+	csp_queue_enqueue(buf->pool->queue, &buf, 0);
+}
+
+void csp_buffer_refc_inc(void * buffer) {
+
+	if (buffer == NULL) {
+		csp_dbg_errno = CSP_DBG_ERR_INVALID_POINTER;
+		return;
+	}
+
+	csp_skbf_t * buf = (void *)(((uint8_t *)buffer) - sizeof(csp_skbf_t));
+
+	if (buf->skbf_addr != buf) {
+		csp_dbg_errno = CSP_DBG_ERR_CORRUPT_BUFFER;
+		return;
+	}
+
+	__atomic_add_fetch(&buf->refcount, 1, __ATOMIC_RELAXED);
 }
 
 void * csp_buffer_clone(void * buffer) {
@@ -167,7 +199,68 @@ void * csp_buffer_clone(void * buffer) {
 }
 
 int csp_buffer_remaining(void) {
-	return csp_queue_size(csp_buffers);
+	return csp_queue_size(csp_buffers.queue);
+}
+
+size_t csp_buffer_pool_storage_size(unsigned int count) {
+	return count * (SKBUF_SIZE + sizeof(csp_skbf_t *));
+}
+
+int csp_buffer_pool_init(csp_buffer_pool_t * pool, void * storage, unsigned int count) {
+
+	if ((pool == NULL) || (storage == NULL) || (count == 0) || (((uintptr_t)storage % CSP_BUFFER_ALIGN) > 0)) {
+		return CSP_ERR_INVAL;
+	}
+
+	/* Buffers first, keeping their alignment, then the free queue */
+	char * buffers = storage;
+	csp_buffer_pool_setup(pool, buffers, &buffers[count * SKBUF_SIZE], count);
+
+	return CSP_ERR_NONE;
+}
+
+int csp_buffer_pool_remaining(csp_buffer_pool_t * pool) {
+	return csp_queue_size(pool->queue);
+}
+
+void * csp_buffer_pool_copy(csp_buffer_pool_t * pool, void * buffer) {
+
+	csp_packet_t * packet = buffer;
+	if (packet == NULL) {
+		return NULL;
+	}
+
+	/* Already there, e.g. the driver decoded into the pool */
+	csp_skbf_t * buf = (void *)(((uint8_t *)packet) - sizeof(csp_skbf_t));
+	if (buf->pool == pool) {
+		return packet;
+	}
+
+	csp_packet_t * moved = csp_buffer_pool_get(pool);
+	if (moved == NULL) {
+		return NULL;
+	}
+
+	/* Only the used part of the data */
+	memcpy(moved, packet, CSP_BUFFER_PACKET_OVERHEAD + packet->length);
+
+	/* The frame may start in the header, so it must follow the copy */
+	uintptr_t offset = (uintptr_t)packet->frame_begin - (uintptr_t)packet;
+	if (offset < csp_buffer_size()) {
+		moved->frame_begin = (uint8_t *)moved + offset;
+	}
+
+	return moved;
+}
+
+void * csp_buffer_pool_move(csp_buffer_pool_t * pool, void * buffer) {
+
+	void * moved = csp_buffer_pool_copy(pool, buffer);
+	if (moved != buffer) {
+		csp_buffer_free(buffer);
+	}
+
+	return moved;
 }
 
 size_t csp_buffer_size(void) {
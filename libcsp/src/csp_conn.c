@@ -3,6 +3,7 @@
 #include "csp_autoconfig.h"
 
 #include "csp_conn.h"
+#include "csp_credit.h"
 
 #include <stdlib.h>
 #include <stdatomic.h>
@@ -14,20 +15,73 @@
 #include "csp_rdp_queue.h"
 #include "csp_rdp.h"
 
-#define OUTGOING_PORTS (((1 << (CSP_ID2_PORT_SIZE)) - 1) - CSP_PORT_MAX_BIND)
-#if OUTGOING_PORTS > CSP_CONN_MAX
-#error "More connections than available outgoing ports"
-#endif
+#define CSP_CONN_NONE 0xFFFF
+
+/* Outgoing (client) ports, CSP 1 and 2 both use 6 bit ports */
+#define CSP_CONN_PORTS 64
+
+/* Default connection pool, used unless csp_conf.conn_storage is set */
+static csp_conn_t arr_conn_default[CSP_CONN_MAX] __attribute__((section(".noinit")));
+static uint16_t arr_bucket_default[2 * CSP_CONN_MAX] __attribute__((section(".noinit")));
 
 /* Connection pool */
-static csp_conn_t arr_conn[CSP_CONN_MAX] __attribute__((section(".noinit")));
+static csp_conn_t * arr_conn;
+static unsigned int conn_count;
+
+/* Server connections, hashed on (dport, sport, src) and chained through conn->next */
+static uint16_t * conn_bucket;
+static unsigned int conn_bucket_bits;
+
+/* Client connections, indexed by their outgoing port */
+static csp_conn_t * conn_client[CSP_CONN_PORTS];
+static uint64_t conn_ports_used;
+static unsigned int conn_port_last;
+
+/* Closed connections, oldest first, chained through conn->next */
+static uint16_t conn_free_head;
+static uint16_t conn_free_tail;
+
+/* Open connections, for timeout checks */
+static uint16_t conn_open_head;
+
+/**
+ * Serializes allocation and close. The router looks up every packet without it: conn_client[], the bucket heads
+ * and the next links are published with release stores, and read with acquire loads. A lookup racing with a close
+ * may miss, so misses are checked again under the lock.
+ */
+static csp_bin_sem_t conn_lock;
+
+static inline uint16_t csp_conn_index(csp_conn_t * conn) {
+	return conn - arr_conn;
+}
+
+static inline unsigned int csp_conn_hash(uint16_t dport, uint16_t sport, uint16_t src) {
+	uint32_t key = ((uint32_t)src << 12) ^ ((uint32_t)sport << 6) ^ dport;
+	return (key * 2654435761u) >> (32 - conn_bucket_bits);
+}
+
+static unsigned int csp_conn_bucket_count(unsigned int conns) {
+	unsigned int buckets = 8;
+	while (buckets < conns) {
+		buckets <<= 1;
+	}
+	return buckets;
+}
+
+size_t csp_conn_storage_size(unsigned int conn_max) {
+	return conn_max * sizeof(csp_conn_t) + csp_conn_bucket_count(conn_max) * sizeof(uint16_t) + sizeof(void *);
+}
 
 void csp_conn_check_timeouts(void) {
 #if (CSP_USE_RDP)
-	for (int i = 0; i < CSP_CONN_MAX; i++) {
-		if (arr_conn[i].state == CONN_OPEN) {
-			if (arr_conn[i].idin.flags & CSP_FRDP) {
-				csp_rdp_check_timeouts(&arr_conn[i]);
+	/* The list is walked without the lock, a connection closed meanwhile is checked again on the next call */
+	uint16_t i = conn_open_head;
+	while (i != CSP_CONN_NONE) {
+		csp_conn_t * conn = &arr_conn[i];
+		i = conn->open_next;
+		if (conn->state == CONN_OPEN) {
+			if (conn->idin.flags & CSP_FRDP) {
+				csp_rdp_check_timeouts(conn);
 			}
 		}
 	}
@@ -39,49 +93,121 @@ int csp_conn_enqueue_packet(csp_conn_t * conn, csp_packet_t * packet) {
 	if (!conn)
 		return CSP_ERR_INVAL;
 
-	if (csp_queue_enqueue(conn->rx_queue, &packet, 0) != CSP_QUEUE_OK) {
+	/* Application data goes to the pool of the socket, control packets never get here */
+	csp_packet_t * queued = packet;
+	if ((packet != NULL) && (conn->rx_pool != NULL)) {
+		queued = csp_buffer_pool_copy(conn->rx_pool, packet);
+		if (queued == NULL) {
+			csp_dbg_conn_ovf++;
+			return CSP_ERR_NOBUFS;
+		}
+	}
+
+	if (csp_queue_enqueue(conn->rx_queue, &queued, 0) != CSP_QUEUE_OK) {
 		csp_dbg_conn_ovf++;
+		if (queued != packet) {
+			csp_buffer_free(queued);
+		}
 		return CSP_ERR_NOMEM;
 	}
 
+	if (queued != packet) {
+		csp_buffer_free(packet);
+	}
+
 	return CSP_ERR_NONE;
 }
 
 void csp_conn_init(void) {
 
-	for (int i = 0; i < CSP_CONN_MAX; i++) {
+	unsigned int count = (csp_conf.conn_max > 0) ? csp_conf.conn_max : CSP_CONN_MAX;
+	if (count >= CSP_CONN_NONE) {
+		csp_dbg_errno = CSP_DBG_ERR_CONN_MAX;
+		count = CSP_CONN_NONE - 1;
+	}
+
+	if (csp_conf.conn_storage != NULL) {
+		/* Connections first, then the hash buckets */
+		uintptr_t addr = (uintptr_t)csp_conf.conn_storage;
+		addr = (addr + sizeof(void *) - 1) & ~(uintptr_t)(sizeof(void *) - 1);
+		arr_conn = (csp_conn_t *)addr;
+		conn_bucket = (uint16_t *)&arr_conn[count];
+		conn_bucket_bits = __builtin_ctz(csp_conn_bucket_count(count));
+	} else {
+		/* The built-in pool is fixed at compile time */
+		if (count > CSP_CONN_MAX) {
+			csp_dbg_errno = CSP_DBG_ERR_CONN_MAX;
+			count = CSP_CONN_MAX;
+		}
+		arr_conn = arr_conn_default;
+		conn_bucket = arr_bucket_default;
+		/* Largest power of two that fits the default buckets */
+		conn_bucket_bits = 31 - __builtin_clz(2 * CSP_CONN_MAX);
+	}
+
+	conn_count = count;
+
+	for (unsigned int i = 0; i < (1U << conn_bucket_bits); i++) {
+		conn_bucket[i] = CSP_CONN_NONE;
+	}
+
+	for (unsigned int i = 0; i < CSP_CONN_PORTS; i++) {
+		conn_client[i] = NULL;
+	}
+	conn_ports_used = 0;
+	conn_port_last = CSP_PORT_MAX_BIND;
+	conn_open_head = CSP_CONN_NONE;
+
+	for (unsigned int i = 0; i < conn_count; i++) {
 		csp_conn_t * conn = &arr_conn[i];
 
-		conn->sport_outgoing = CSP_PORT_MAX_BIND + 1 + i;
+		conn->sport_outgoing = 0;
 		conn->state = CONN_CLOSED;
 		conn->idin.flags = 0;
+		conn->next = (i + 1 < conn_count) ? i + 1 : CSP_CONN_NONE;
 		conn->rx_queue = csp_queue_create_static(CSP_CONN_RXQUEUE_LEN, sizeof(csp_packet_t *), conn->rx_queue_static_data, &conn->rx_queue_static);
 
+		csp_bin_sem_init(&conn->credit.wait);
+
 #if (CSP_USE_RDP)
 		csp_rdp_init(conn);
 #endif
 	}
-}
 
-csp_conn_t * csp_conn_find_dport(unsigned int dport) {
+	conn_free_head = (conn_count > 0) ? 0 : CSP_CONN_NONE;
+	conn_free_tail = (conn_count > 0) ? conn_count - 1 : CSP_CONN_NONE;
 
-	for (int i = 0; i < CSP_CONN_MAX; i++) {
-		csp_conn_t * conn = &arr_conn[i];
+	csp_bin_sem_init(&conn_lock);
+}
 
-		/* Connection must match dport */
-		if (conn->idin.dport != dport)
-			continue;
+csp_conn_t * csp_conn_find_dport(unsigned int dport) {
 
-		/* Connection must be open */
-		if (conn->state != CONN_OPEN)
-			continue;
+	if (dport >= CSP_CONN_PORTS) {
+		return NULL;
+	}
 
-		/* Connection must be client */
-		if (conn->type != CONN_CLIENT)
-			continue;
+	return __atomic_load_n(&conn_client[dport], __ATOMIC_ACQUIRE);
+}
 
-		/* All conditions found! */
-		return conn;
+/**
+ * Search the hash chain of an incoming connection.
+ * Without the lock, a connection closed meanwhile may lead the walk to another chain or the free list, so the walk
+ * is bounded, and only open server connections match.
+ */
+static csp_conn_t * csp_conn_find_server(csp_id_t * id) {
+
+	uint16_t i = __atomic_load_n(&conn_bucket[csp_conn_hash(id->dport, id->sport, id->src)], __ATOMIC_ACQUIRE);
+
+	for (unsigned int steps = 0; (i != CSP_CONN_NONE) && (steps < conn_count); steps++) {
+		csp_conn_t * candidate = &arr_conn[i];
+		if ((candidate->idin.dport == id->dport) &&
+			(candidate->idin.sport == id->sport) &&
+			(candidate->idin.src == id->src) &&
+			(candidate->type == CONN_SERVER) &&
+			(candidate->state == CONN_OPEN)) {
+			return candidate;
+		}
+		i = __atomic_load_n(&candidate->next, __ATOMIC_ACQUIRE);
 	}
 
 	return NULL;
@@ -89,55 +215,33 @@ csp_conn_t * csp_conn_find_dport(unsigned int dport) {
 
 csp_conn_t * csp_conn_find_existing(csp_id_t * id) {
 
-	for (int i = 0; i < CSP_CONN_MAX; i++) {
-		csp_conn_t * conn = &arr_conn[i];
-
-		/* Connection must be open */
-		if (conn->state != CONN_OPEN)
-			continue;
-
-		/**
-		 * This search looks verbose, Instead of a big if statement, it is written out as
-		 * conditions. This has been done for clarity. The least likely check is put first
-		 * for runtime speed improvement.
-		 * Also this is written using explicit fields, not bitmasks, in order to improve
-		 * portability and dual use between different header formats.
-		 */
-
-		/* Outgoing connections are uniquely defined by the source port,
-		 * So only the incoming destination port must match. This means
-		 * that responses to broadcast addresses, are accepted as long
-		 * as the incoming port matches the unique source port of the
-		 * connection */
-		if (conn->type == CONN_CLIENT) {
-
-			/* Connection must match dport */
-			if (conn->idin.dport != id->dport)
-				continue;
-
-			/* Incoming connections are uniquely defined by the source amd
-			 * destination port, as well as the source node. Incoming
-			 * connections can never come from a brodcast address */
-		} else {
-
-			/* Connection must match dport */
-			if (conn->idin.dport != id->dport)
-				continue;
-
-			/* Connection must match sport */
-			if (conn->idin.sport != id->sport)
-				continue;
-
-			/* Connection must match source */
-			if (conn->idin.src != id->src)
-				continue;
-		}
+	/* Outgoing connections are uniquely defined by the source port,
+	 * So only the incoming destination port must match. This means
+	 * that responses to broadcast addresses, are accepted as long
+	 * as the incoming port matches the unique source port of the
+	 * connection */
+	csp_conn_t * conn = csp_conn_find_dport(id->dport);
+	if (conn != NULL) {
+		return conn;
+	}
 
-		/* All conditions found! */
+	/* Incoming connections are uniquely defined by the source amd
+	 * destination port, as well as the source node. Incoming
+	 * connections can never come from a brodcast address */
+	conn = csp_conn_find_server(id);
+	if (conn != NULL) {
 		return conn;
 	}
 
-	return NULL;
+	/* A miss opens a new connection, so make sure it is not a lookup racing with a close */
+	csp_bin_sem_wait(&conn_lock, CSP_MAX_TIMEOUT);
+	conn = csp_conn_find_dport(id->dport);
+	if (conn == NULL) {
+		conn = csp_conn_find_server(id);
+	}
+	csp_bin_sem_post(&conn_lock);
+
+	return conn;
 }
 
 static int csp_conn_flush_rx_queue(csp_conn_t * conn) {
@@ -154,36 +258,122 @@ static int csp_conn_flush_rx_queue(csp_conn_t * conn) {
 	return CSP_ERR_NONE;
 }
 
+/* Take the least recently used free outgoing port, must hold conn_lock */
+static int csp_conn_port_allocate(void) {
+
+	for (unsigned int j = 0; j < CSP_CONN_PORTS; j++) {
+		unsigned int port = conn_port_last + 1 + j;
+		if (port >= CSP_CONN_PORTS) {
+			port = CSP_PORT_MAX_BIND + 1 + (port - CSP_CONN_PORTS) % (CSP_CONN_PORTS - CSP_PORT_MAX_BIND - 1);
+		}
+		if ((conn_ports_used & (1ULL << port)) == 0) {
+			conn_ports_used |= (1ULL << port);
+			conn_port_last = port;
+			return port;
+		}
+	}
+
+	return -1;
+}
+
 csp_conn_t * csp_conn_allocate(csp_conn_type_t type) {
 
-	static uint8_t csp_conn_last_given = 0;
+	csp_bin_sem_wait(&conn_lock, CSP_MAX_TIMEOUT);
 
-	/* Search for free connection */
-	csp_conn_t * conn = NULL;
-	int i = csp_conn_last_given;
-	for (int j = 0; j < CSP_CONN_MAX; j++) {
-		i = (i + 1) % CSP_CONN_MAX;
+	/* Take the connection closed the longest time ago */
+	if (conn_free_head == CSP_CONN_NONE) {
+		csp_bin_sem_post(&conn_lock);
+		csp_dbg_conn_out++;
+		return NULL;
+	}
 
-		int expected = CONN_CLOSED;
-		if (atomic_compare_exchange_strong(&arr_conn[i].state, &expected, CONN_OPEN)) {
-			conn = &arr_conn[i];
-			csp_conn_last_given = i;
-			break;
+	csp_conn_t * conn = &arr_conn[conn_free_head];
+
+	/* Outgoing connections are identified by their source port */
+	if (type == CONN_CLIENT) {
+		int port = csp_conn_port_allocate();
+		if (port < 0) {
+			csp_bin_sem_post(&conn_lock);
+			csp_dbg_conn_out++;
+			return NULL;
 		}
+		conn->sport_outgoing = port;
+		__atomic_store_n(&conn_client[port], conn, __ATOMIC_RELEASE);
 	}
 
-	if (conn == NULL) {
-		csp_dbg_conn_out++;
-		return NULL;
+	conn_free_head = conn->next;
+	if (conn_free_head == CSP_CONN_NONE) {
+		conn_free_tail = CSP_CONN_NONE;
+	}
+	__atomic_store_n(&conn->next, CSP_CONN_NONE, __ATOMIC_RELEASE);
+
+	/* Add to the open list */
+	uint16_t index = csp_conn_index(conn);
+	conn->open_prev = CSP_CONN_NONE;
+	conn->open_next = conn_open_head;
+	if (conn_open_head != CSP_CONN_NONE) {
+		arr_conn[conn_open_head].open_prev = index;
 	}
+	conn_open_head = index;
 
 	conn->timestamp = 0;
 	conn->type = type;
 	conn->idin.flags = 0;
 	conn->idout.flags = 0;
+	conn->state = CONN_OPEN;
+
+	csp_bin_sem_post(&conn_lock);
+
 	return conn;
 }
 
+/* Remove from the lookup index and return to the free list */
+static void csp_conn_release(csp_conn_t * conn) {
+
+	csp_bin_sem_wait(&conn_lock, CSP_MAX_TIMEOUT);
+
+	uint16_t index = csp_conn_index(conn);
+
+	if (conn->type == CONN_CLIENT) {
+		if (conn_client[conn->sport_outgoing] == conn) {
+			__atomic_store_n(&conn_client[conn->sport_outgoing], NULL, __ATOMIC_RELEASE);
+			conn_ports_used &= ~(1ULL << conn->sport_outgoing);
+		}
+	} else {
+		uint16_t * link = &conn_bucket[csp_conn_hash(conn->idin.dport, conn->idin.sport, conn->idin.src)];
+		while (*link != CSP_CONN_NONE) {
+			if (*link == index) {
+				__atomic_store_n(link, conn->next, __ATOMIC_RELEASE);
+				break;
+			}
+			link = &arr_conn[*link].next;
+		}
+	}
+
+	/* Remove from the open list */
+	if (conn->open_prev != CSP_CONN_NONE) {
+		arr_conn[conn->open_prev].open_next = conn->open_next;
+	} else {
+		conn_open_head = conn->open_next;
+	}
+	if (conn->open_next != CSP_CONN_NONE) {
+		arr_conn[conn->open_next].open_prev = conn->open_prev;
+	}
+
+	/* Reused last, so late references to a closed connection stay harmless as long as possible */
+	__atomic_store_n(&conn->next, CSP_CONN_NONE, __ATOMIC_RELEASE);
+	if (conn_free_tail == CSP_CONN_NONE) {
+		conn_free_head = index;
+	} else {
+		__atomic_store_n(&arr_conn[conn_free_tail].next, index, __ATOMIC_RELEASE);
+	}
+	conn_free_tail = index;
+
+	conn->state = CONN_CLOSED;
+
+	csp_bin_sem_post(&conn_lock);
+}
+
 csp_conn_t * csp_conn_new(csp_id_t idin, csp_id_t idout, csp_conn_type_t type) {
 
 	/* Allocate connection structure */
@@ -196,9 +386,20 @@ csp_conn_t * csp_conn_new(csp_id_t idin, csp_id_t idout, csp_conn_type_t type) {
 		csp_id_copy(&conn->idout, &idout);
 
 		conn->timestamp = csp_get_ms();
+		conn->rx_pool = NULL;
+		csp_credit_init(conn);
 
 		/* Ensure connection queue is empty */
 		csp_conn_flush_rx_queue(conn);
+
+		/* Make incoming connections visible to the router */
+		if (type == CONN_SERVER) {
+			unsigned int hash = csp_conn_hash(conn->idin.dport, conn->idin.sport, conn->idin.src);
+			csp_bin_sem_wait(&conn_lock, CSP_MAX_TIMEOUT);
+			conn->next = conn_bucket[hash];
+			__atomic_store_n(&conn_bucket[hash], csp_conn_index(conn), __ATOMIC_RELEASE);
+			csp_bin_sem_post(&conn_lock);
+		}
 	}
 
 	return conn;
@@ -239,7 +440,7 @@ int csp_conn_close(csp_conn_t * conn, uint8_t closed_by) {
 #endif
 
 	/* Set to closed */
-	conn->state = CONN_CLOSED;
+	csp_conn_release(conn);
 
 	return CSP_ERR_NONE;
 }
@@ -274,6 +475,10 @@ csp_conn_t * csp_connect(uint8_t prio, uint16_t dest, uint8_t dport, uint32_t ti
 		opts &= ~CSP_O_CRC32;
 	}
 
+	if (opts & CSP_O_NOSIPHASH) {
+		opts &= ~CSP_O_SIPHASH;
+	}
+
 	if (opts & CSP_O_RDP) {
 #if (CSP_USE_RDP)
 		incoming_id.flags |= CSP_FRDP;
@@ -284,7 +489,16 @@ csp_conn_t * csp_connect(uint8_t prio, uint16_t dest, uint8_t dport, uint32_t ti
 #endif
 	}
 
-	if (opts & CSP_O_HMAC) {
+	/* SipHash replaces HMAC when both are requested */
+	if (opts & CSP_O_SIPHASH) {
+#if (CSP_USE_HMAC)
+		outgoing_id.flags |= CSP_FSIPHASH;
+		incoming_id.flags |= CSP_FSIPHASH;
+#else
+		csp_dbg_errno = CSP_DBG_ERR_UNSUPPORTED;
+		return NULL;
+#endif
+	} else if (opts & CSP_O_HMAC) {
 #if (CSP_USE_HMAC)
 		outgoing_id.flags |= CSP_FHMAC;
 		incoming_id.flags |= CSP_FHMAC;
@@ -299,6 +513,12 @@ csp_conn_t * csp_connect(uint8_t prio, uint16_t dest, uint8_t dport, uint32_t ti
 		incoming_id.flags |= CSP_FCRC32;
 	}
 
+	/* RDP has its own window */
+	if ((opts & CSP_O_CREDIT) && !(opts & CSP_O_RDP)) {
+		outgoing_id.flags |= CSP_FCREDIT;
+		incoming_id.flags |= CSP_FCREDIT;
+	}
+
 	/* Find a new connection */
 	csp_conn_t * conn = csp_conn_new(incoming_id, outgoing_id, CONN_CLIENT);
 	if (conn == NULL) {
@@ -318,7 +538,8 @@ csp_conn_t * csp_connect(uint8_t prio, uint16_t dest, uint8_t dport, uint32_t ti
 	if (outgoing_id.flags & CSP_FRDP) {
 		/* If the transport layer has failed to connect
 		 * deallocate connection structure again and return NULL */
-		if (csp_rdp_connect(conn) != CSP_ERR_NONE) {
+		int ret = (opts & CSP_O_NONBLOCK) ? csp_rdp_connect_nonblock(conn) : csp_rdp_connect(conn);
+		if (ret != CSP_ERR_NONE) {
 			csp_close(conn);
 			return NULL;
 		}
@@ -329,6 +550,17 @@ csp_conn_t * csp_connect(uint8_t prio, uint16_t dest, uint8_t dport, uint32_t ti
 	return conn;
 }
 
+int csp_conn_wait_open(csp_conn_t * conn, uint32_t timeout) {
+
+#if (CSP_USE_RDP)
+	if (conn->idout.flags & CSP_FRDP) {
+		return csp_rdp_connect_wait(conn, timeout);
+	}
+#endif
+
+	return CSP_ERR_NONE;
+}
+
 int csp_conn_dport(csp_conn_t * conn) {
 
 	return conn->idin.dport;
@@ -397,7 +629,7 @@ int csp_conn_flags_out(csp_conn_t * conn) {
 
 void csp_conn_print_table(void) {
 
-	for (unsigned int i = 0; i < CSP_CONN_MAX; i++) {
+	for (unsigned int i = 0; i < conn_count; i++) {
 		__attribute__((__unused__)) csp_conn_t * conn = &arr_conn[i];
 		csp_print("[%02u %p] S:%u, %u -> %u, %u -> %u (%u) fl %x\r\n",
 				  i, conn, conn->state, conn->idin.src, conn->idin.dst,
@@ -419,9 +651,9 @@ void csp_conn_print_table(void) {
 int csp_conn_print_table_str(char * str_buf, int str_size) {
 
 	/* Display up to 10 connections */
-	unsigned int start = (CSP_CONN_MAX > 10) ? (CSP_CONN_MAX - 10) : 0;
+	unsigned int start = (conn_count > 10) ? (conn_count - 10) : 0;
 
-	for (unsigned int i = start; i < CSP_CONN_MAX; i++) {
+	for (unsigned int i = start; i < conn_count; i++) {
 		csp_conn_t * conn = &arr_conn[i];
 		char buf[100];
 		snprintf(buf, sizeof(buf), "[%02u %p] S:%u, %u -> %u, %u -> %u (%u)\n",
@@ -440,6 +672,6 @@ int csp_conn_print_table_str(char * str_buf, int str_size) {
 #endif
 
 const csp_conn_t * csp_conn_get_array(size_t * size) {
-	*size = CSP_CONN_MAX;
+	*size = conn_count;
 	return arr_conn;
 }
@@ -32,18 +32,29 @@ typedef enum {
 #define CSP_RDP_CLOSED_BY_TIMEOUT   0x04
 #define CSP_RDP_CLOSED_BY_ALL       (CSP_RDP_CLOSED_BY_USERSPACE | CSP_RDP_CLOSED_BY_PROTOCOL | CSP_RDP_CLOSED_BY_TIMEOUT)
 
+/* Sequence numbers wrap at 2^16, so the rings are a power of two to keep consecutive numbers in different slots */
+#define CSP_RDP_RING_SIZE(n) (((n) <= 1) ? 1U : (1U << (32 - __builtin_clz((n) - 1))))
+
+/** Retransmission ring, holds a full send window */
+#define CSP_RDP_TX_RING CSP_RDP_RING_SIZE(CSP_RDP_MAX_WINDOW)
+
+/** Reorder buffer, holds the accepted receive range of two windows */
+#define CSP_RDP_RX_RING CSP_RDP_RING_SIZE(2 * CSP_RDP_MAX_WINDOW)
+
 /**
  * RDP Connection
  */
 typedef struct {
 	csp_rdp_state_t state; /**< Connection state */
 	uint8_t closed_by;     /**< Tracks 'who' have closed the RDP connection */
+	uint8_t syn_retry;     /**< Half-open retries left for a non-blocking connect */
 	uint16_t snd_nxt;      /**< The sequence number of the next segment that is to be sent */
 	uint16_t snd_una;      /**< The sequence number of the oldest unacknowledged segment */
 	uint16_t snd_iss;      /**< The initial send sequence number */
 	uint16_t rcv_cur;      /**< The sequence number of the last segment received correctly and in sequence */
 	uint16_t rcv_irs;      /**< The initial receive sequence number */
 	uint16_t rcv_lsa;      /**< The last sequence number acknowledged by the receiver */
+	uint16_t tx_tail;      /**< The oldest sequence number that may still be in tx_ring */
 	uint32_t window_size;
 	uint32_t conn_timeout;
 	uint32_t packet_timeout;
@@ -52,9 +63,23 @@ typedef struct {
 	uint32_t ack_delay_count;
 	uint32_t ack_timestamp;
 	csp_bin_sem_t tx_wait;
+	csp_packet_t * tx_ring[CSP_RDP_TX_RING]; /**< Unacknowledged segments, indexed by sequence number */
+	csp_packet_t * rx_ring[CSP_RDP_RX_RING]; /**< Out of order segments, indexed by sequence number */
 
 } csp_rdp_t;
 
+/**
+ * Credit flow control state, see csp_credit.h
+ */
+typedef struct {
+	uint16_t sent;          /**< Data packets sent */
+	uint16_t limit;         /**< Data packets the peer allows us to send, from its last grant */
+	uint16_t seen;          /**< Data packets sent by the peer, up to the last one received or probed */
+	uint16_t queued;        /**< Data packets in the receive queue, not read by the application yet */
+	uint16_t granted;       /**< Limit in the last grant sent */
+	csp_bin_sem_t wait;     /**< Posted by the router on new grants */
+} csp_credit_t;
+
 /** @brief Connection struct */
 struct csp_conn_s {
 	atomic_int type;   /* Connection type (CONN_CLIENT or CONN_SERVER) */
@@ -62,6 +87,9 @@ struct csp_conn_s {
 	csp_id_t idin;          /* Identifier received */
 	csp_id_t idout;         /* Identifier transmitted */
 	uint8_t sport_outgoing; /* When used for outgoing, use this sport */
+	uint16_t next;          /* Next connection in hash bucket or free list */
+	uint16_t open_prev;     /* Open connections list */
+	uint16_t open_next;
 
 	csp_queue_handle_t rx_queue;        /* Queue for RX packets */
 	csp_static_queue_t rx_queue_static; /* Static storage for rx queue */
@@ -70,8 +98,10 @@ struct csp_conn_s {
 	void (*callback)(csp_packet_t * packet);
 
 	csp_socket_t * dest_socket; /* incoming connections destination socket */
+	struct csp_buffer_pool_s * rx_pool; /* Application pool for received packets, from the socket */
 	uint32_t timestamp;         /* Time the connection was opened */
 	uint32_t opts;              /* Connection or socket options */
+	csp_credit_t credit;        /* Credit flow control state */
 #if (CSP_USE_RDP)
 	csp_rdp_t rdp; /* RDP state */
 #endif
@@ -0,0 +1,161 @@
+#include "csp_conn_pool.h"
+
+#include <csp/csp.h>
+#include <csp/arch/csp_time.h>
+
+typedef struct {
+	csp_conn_t * conn;  // NULL if the entry is free
+	uint16_t dest;
+	uint8_t port;
+	uint32_t opts;
+	uint32_t last_used;
+} csp_conn_pool_entry_t;
+
+static csp_conn_pool_entry_t pool[CSP_CONN_POOL_SIZE];
+
+static csp_bin_sem_t pool_lock;
+
+void csp_conn_pool_init(void) {
+
+	for (unsigned int i = 0; i < CSP_CONN_POOL_SIZE; i++) {
+		pool[i].conn = NULL;
+	}
+
+	csp_bin_sem_init(&pool_lock);
+}
+
+/* Take out connections idle for too long, must hold pool_lock */
+static unsigned int csp_conn_pool_expire(csp_conn_t ** expired) {
+
+	unsigned int count = 0;
+	uint32_t now = csp_get_ms();
+
+	for (unsigned int i = 0; i < CSP_CONN_POOL_SIZE; i++) {
+		if ((pool[i].conn != NULL) && ((now - pool[i].last_used) >= csp_conf.keepalive_idle)) {
+			expired[count++] = pool[i].conn;
+			pool[i].conn = NULL;
+		}
+	}
+
+	return count;
+}
+
+static void csp_conn_pool_close(csp_conn_t ** conns, unsigned int count) {
+	for (unsigned int i = 0; i < count; i++) {
+		csp_close(conns[i]);
+	}
+}
+
+/* A pooled connection may have been closed by the peer or the protocol while idle */
+static bool csp_conn_pool_healthy(csp_conn_t * conn) {
+
+	if (conn->state != CONN_OPEN) {
+		return false;
+	}
+
+#if (CSP_USE_RDP)
+	if ((conn->idout.flags & CSP_FRDP) && (conn->rdp.state != RDP_OPEN)) {
+		return false;
+	}
+#endif
+
+	return true;
+}
+
+csp_conn_t * csp_conn_pool_get(uint8_t prio, uint16_t dest, uint8_t port, uint32_t opts) {
+
+	csp_conn_t * closing[CSP_CONN_POOL_SIZE];
+	csp_conn_t * conn = NULL;
+
+	csp_bin_sem_wait(&pool_lock, CSP_MAX_TIMEOUT);
+
+	unsigned int count = csp_conn_pool_expire(closing);
+
+	for (unsigned int i = 0; i < CSP_CONN_POOL_SIZE; i++) {
+
+		if ((pool[i].conn == NULL) || (pool[i].dest != dest) || (pool[i].port != port) || (pool[i].opts != opts)) {
+			continue;
+		}
+
+		csp_conn_t * candidate = pool[i].conn;
+		pool[i].conn = NULL;
+
+		if (csp_conn_pool_healthy(candidate)) {
+			conn = candidate;
+			break;
+		}
+		closing[count++] = candidate;
+	}
+
+	csp_bin_sem_post(&pool_lock);
+
+	csp_conn_pool_close(closing, count);
+
+	if (conn == NULL) {
+		return csp_connect(prio, dest, port, 0, opts);
+	}
+
+	/* Drop late replies to an earlier transaction */
+	csp_packet_t * packet;
+	while ((packet = csp_read(conn, 0)) != NULL) {
+		csp_buffer_free(packet);
+	}
+
+	conn->idout.pri = prio;
+
+	return conn;
+}
+
+void csp_conn_pool_put(csp_conn_t * conn, uint16_t dest, uint8_t port, uint32_t opts) {
+
+	csp_conn_t * closing[CSP_CONN_POOL_SIZE + 1];
+
+	csp_bin_sem_wait(&pool_lock, CSP_MAX_TIMEOUT);
+
+	unsigned int count = csp_conn_pool_expire(closing);
+
+	/* Take a free entry, or the least recently used */
+	unsigned int slot = 0;
+	for (unsigned int i = 0; i < CSP_CONN_POOL_SIZE; i++) {
+		if (pool[i].conn == NULL) {
+			slot = i;
+			break;
+		}
+		if ((int32_t)(pool[i].last_used - pool[slot].last_used) < 0) {
+			slot = i;
+		}
+	}
+
+	if (pool[slot].conn != NULL) {
+		closing[count++] = pool[slot].conn;
+	}
+
+	pool[slot].conn = conn;
+	pool[slot].dest = dest;
+	pool[slot].port = port;
+	pool[slot].opts = opts;
+	pool[slot].last_used = csp_get_ms();
+
+	csp_bin_sem_post(&pool_lock);
+
+	csp_conn_pool_close(closing, count);
+}
+
+void csp_transaction_pool_flush(void) {
+
+	csp_conn_t * closing[CSP_CONN_POOL_SIZE];
+	unsigned int count = 0;
+
+	csp_bin_sem_wait(&pool_lock, CSP_MAX_TIMEOUT);
+
+	for (unsigned int i = 0; i < CSP_CONN_POOL_SIZE; i++) {
+		if (pool[i].conn != NULL) {
+			closing[count++] = pool[i].conn;
+			pool[i].conn = NULL;
+		}
+	}
+
+	csp_bin_sem_post(&pool_lock);
+
+	csp_conn_pool_close(closing, count);
+}
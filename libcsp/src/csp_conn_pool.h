@@ -0,0 +1,25 @@
+#pragma once
+
+#include "csp_conn.h"
+
+#ifndef CSP_CONN_POOL_SIZE
+#define CSP_CONN_POOL_SIZE 4  //! Number of idle keep-alive connections kept for transactions, see #CSP_O_KEEPALIVE
+#endif
+
+/**
+ * Init transaction connection pool
+ */
+void csp_conn_pool_init(void);
+
+/**
+ * Borrow a connection for a transaction.
+ * Reuses an idle connection to the same destination, port and options if one is healthy, otherwise connects.
+ * @return connection, or NULL if a new connection could not be made
+ */
+csp_conn_t * csp_conn_pool_get(uint8_t prio, uint16_t dest, uint8_t port, uint32_t opts);
+
+/**
+ * Return a borrowed connection after a successful transaction, to keep it open for the next.
+ * The least recently used connection is closed, if the pool is full.
+ */
+void csp_conn_pool_put(csp_conn_t * conn, uint16_t dest, uint8_t port, uint32_t opts);
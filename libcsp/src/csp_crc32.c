@@ -4,6 +4,7 @@
 #include <csp/csp_id.h>
 
 #include <endian.h>
+#include <string.h>
 
 #ifdef __AVR__
 #include <avr/pgmspace.h>
@@ -44,10 +45,39 @@ static const uint32_t crc_tab[256] = {
 	0xF36E6F75, 0x0105EC76, 0x12551F82, 0xE03E9C81, 0x34F4F86A, 0xC69F7B69, 0xD5CF889D, 0x27A40B9E,
 	0x79B737BA, 0x8BDCB4B9, 0x988C474D, 0x6AE7C44E, 0xBE2DA0A5, 0x4C4623A6, 0x5F16D052, 0xAD7D5351};
 
-uint32_t csp_crc32_memory(const uint8_t * data, uint32_t length) {
-	uint32_t crc;
+/**
+ * Slicing-by-8 needs seven extra 1 KiB tables, which are generated from crc_tab on first use.
+ * Disabled by default on AVR, where RAM is scarcer than cycles.
+ */
+#ifndef CSP_CRC32_SLICE8
+#ifdef __AVR__
+#define CSP_CRC32_SLICE8 0
+#else
+#define CSP_CRC32_SLICE8 1
+#endif
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CSP_CRC32_HAVE_SSE42 1
+#include <nmmintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__GNUC__) && (defined(__ARM_FEATURE_CRC32) || defined(__linux__))
+#define CSP_CRC32_HAVE_ARMV8 1
+#include <arm_acle.h>
+#if !defined(__ARM_FEATURE_CRC32)
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+#endif
+
+/* Kernels update a running (non-inverted) CRC, so they can be chained */
+typedef uint32_t (*csp_crc32_fn_t)(uint32_t crc, const uint8_t * data, uint32_t length);
+
+static uint32_t csp_crc32_byte(uint32_t crc, const uint8_t * data, uint32_t length) {
 
-	crc = 0xFFFFFFFF;
 	while (length--)
 #ifdef __AVR__
 		crc = pgm_read_dword(&crc_tab[(crc ^ *data++) & 0xFFL]) ^ (crc >> 8);
@@ -55,7 +85,234 @@ uint32_t csp_crc32_memory(const uint8_t * data, uint32_t length) {
 		crc = crc_tab[(crc ^ *data++) & 0xFFL] ^ (crc >> 8);
 #endif
 
-	return (crc ^ 0xFFFFFFFF);
+	return crc;
+}
+
+#if (CSP_CRC32_SLICE8)
+static uint32_t crc_tab8[7][256];
+
+static void csp_crc32_slice8_tables(void) {
+
+	for (unsigned int n = 0; n < 256; n++) {
+		uint32_t crc = crc_tab[n];
+		for (unsigned int k = 0; k < 7; k++) {
+			crc = crc_tab[crc & 0xFF] ^ (crc >> 8);
+			crc_tab8[k][n] = crc;
+		}
+	}
+}
+
+static uint32_t csp_crc32_slice8(uint32_t crc, const uint8_t * data, uint32_t length) {
+
+	/* Byte-wise until aligned, so the word loads below are cheap everywhere */
+	while (length && ((uintptr_t)data & 7)) {
+		crc = crc_tab[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+		length--;
+	}
+
+	while (length >= 8) {
+		uint32_t lo, hi;
+		memcpy(&lo, data, sizeof(lo));
+		memcpy(&hi, data + 4, sizeof(hi));
+		lo = le32toh(lo) ^ crc;
+		hi = le32toh(hi);
+		crc = crc_tab8[6][lo & 0xFF] ^ crc_tab8[5][(lo >> 8) & 0xFF] ^
+			  crc_tab8[4][(lo >> 16) & 0xFF] ^ crc_tab8[3][lo >> 24] ^
+			  crc_tab8[2][hi & 0xFF] ^ crc_tab8[1][(hi >> 8) & 0xFF] ^
+			  crc_tab8[0][(hi >> 16) & 0xFF] ^ crc_tab[hi >> 24];
+		data += 8;
+		length -= 8;
+	}
+
+	return csp_crc32_byte(crc, data, length);
+}
+#endif
+
+#if (CSP_CRC32_HAVE_SSE42)
+__attribute__((target("sse4.2")))
+static uint32_t csp_crc32_sse42(uint32_t crc, const uint8_t * data, uint32_t length) {
+
+	uint64_t crc64 = crc;
+
+	while (length >= 8) {
+		uint64_t word;
+		memcpy(&word, data, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+		data += 8;
+		length -= 8;
+	}
+
+	crc = crc64;
+	while (length--) {
+		crc = _mm_crc32_u8(crc, *data++);
+	}
+
+	return crc;
+}
+#endif
+
+#if (CSP_CRC32_HAVE_ARMV8)
+__attribute__((target("arch=armv8-a+crc")))
+static uint32_t csp_crc32_armv8(uint32_t crc, const uint8_t * data, uint32_t length) {
+
+	while (length >= 8) {
+		uint64_t word;
+		memcpy(&word, data, sizeof(word));
+		crc = __crc32cd(crc, word);
+		data += 8;
+		length -= 8;
+	}
+
+	while (length--) {
+		crc = __crc32cb(crc, *data++);
+	}
+
+	return crc;
+}
+#endif
+
+static uint32_t csp_crc32_resolve(uint32_t crc, const uint8_t * data, uint32_t length);
+
+static csp_crc32_fn_t csp_crc32_fn = csp_crc32_resolve;
+static csp_crc32_kernel_t csp_crc32_kernel = CSP_CRC32_KERNEL_AUTO;
+
+int csp_crc32_set_kernel(csp_crc32_kernel_t kernel) {
+
+	csp_crc32_fn_t fn = NULL;
+
+	if (kernel == CSP_CRC32_KERNEL_AUTO) {
+#if (CSP_CRC32_HAVE_SSE42)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("sse4.2")) {
+			return csp_crc32_set_kernel(CSP_CRC32_KERNEL_SSE42);
+		}
+#endif
+#if (CSP_CRC32_HAVE_ARMV8)
+		if (csp_crc32_set_kernel(CSP_CRC32_KERNEL_ARMV8) == CSP_ERR_NONE) {
+			return CSP_ERR_NONE;
+		}
+#endif
+#if (CSP_CRC32_SLICE8)
+		return csp_crc32_set_kernel(CSP_CRC32_KERNEL_SLICE8);
+#else
+		return csp_crc32_set_kernel(CSP_CRC32_KERNEL_BYTE);
+#endif
+	}
+
+	switch (kernel) {
+		case CSP_CRC32_KERNEL_BYTE:
+			fn = csp_crc32_byte;
+			break;
+#if (CSP_CRC32_SLICE8)
+		case CSP_CRC32_KERNEL_SLICE8:
+			/* Idempotent, so racing first callers write identical tables */
+			csp_crc32_slice8_tables();
+			fn = csp_crc32_slice8;
+			break;
+#endif
+#if (CSP_CRC32_HAVE_SSE42)
+		case CSP_CRC32_KERNEL_SSE42:
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("sse4.2")) {
+				fn = csp_crc32_sse42;
+			}
+			break;
+#endif
+#if (CSP_CRC32_HAVE_ARMV8)
+		case CSP_CRC32_KERNEL_ARMV8:
+#if defined(__ARM_FEATURE_CRC32)
+			fn = csp_crc32_armv8;
+#else
+			if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+				fn = csp_crc32_armv8;
+			}
+#endif
+			break;
+#endif
+		default:
+			break;
+	}
+
+	if (fn == NULL) {
+		return CSP_ERR_NOTSUP;
+	}
+
+	__atomic_store_n(&csp_crc32_kernel, kernel, __ATOMIC_RELAXED);
+	__atomic_store_n(&csp_crc32_fn, fn, __ATOMIC_RELEASE);
+	return CSP_ERR_NONE;
+}
+
+csp_crc32_kernel_t csp_crc32_get_kernel(void) {
+
+	if (__atomic_load_n(&csp_crc32_fn, __ATOMIC_ACQUIRE) == csp_crc32_resolve) {
+		csp_crc32_set_kernel(CSP_CRC32_KERNEL_AUTO);
+	}
+	return __atomic_load_n(&csp_crc32_kernel, __ATOMIC_RELAXED);
+}
+
+/* Initial kernel: selects the fastest one available on first use, then forwards to it */
+static uint32_t csp_crc32_resolve(uint32_t crc, const uint8_t * data, uint32_t length) {
+
+	csp_crc32_set_kernel(CSP_CRC32_KERNEL_AUTO);
+	return __atomic_load_n(&csp_crc32_fn, __ATOMIC_ACQUIRE)(crc, data, length);
+}
+
+uint32_t csp_crc32_init(void) {
+	return 0xFFFFFFFF;
+}
+
+uint32_t csp_crc32_update(uint32_t crc, const void * data, uint32_t length) {
+
+	csp_crc32_fn_t fn = __atomic_load_n(&csp_crc32_fn, __ATOMIC_ACQUIRE);
+	return fn(crc, data, length);
+}
+
+uint32_t csp_crc32_final(uint32_t crc) {
+	return crc ^ 0xFFFFFFFF;
+}
+
+/* x^(2^n) modulo the CRC-32C polynomial, reflected, for n = 0..31 */
+static const uint32_t crc_x2n_tab[32] = {
+	0x40000000, 0x20000000, 0x08000000, 0x00800000, 0x00008000, 0x82F63B78, 0x6EA2D55C, 0x18B8EA18,
+	0x510AC59A, 0xB82BE955, 0xB8FDB1E7, 0x88E56F72, 0x74C360A4, 0xE4172B16, 0x0D65762A, 0x35D73A62,
+	0x28461564, 0xBF455269, 0xE2EA32DC, 0xFE7740E6, 0xF946610B, 0x3C204F8F, 0x538586E3, 0x59726915,
+	0x734D5309, 0xBC1AC763, 0x7D0722CC, 0xD289CABE, 0xE94CA9BC, 0x05B74F3F, 0xA51E1F42, 0x40000000};
+
+/* Multiply a and b modulo the CRC-32C polynomial (reflected) */
+static uint32_t csp_crc32_multmodp(uint32_t a, uint32_t b) {
+
+	uint32_t m = 1UL << 31;
+	uint32_t p = 0;
+
+	while (m) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0) {
+				break;
+			}
+		}
+		m >>= 1;
+		b = (b & 1) ? ((b >> 1) ^ 0x82F63B78) : (b >> 1);
+	}
+
+	return p;
+}
+
+uint32_t csp_crc32_combine(uint32_t crc1, uint32_t crc2, uint32_t length2) {
+
+	/* Shift crc1 past length2 zero bytes: multiply by x^(8 * length2) */
+	uint32_t x = 1UL << 31;
+	for (unsigned int k = 3; length2; length2 >>= 1, k++) {
+		if (length2 & 1) {
+			x = csp_crc32_multmodp(crc_x2n_tab[k & 31], x);
+		}
+	}
+
+	return csp_crc32_multmodp(x, crc1) ^ crc2;
+}
+
+uint32_t csp_crc32_memory(const uint8_t * data, uint32_t length) {
+	return csp_crc32_final(csp_crc32_update(csp_crc32_init(), data, length));
 }
 
 int csp_crc32_append(csp_packet_t * packet) {
@@ -86,28 +343,39 @@ int csp_crc32_append(csp_packet_t * packet) {
 
 int csp_crc32_verify(csp_packet_t * packet) {
 
+	if (packet->length < sizeof(uint32_t)) {
+		return CSP_ERR_CRC32;
+	}
+
+	return csp_crc32_verify_precomputed(packet, csp_crc32_memory(packet->data, packet->length - sizeof(uint32_t)));
+}
+
+int csp_crc32_verify_precomputed(csp_packet_t * packet, uint32_t data_crc) {
+
 	uint32_t crc;
 
 	if (packet->length < sizeof(crc)) {
 		return CSP_ERR_CRC32;
 	}
 
-	/* Calculate CRC32, convert to network byte order */
-	csp_id_prepend(packet);
-	crc = csp_crc32_memory(packet->frame_begin, packet->frame_length);
-	crc = htobe32(crc);
+	/* Checksum on data only, convert to network byte order */
+	crc = htobe32(data_crc);
 
-	/* Compare calculated checksum with packet header */
+	/* Compare calculated checksum with packet trailer */
 	if (memcmp(&packet->data[packet->length] - sizeof(crc), &crc, sizeof(crc)) != 0) {
 
-		/* CRC32 with header failed, try without header */
-		crc = csp_crc32_memory(packet->data, packet->length - sizeof(crc));
+		/* CRC32 on data failed, try with header (excluding the checksum itself).
+		 * Only the header is walked, the rest is combined from the data checksum */
+		csp_id_prepend(packet);
+		const uint32_t header_length = packet->frame_length - packet->length;
+		crc = csp_crc32_memory(packet->frame_begin, header_length);
+		crc = csp_crc32_combine(crc, data_crc, packet->length - sizeof(crc));
 		crc = htobe32(crc);
 
 		if (memcmp(&packet->data[packet->length] - sizeof(crc), &crc, sizeof(crc)) != 0) {
 			return CSP_ERR_CRC32;
 		}
-		
+
 	}
 
 	/* Strip CRC32 */
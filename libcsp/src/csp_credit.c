@@ -0,0 +1,192 @@
+#include "csp_credit.h"
+
+#include <string.h>
+#include <endian.h>
+
+#include <csp/csp.h>
+#include <csp/arch/csp_time.h>
+
+#include "csp_conn.h"
+#include "csp_io.h"
+
+#define CREDIT_DATA  0x01  // Packet carries data for the application
+#define CREDIT_PROBE 0x02  // Sender is out of credits, answer with a grant
+
+typedef struct __attribute__((__packed__)) {
+	uint8_t flags;
+	uint16_t seq;    // Data packets sent so far by the sender of this packet, wraps
+	uint16_t limit;  // Data packets the receiver of this packet may send in total, wraps
+} credit_header_t;
+
+static uint16_t csp_credit_available(csp_conn_t * conn) {
+
+	uint16_t limit = __atomic_load_n(&conn->credit.limit, __ATOMIC_ACQUIRE);
+	int16_t available = limit - conn->credit.sent;
+
+	return (available > 0) ? available : 0;
+}
+
+/**
+ * Everything the peer has sent up to seen has either been received or lost, so the peer may send as many packets
+ * beyond that as there is free space in the receive queue. Lost packets never took space, so their credits return.
+ */
+static uint16_t csp_credit_limit(csp_conn_t * conn) {
+
+	uint16_t seen = __atomic_load_n(&conn->credit.seen, __ATOMIC_ACQUIRE);
+	uint16_t queued = __atomic_load_n(&conn->credit.queued, __ATOMIC_ACQUIRE);
+
+	return seen + CSP_CONN_RXQUEUE_LEN - queued;
+}
+
+static void csp_credit_header_add(csp_conn_t * conn, csp_packet_t * packet, uint8_t flags) {
+
+	uint16_t limit = csp_credit_limit(conn);
+
+	credit_header_t header = {
+		.flags = flags,
+		.seq = htobe16(conn->credit.sent),
+		.limit = htobe16(limit),
+	};
+	memcpy(&packet->data[packet->length], &header, sizeof(header));
+	packet->length += sizeof(header);
+
+	/* Sending our limit is a grant, also when carried by data */
+	conn->credit.granted = limit;
+}
+
+/* Grant or probe without data */
+static void csp_credit_send_cmp(csp_conn_t * conn, uint8_t flags) {
+
+	csp_packet_t * packet = csp_buffer_get(sizeof(credit_header_t));
+	if (packet == NULL) {
+		return;
+	}
+
+	packet->length = 0;
+	csp_credit_header_add(conn, packet, flags);
+	csp_send_direct(conn->idout, packet, NULL);
+}
+
+void csp_credit_init(csp_conn_t * conn) {
+
+	conn->credit.sent = 0;
+	conn->credit.limit = CSP_CONN_RXQUEUE_LEN;
+	conn->credit.seen = 0;
+	conn->credit.queued = 0;
+	conn->credit.granted = CSP_CONN_RXQUEUE_LEN;
+
+	/* Ensure semaphore is busy, so router task can release it */
+	csp_bin_sem_wait(&conn->credit.wait, 0);
+}
+
+int csp_credit_send(csp_conn_t * conn, csp_packet_t * packet, uint32_t timeout) {
+
+	if ((packet->length + sizeof(credit_header_t)) > csp_buffer_data_size()) {
+		return CSP_ERR_NOMEM;
+	}
+
+	const uint32_t start = csp_get_ms();
+
+	while (csp_credit_available(conn) == 0) {
+
+		uint32_t elapsed = csp_get_ms() - start;
+		if (elapsed >= timeout) {
+			return (timeout == 0) ? CSP_ERR_AGAIN : CSP_ERR_TIMEDOUT;
+		}
+
+		uint32_t wait = timeout - elapsed;
+		if (wait > CSP_CREDIT_PROBE_INTERVAL) {
+			wait = CSP_CREDIT_PROBE_INTERVAL;
+		}
+
+		if (csp_bin_sem_wait(&conn->credit.wait, wait) != CSP_SEMAPHORE_OK) {
+			/* The last grant, or the packets before it, may have been lost */
+			csp_credit_send_cmp(conn, CREDIT_PROBE);
+		}
+	}
+
+	conn->credit.sent++;
+	csp_credit_header_add(conn, packet, CREDIT_DATA);
+
+	return CSP_ERR_NONE;
+}
+
+bool csp_credit_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
+
+	if (packet->length < sizeof(credit_header_t)) {
+		csp_buffer_free(packet);
+		return false;
+	}
+
+	credit_header_t header;
+	packet->length -= sizeof(header);
+	memcpy(&header, &packet->data[packet->length], sizeof(header));
+
+	/* Grants are cumulative, so a lost or reordered grant is covered by the next */
+	uint16_t limit = be16toh(header.limit);
+	if ((int16_t)(limit - conn->credit.limit) > 0) {
+		__atomic_store_n(&conn->credit.limit, limit, __ATOMIC_RELEASE);
+		csp_bin_sem_post(&conn->credit.wait);
+	}
+
+	/**
+	 * Data and probes tell how many packets the peer has sent. Packets missing up to there were lost, this is
+	 * what returns their credits. A probe is only sent after waiting, when nothing earlier is still underway.
+	 */
+	if (header.flags & (CREDIT_DATA | CREDIT_PROBE)) {
+		uint16_t seq = be16toh(header.seq);
+		if ((int16_t)(seq - conn->credit.seen) > 0) {
+			__atomic_store_n(&conn->credit.seen, seq, __ATOMIC_RELEASE);
+		}
+	}
+
+	if (header.flags & CREDIT_PROBE) {
+		csp_credit_send_cmp(conn, 0);
+	}
+
+	if (header.flags & CREDIT_DATA) {
+		/* Counted before it is queued, so a read never finds the count behind */
+		__atomic_add_fetch(&conn->credit.queued, 1, __ATOMIC_ACQ_REL);
+		return true;
+	}
+
+	csp_buffer_free(packet);
+	return false;
+}
+
+void csp_credit_dropped(csp_conn_t * conn) {
+	/* The packet took no space, its credit returns with the next grant */
+	__atomic_sub_fetch(&conn->credit.queued, 1, __ATOMIC_ACQ_REL);
+}
+
+bool csp_credit_has_data(const csp_packet_t * packet) {
+
+	if (packet->length < sizeof(credit_header_t)) {
+		return false;
+	}
+
+	credit_header_t header;
+	memcpy(&header, &packet->data[packet->length - sizeof(header)], sizeof(header));
+
+	return (header.flags & CREDIT_DATA) != 0;
+}
+
+bool csp_credit_strip(csp_packet_t * packet) {
+
+	if (!csp_credit_has_data(packet)) {
+		csp_buffer_free(packet);
+		return false;
+	}
+
+	packet->length -= sizeof(credit_header_t);
+	return true;
+}
+
+void csp_credit_consumed(csp_conn_t * conn) {
+
+	__atomic_sub_fetch(&conn->credit.queued, 1, __ATOMIC_ACQ_REL);
+
+	if ((uint16_t)(csp_credit_limit(conn) - conn->credit.granted) >= CSP_CREDIT_GRANT_BATCH) {
+		csp_credit_send_cmp(conn, 0);
+	}
+}
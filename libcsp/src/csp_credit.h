@@ -0,0 +1,68 @@
+#pragma once
+
+/**
+ * Credit flow control, for connections without RDP.
+ *
+ * Every packet on a credit connection (#CSP_FCREDIT) carries a small trailer, like the RDP header, with the number of
+ * data packets sent so far, and the number of data packets the peer may send in total. The receiver grants what it
+ * has seen of the sender, plus the free space in its receive queue, so the queue never overflows. Packets lost on
+ * the link, or dropped by the receiver, took no space and return their credits with the next grant.
+ */
+
+#include <csp/csp_types.h>
+
+/** Send a grant when the application has read this many packets since the last one */
+#ifndef CSP_CREDIT_GRANT_BATCH
+#define CSP_CREDIT_GRANT_BATCH (CSP_CONN_RXQUEUE_LEN / 2)
+#endif
+
+/** Ask the peer for a new grant when waiting for credits this long, in case the last grant was lost */
+#ifndef CSP_CREDIT_PROBE_INTERVAL
+#define CSP_CREDIT_PROBE_INTERVAL 1000
+#endif
+
+/** Max time csp_send() waits for credits, before dropping the packet */
+#ifndef CSP_CREDIT_SEND_TIMEOUT
+#define CSP_CREDIT_SEND_TIMEOUT 10000
+#endif
+
+/**
+ * Reset credit state of a new connection
+ */
+void csp_credit_init(csp_conn_t * conn);
+
+/**
+ * Wait for a credit, and add the credit trailer to the packet
+ * @param timeout time in mS to wait for a credit, 0 to return at once
+ * @return #CSP_ERR_NONE on success, #CSP_ERR_AGAIN or #CSP_ERR_TIMEDOUT without credits, #CSP_ERR_NOMEM if
+ * there is no room for the trailer. On error the packet is unchanged.
+ */
+int csp_credit_send(csp_conn_t * conn, csp_packet_t * packet, uint32_t timeout);
+
+/**
+ * Handle the credit trailer of an incoming packet, called by the router
+ * @return true if the packet carries data and must be queued, otherwise it has been consumed
+ */
+bool csp_credit_new_packet(csp_conn_t * conn, csp_packet_t * packet);
+
+/**
+ * Return the credit of a data packet accepted by csp_credit_new_packet(), which could not be queued
+ */
+void csp_credit_dropped(csp_conn_t * conn);
+
+/**
+ * Check if an incoming credit packet carries data, without changing it. Grants and probes do not.
+ * The router uses this to avoid creating a connection for a grant or probe to a closed connection.
+ */
+bool csp_credit_has_data(const csp_packet_t * packet);
+
+/**
+ * Strip the credit trailer of a packet delivered without a connection (#CSP_SO_CONN_LESS)
+ * @return true if the packet carries data, otherwise it has been freed
+ */
+bool csp_credit_strip(csp_packet_t * packet);
+
+/**
+ * Count a packet read by the application, and grant new credits to the peer
+ */
+void csp_credit_consumed(csp_conn_t * conn);
@@ -2,45 +2,125 @@
 
 #include "csp_dedup.h"
 
-#include <stdlib.h>
+#include <string.h>
 
+#include <csp/csp_dedup.h>
 #include <csp/arch/csp_time.h>
-#include <csp/csp_crc32.h>
-#include <csp/csp_id.h>
 
-/* Check the last CSP_DEDUP_COUNT packets for duplicates */
-#define CSP_DEDUP_COUNT 16
+/* Entries checked from the home slot of a hash, also the most entries a packet can move away from it */
+#define CSP_DEDUP_PROBE 16
 
-/* Only consider packet a duplicate if received under CSP_DEDUP_WINDOW_MS ago */
-#define CSP_DEDUP_WINDOW_MS 100
+#if (CSP_DEDUP_SIZE & (CSP_DEDUP_SIZE - 1))
+#error "CSP_DEDUP_SIZE must be a power of two"
+#endif
 
-/* Store packet CRC's in a ringbuffer */
-static uint32_t csp_dedup_array[CSP_DEDUP_COUNT] = {};
-static uint32_t csp_dedup_timestamp[CSP_DEDUP_COUNT] = {};
-static int csp_dedup_in = 0;
+static csp_dedup_entry_t csp_dedup_default[CSP_DEDUP_SIZE];
+static csp_dedup_entry_t * csp_dedup_table = csp_dedup_default;
+static uint32_t csp_dedup_mask = CSP_DEDUP_SIZE - 1;
+static uint32_t csp_dedup_window = CSP_DEDUP_WINDOW_MS;
+
+/* Mix one 64-bit word into the hash (murmur3 style) */
+static inline uint64_t csp_dedup_mix(uint64_t h, uint64_t v) {
+
+	v *= 0x87C37B91114253D5ULL;
+	v = (v << 31) | (v >> 33);
+	v *= 0x4CF5AD432745937FULL;
+	h ^= v;
+	h = (h << 27) | (h >> 37);
+	return h * 5 + 0x52DCE729;
+}
+
+/* Hash over the unpacked header and the data, a word at a time */
+static uint32_t csp_dedup_hash(const csp_packet_t * packet) {
+
+	uint64_t h = ((uint64_t)packet->id.src << 48) | ((uint64_t)packet->id.dst << 32) |
+				 ((uint64_t)packet->id.dport << 24) | ((uint64_t)packet->id.sport << 16) |
+				 ((uint64_t)packet->id.pri << 8) | packet->id.flags;
+	h = csp_dedup_mix(packet->length, h);
+
+	const uint8_t * data = packet->data;
+	unsigned int len = packet->length;
+
+	for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t), data += sizeof(uint64_t)) {
+		uint64_t v;
+		memcpy(&v, data, sizeof(v));
+		h = csp_dedup_mix(h, v);
+	}
+
+	if (len > 0) {
+		uint64_t v = 0;
+		memcpy(&v, data, len);
+		h = csp_dedup_mix(h, v);
+	}
+
+	/* Final avalanche */
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+
+	return (uint32_t)h;
+}
 
 bool csp_dedup_is_duplicate(csp_packet_t * packet) {
-	/* Calculate CRC32 for packet */
-	csp_id_prepend(packet);
-	uint32_t crc = csp_crc32_memory(packet->frame_begin, packet->frame_length);
 
-	/* Check if we have received this packet before */
-	for (int i = 0; i < CSP_DEDUP_COUNT; i++) {
+	const uint32_t now = csp_get_ms();
+	const uint32_t window = __atomic_load_n(&csp_dedup_window, __ATOMIC_RELAXED);
+
+	/* 0 marks a free entry */
+	const uint32_t hash = csp_dedup_hash(packet) | 1;
+
+	/* Expired entries are free, so there are no deletions. Insert into a free entry, or replace the oldest */
+	csp_dedup_entry_t * victim = NULL;
+	uint32_t victim_age = 0;
 
-		/* Check for match */
-		if (crc == csp_dedup_array[i]) {
+	for (uint32_t i = 0; (i < CSP_DEDUP_PROBE) && (i <= csp_dedup_mask); i++) {
 
-			/* Check the timestamp */
-			if (csp_get_ms() < csp_dedup_timestamp[i] + CSP_DEDUP_WINDOW_MS) {
-				return true;
-			}
+		csp_dedup_entry_t * entry = &csp_dedup_table[(hash + i) & csp_dedup_mask];
+		uint32_t age = now - entry->timestamp;
+
+		if ((entry->hash == 0) || (age >= window)) {
+			age = UINT32_MAX;
+		} else if (entry->hash == hash) {
+			return true;
+		}
+
+		if ((victim == NULL) || (age > victim_age)) {
+			victim = entry;
+			victim_age = age;
 		}
 	}
 
-	/* If not, insert packet into duplicate list */
-	csp_dedup_array[csp_dedup_in] = crc;
-	csp_dedup_timestamp[csp_dedup_in] = csp_get_ms();
-	csp_dedup_in = (csp_dedup_in + 1) % CSP_DEDUP_COUNT;
+	victim->hash = hash;
+	victim->timestamp = now;
 
 	return false;
 }
+
+int csp_dedup_set_storage(void * storage, size_t size) {
+
+	size_t entries = size / sizeof(csp_dedup_entry_t);
+	if ((storage == NULL) || (entries == 0)) {
+		return CSP_ERR_INVAL;
+	}
+
+	/* Round down to a power of two */
+	while (entries & (entries - 1)) {
+		entries &= entries - 1;
+	}
+
+	memset(storage, 0, entries * sizeof(csp_dedup_entry_t));
+	csp_dedup_table = storage;
+	csp_dedup_mask = entries - 1;
+
+	return CSP_ERR_NONE;
+}
+
+void csp_dedup_set_window(uint32_t window_ms) {
+	__atomic_store_n(&csp_dedup_window, window_ms, __ATOMIC_RELAXED);
+}
+
+uint32_t csp_dedup_get_window(void) {
+	return __atomic_load_n(&csp_dedup_window, __ATOMIC_RELAXED);
+}
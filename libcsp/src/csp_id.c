@@ -39,6 +39,17 @@
 
 #define CSP_ID1_HEADER_SIZE 4
 
+/**
+ * CSP 1.x uses 0x04 for XTEA, so SipHash goes in the reserved bit 0x40 on this header. The two bits are swapped both
+ * ways: a 1.x packet with XTEA set is then passed on untouched as #CSP_FRES2, like before SipHash existed.
+ */
+#define CSP_ID1_FXTEA 0x04
+
+static inline uint8_t csp_id1_swap_flags(uint8_t flags) {
+	uint8_t swap = ((flags & CSP_ID1_FXTEA) != 0) ^ ((flags & CSP_FRES2) != 0);
+	return swap ? (flags ^ (CSP_ID1_FXTEA | CSP_FRES2)) : flags;
+}
+
 void csp_id1_prepend(csp_packet_t * packet) {
 
 	/* Pack into 32-bit using host endian */
@@ -47,7 +58,7 @@ void csp_id1_prepend(csp_packet_t * packet) {
 					(packet->id.src << CSP_ID1_SRC_OFFSET) |
 					(packet->id.dport << CSP_ID1_DPORT_OFFSET) |
 					(packet->id.sport << CSP_ID1_SPORT_OFFSET) |
-					(packet->id.flags << CSP_ID1_FLAGS_OFFSET));
+					(csp_id1_swap_flags(packet->id.flags) << CSP_ID1_FLAGS_OFFSET));
 
 	/* Convert to big / network endian */
 	id1 = htobe32(id1);
@@ -79,7 +90,7 @@ int csp_id1_strip(csp_packet_t * packet) {
 	packet->id.src = (id1 >> CSP_ID1_SRC_OFFSET) & CSP_ID1_SRC_MASK;
 	packet->id.dport = (id1 >> CSP_ID1_DPORT_OFFSET) & CSP_ID1_DPORT_MASK;
 	packet->id.sport = (id1 >> CSP_ID1_SPORT_OFFSET) & CSP_ID1_SPORT_MASK;
-	packet->id.flags = (id1 >> CSP_ID1_FLAGS_OFFSET) & CSP_ID1_FLAGS_MASK;
+	packet->id.flags = csp_id1_swap_flags((id1 >> CSP_ID1_FLAGS_OFFSET) & CSP_ID1_FLAGS_MASK);
 
 	return 0;
 }
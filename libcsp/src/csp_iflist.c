@@ -1,27 +1,262 @@
 
 
-#include <csp/csp_iflist.h>
+#include "csp_iflist.h"
 #include <csp/csp_id.h>
 
 #include <string.h>
 
 #include <csp_autoconfig.h>
+#include <csp/csp.h>
 #include <csp/csp_debug.h>
 
+#include "csp_semaphore.h"
+
 /* Interfaces are stored in a linked list */
 static csp_iface_t * interfaces = NULL;
 
+/* And in an array, in the order they were added. Entries are only appended. */
+static csp_iface_t * iflist[CSP_IFLIST_MAX];
+static unsigned int iflist_count = 0;
+
+/* Interfaces sharing a subnet, sorted by mask and network */
+typedef struct {
+	uint16_t mask;
+	uint16_t network;
+	uint32_t map;
+} csp_iflist_subnet_t;
+
+/* Distinct masks, each covering a range of the subnets */
+typedef struct {
+	uint16_t mask;
+	uint8_t first;
+	uint8_t count;
+} csp_iflist_mask_t;
+
+/**
+ * Subnet index, built from the interface addresses and netmasks by csp_iflist_update().
+ * There are two copies. Lookups use the active copy without locking, the index is rebuilt in the other copy,
+ * which is then published with a single atomic pointer store. Like the routing table, the previously active copy
+ * is only reused once its last reader has left.
+ */
+typedef struct {
+	csp_iflist_entry_t entries[CSP_IFLIST_MAX];  // Same order as iflist[]
+	unsigned int entry_count;
+	csp_iflist_subnet_t subnets[CSP_IFLIST_MAX];
+	csp_iflist_mask_t masks[CSP_IFLIST_MAX];
+	unsigned int mask_count;
+	unsigned int readers;         // Lookups running on this copy
+	bool draining;                // A writer waits for readers to leave
+} csp_iflist_index_t;
+
+static csp_iflist_index_t iflist_index[2];
+static csp_iflist_index_t * iflist_active = &iflist_index[0];
+
+/* Posted by the last reader to leave a draining copy */
+static csp_bin_sem_t iflist_drained;
+
+_Static_assert(CSP_IFLIST_MAX <= 32, "CSP_IFLIST_MAX must fit the interface bitmap");
+
+static void csp_iflist_entry_setup(csp_iflist_entry_t * entry, const csp_iface_t * ifc) {
+
+	unsigned int host_bits = csp_id_get_host_bits();
+	unsigned int netmask = ifc->netmask;
+	if (netmask > host_bits) {
+		netmask = host_bits;
+	}
+
+	entry->mask = ((1 << netmask) - 1) << (host_bits - netmask);
+	entry->network = ifc->addr & entry->mask;
+	entry->hostmask = (1 << (host_bits - netmask)) - 1;
+}
+
+static void csp_iflist_read_unlock(csp_iflist_index_t * index) {
+
+	/* Sequentially consistent, pairs with the draining flag in csp_iflist_drain() */
+	if ((__atomic_sub_fetch(&index->readers, 1, __ATOMIC_SEQ_CST) == 0) &&
+		__atomic_load_n(&index->draining, __ATOMIC_SEQ_CST)) {
+		csp_bin_sem_post(&iflist_drained);
+	}
+}
+
+static csp_iflist_index_t * csp_iflist_read_lock(void) {
+
+	for (;;) {
+		csp_iflist_index_t * index = __atomic_load_n(&iflist_active, __ATOMIC_SEQ_CST);
+		__atomic_fetch_add(&index->readers, 1, __ATOMIC_SEQ_CST);
+		/* The index may have been taken for rebuilding, before we registered */
+		if (__atomic_load_n(&iflist_active, __ATOMIC_SEQ_CST) == index) {
+			return index;
+		}
+		csp_iflist_read_unlock(index);
+	}
+}
+
+/* Wait for lookups still running on a copy that is no longer active */
+static void csp_iflist_drain(csp_iflist_index_t * index) {
+
+	__atomic_store_n(&index->draining, true, __ATOMIC_SEQ_CST);
+
+	/* A post left over from an earlier drain only causes one more check */
+	while (__atomic_load_n(&index->readers, __ATOMIC_SEQ_CST) > 0) {
+		csp_bin_sem_wait(&iflist_drained, CSP_MAX_TIMEOUT);
+	}
+
+	__atomic_store_n(&index->draining, false, __ATOMIC_SEQ_CST);
+}
+
+static void csp_iflist_build(csp_iflist_index_t * index) {
+
+	unsigned int subnet_count = 0;
+	csp_iflist_subnet_t * subnets = index->subnets;
+	csp_iflist_mask_t * masks = index->masks;
+
+	index->entry_count = iflist_count;
+
+	for (unsigned int i = 0; i < iflist_count; i++) {
+
+		csp_iflist_entry_t * entry = &index->entries[i];
+		csp_iflist_entry_setup(entry, iflist[i]);
+
+		/* Reject searches involving subnets, if the netmask is invalid */
+		if (iflist[i]->netmask == 0) {
+			continue;
+		}
+
+		unsigned int s;
+		for (s = 0; s < subnet_count; s++) {
+			if ((subnets[s].mask == entry->mask) && (subnets[s].network == entry->network)) {
+				break;
+			}
+		}
+
+		if (s == subnet_count) {
+			subnets[s].mask = entry->mask;
+			subnets[s].network = entry->network;
+			subnets[s].map = 0;
+			subnet_count++;
+		}
+		subnets[s].map |= (1UL << i);
+	}
+
+	/* Insertion sort, there are only a handful of subnets */
+	for (unsigned int s = 1; s < subnet_count; s++) {
+		csp_iflist_subnet_t key = subnets[s];
+		unsigned int j = s;
+		while ((j > 0) && ((subnets[j - 1].mask < key.mask) ||
+						   ((subnets[j - 1].mask == key.mask) && (subnets[j - 1].network > key.network)))) {
+			subnets[j] = subnets[j - 1];
+			j--;
+		}
+		subnets[j] = key;
+	}
+
+	index->mask_count = 0;
+	for (unsigned int s = 0; s < subnet_count; s++) {
+		if ((index->mask_count == 0) || (masks[index->mask_count - 1].mask != subnets[s].mask)) {
+			masks[index->mask_count].mask = subnets[s].mask;
+			masks[index->mask_count].first = s;
+			masks[index->mask_count].count = 0;
+			index->mask_count++;
+		}
+		masks[index->mask_count - 1].count++;
+	}
+}
+
+void csp_iflist_init(void) {
+	csp_bin_sem_init(&iflist_drained);
+	csp_bin_sem_wait(&iflist_drained, 0);
+}
+
+void csp_iflist_update(void) {
+
+	csp_iflist_index_t * active = iflist_active;
+	csp_iflist_index_t * shadow = (active == &iflist_index[0]) ? &iflist_index[1] : &iflist_index[0];
+
+	/* Readers of the previous change may still be on the copy we are about to overwrite */
+	csp_iflist_drain(shadow);
+	csp_iflist_build(shadow);
+
+	/* Publish, lookups starting after this see the new index */
+	__atomic_store_n(&iflist_active, shadow, __ATOMIC_SEQ_CST);
+}
+
+/* Position of an added interface, or -1 */
+static int csp_iflist_position(const csp_iface_t * ifc, const csp_iflist_index_t * index) {
+
+	unsigned int pos = ifc->iflist_pos;
+	if ((pos < index->entry_count) && (iflist[pos] == ifc)) {
+		return pos;
+	}
+	return -1;
+}
+
+static uint32_t csp_iflist_index_map(const csp_iflist_index_t * index, uint16_t addr) {
+
+	uint32_t map = 0;
+	const csp_iflist_subnet_t * subnets = index->subnets;
+
+	for (unsigned int m = 0; m < index->mask_count; m++) {
+
+		const csp_iflist_mask_t * mask = &index->masks[m];
+		uint16_t network = addr & mask->mask;
+		int low = mask->first;
+		int high = mask->first + mask->count - 1;
+
+		while (low <= high) {
+			int mid = (low + high) / 2;
+			if (subnets[mid].network == network) {
+				map |= subnets[mid].map;
+				break;
+			}
+			if (subnets[mid].network < network) {
+				low = mid + 1;
+			} else {
+				high = mid - 1;
+			}
+		}
+	}
+
+	return map;
+}
+
+uint32_t csp_iflist_subnet_map(uint16_t addr) {
+
+	csp_iflist_index_t * index = csp_iflist_read_lock();
+	uint32_t map = csp_iflist_index_map(index, addr);
+	csp_iflist_read_unlock(index);
+
+	return map;
+}
+
+csp_iface_t * csp_iflist_at(unsigned int idx) {
+
+	if (idx >= __atomic_load_n(&iflist_count, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+
+	return iflist[idx];
+}
+
 int csp_iflist_is_within_subnet(uint16_t addr, csp_iface_t * ifc) {
 
 	if (ifc == NULL) {
 		return 0;
 	}
-	
-	uint16_t netmask = ((1 << ifc->netmask) - 1) << (csp_id_get_host_bits() - ifc->netmask);
-	uint16_t network_a = ifc->addr & netmask;
-	uint16_t network_b = addr & netmask;
 
-	if (network_a == network_b) {
+	csp_iflist_entry_t entry;
+	csp_iflist_index_t * index = csp_iflist_read_lock();
+	int pos = csp_iflist_position(ifc, index);
+	if (pos >= 0) {
+		entry = index->entries[pos];
+	}
+	csp_iflist_read_unlock(index);
+
+	/* Interfaces which are not indexed have no precomputed masks */
+	if (pos < 0) {
+		csp_iflist_entry_setup(&entry, ifc);
+	}
+
+	if ((addr & entry.mask) == entry.network) {
 		return 1;
 	} else {
 		return 0;
@@ -29,44 +264,53 @@ int csp_iflist_is_within_subnet(uint16_t addr, csp_iface_t * ifc) {
 
 }
 
-csp_iface_t * csp_iflist_get_by_subnet(uint16_t addr, csp_iface_t * ifc) {
+int csp_iflist_is_broadcast(uint16_t addr, const csp_iface_t * ifc) {
 
-	/* Head of list */
-	if (ifc == NULL) {
-		ifc = interfaces;
+	csp_iflist_index_t * index = csp_iflist_read_lock();
+	int pos = csp_iflist_position(ifc, index);
+	uint16_t hostmask = (pos >= 0) ? index->entries[pos].hostmask : 0;
+	csp_iflist_read_unlock(index);
 
-	/* Otherwise, continue from user defined ifc */
-	} else {
-		ifc = ifc->next;
+	if (pos < 0) {
+		return csp_id_is_broadcast(addr, ifc->netmask);
 	}
 
-	while (ifc) {
+	if ((addr & hostmask) == hostmask) {
+		return 1;
+	}
+	return 0;
+}
 
-		/* Reject searches involving subnets, if the netmask is invalud */
-		if (ifc->netmask == 0) {
-			ifc = ifc->next;
-			continue;
-		}
+csp_iface_t * csp_iflist_get_by_subnet(uint16_t addr, csp_iface_t * ifc) {
 
-		if (csp_iflist_is_within_subnet(addr, ifc)) {
-			return ifc;
+	csp_iflist_index_t * index = csp_iflist_read_lock();
+	uint32_t map = csp_iflist_index_map(index, addr);
+
+	/* Continue after user defined ifc */
+	if (ifc != NULL) {
+		int pos = csp_iflist_position(ifc, index);
+		if (pos >= 0) {
+			unsigned int next = pos + 1;
+			map = (next < 32) ? (map & ~((1UL << next) - 1)) : 0;
 		}
+	}
+	csp_iflist_read_unlock(index);
 
-		ifc = ifc->next;
+	if (map == 0) {
+		return NULL;
 	}
 
-	return NULL;
+	return iflist[__builtin_ctz(map)];
 
 }
 
 csp_iface_t * csp_iflist_get_by_addr(uint16_t addr) {
 
-	csp_iface_t * ifc = interfaces;
-	while (ifc) {
-		if (ifc->addr == addr) {
-			return ifc;
+	unsigned int count = __atomic_load_n(&iflist_count, __ATOMIC_ACQUIRE);
+	for (unsigned int i = 0; i < count; i++) {
+		if (iflist[i]->addr == addr) {
+			return iflist[i];
 		}
-		ifc = ifc->next;
 	}
 
 	return NULL;
@@ -74,37 +318,46 @@ csp_iface_t * csp_iflist_get_by_addr(uint16_t addr) {
 }
 
 csp_iface_t * csp_iflist_get_by_name(const char * name) {
-	csp_iface_t * ifc = interfaces;
-	while (ifc) {
-		if (strncmp(ifc->name, name, CSP_IFLIST_NAME_MAX) == 0) {
-			return ifc;
+	unsigned int count = __atomic_load_n(&iflist_count, __ATOMIC_ACQUIRE);
+	for (unsigned int i = 0; i < count; i++) {
+		if (strncmp(iflist[i]->name, name, CSP_IFLIST_NAME_MAX) == 0) {
+			return iflist[i];
 		}
-		ifc = ifc->next;
 	}
 	return NULL;
 }
 
 int csp_iflist_add(csp_iface_t * ifc) {
 
+	/* Insert interface last if not already in pool */
+	csp_iface_t * last = NULL;
+	for (csp_iface_t * i = interfaces; i != NULL; i = i->next) {
+		if ((i == ifc) || (strncmp(ifc->name, i->name, CSP_IFLIST_NAME_MAX) == 0)) {
+			return CSP_ERR_ALREADY;
+		}
+		last = i;
+	}
+
+	if (iflist_count >= CSP_IFLIST_MAX) {
+		return CSP_ERR_NOMEM;
+	}
+
 	ifc->next = NULL;
+	ifc->iflist_pos = iflist_count;
+	iflist[iflist_count] = ifc;
+	/* Lookups by name or address see the interface once it is complete */
+	__atomic_store_n(&iflist_count, iflist_count + 1, __ATOMIC_RELEASE);
 
 	/* Add interface to pool */
-	if (interfaces == NULL) {
+	if (last == NULL) {
 		/* This is the first interface to be added */
 		interfaces = ifc;
 	} else {
-		/* Insert interface last if not already in pool */
-		csp_iface_t * last = NULL;
-		for (csp_iface_t * i = interfaces; i != NULL; i = i->next) {
-			if ((i == ifc) || (strncmp(ifc->name, i->name, CSP_IFLIST_NAME_MAX) == 0)) {
-				return CSP_ERR_ALREADY;
-			}
-			last = i;
-		}
-
 		last->next = ifc;
 	}
 
+	csp_iflist_update();
+
 	return CSP_ERR_NONE;
 }
 
@@ -141,10 +394,10 @@ void csp_iflist_print(void) {
 		rx = csp_bytesize(i->rxbytes, &rx_postfix);
 		csp_print("%-10s addr: %"PRIu16" netmask: %"PRIu16" mtu: %"PRIu16"\r\n"
 				  "           tx: %05" PRIu32 " rx: %05" PRIu32 " txe: %05" PRIu32 " rxe: %05" PRIu32 "\r\n"
-				  "           drop: %05" PRIu32 " autherr: %05" PRIu32 " frame: %05" PRIu32 "\r\n"
+				  "           drop: %05" PRIu32 " dup: %05" PRIu32 " autherr: %05" PRIu32 " frame: %05" PRIu32 "\r\n"
 				  "           txb: %" PRIu32 " (%" PRIu32 "%c) rxb: %" PRIu32 " (%" PRIu32 "%c) \r\n\r\n",
 				  i->name, i->addr, i->netmask, i->mtu, i->tx, i->rx, i->tx_error, i->rx_error, i->drop,
-				  i->autherr, i->frame, i->txbytes, tx, tx_postfix, i->rxbytes, rx, rx_postfix);
+				  i->dup, i->autherr, i->frame, i->txbytes, tx, tx_postfix, i->rxbytes, rx, rx_postfix);
 		i = i->next;
 	}
 }
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <csp/csp_iflist.h>
+
+/**
+ * Precomputed subnet of a registered interface.
+ * Rebuilt by csp_iflist_update(), from the interface address and netmask.
+ */
+typedef struct csp_iflist_entry_s {
+	uint16_t mask;      //! Network part of the address
+	uint16_t network;   //! Interface address & mask
+	uint16_t hostmask;  //! Host part of the address, all ones is the broadcast address
+} csp_iflist_entry_t;
+
+/**
+ * Initialize the subnet index, called by csp_init() before any interface is added
+ */
+void csp_iflist_init(void);
+
+/**
+ * Find the interfaces having addr on their subnet.
+ * Interfaces with netmask 0 never match.
+ * @param addr destination address
+ * @return bitmap of interface positions, lowest bit is the first interface added, see csp_iflist_at()
+ */
+uint32_t csp_iflist_subnet_map(uint16_t addr);
+
+/**
+ * Get interface by position
+ * @param idx position in the order of csp_iflist_add()
+ * @return interface, or NULL if idx is out of range
+ */
+csp_iface_t * csp_iflist_at(unsigned int idx);
+
+/**
+ * Check if addr is the broadcast address on the subnet of an interface
+ * @return 1 if broadcast, otherwise 0
+ */
+int csp_iflist_is_broadcast(uint16_t addr, const csp_iface_t * ifc);
@@ -3,11 +3,15 @@
 #include <csp/interfaces/csp_if_lo.h>
 #include <csp/arch/csp_time.h>
 #include <csp/csp_id.h>
+#include <csp/crypto/csp_hmac.h>
 #include <csp_autoconfig.h>
 #include "csp_conn.h"
+#include "csp_conn_pool.h"
+#include "csp_iflist.h"
+#include "csp_offload.h"
 #include "csp_qfifo.h"
 #include "csp_port.h"
-#include "csp_rdp_queue.h"
+#include "csp_rtable_cidr.h"
 
 csp_conf_t csp_conf = {
 	.version = 2,
@@ -16,7 +20,12 @@ csp_conf_t csp_conf = {
 	.model = "",
 	.revision = "",
 	.conn_dfl_so = CSP_O_NONE,
-	.dedup = CSP_DEDUP_OFF};
+	.dedup = CSP_DEDUP_OFF,
+	.fast_ping = 0,
+	.conn_max = 0,
+	.conn_storage = NULL,
+	.keepalive_idle = 5000,
+	.offload_threshold = 0};
 
 uint16_t csp_get_address(void) {
 	return csp_conf.address;
@@ -26,10 +35,12 @@ void csp_init(void) {
 
 	csp_buffer_init();
 	csp_conn_init();
+	csp_conn_pool_init();
 	csp_qfifo_init();
-#if (CSP_USE_RDP)
-	csp_rdp_queue_init();
-#endif
+	csp_offload_init();
+	csp_rtable_init();
+	csp_hmac_key_init();
+	csp_iflist_init();
 
 	/* Loopback */
 	csp_if_lo.netmask = csp_id_get_host_bits();
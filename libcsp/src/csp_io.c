@@ -14,12 +14,19 @@
 #include <csp/arch/csp_queue.h>
 #include <csp/arch/csp_time.h>
 #include <csp/crypto/csp_hmac.h>
+#include <csp/crypto/csp_siphash.h>
 
 #include "csp_port.h"
 #include "csp_conn.h"
+#include "csp_credit.h"
+#include "csp_conn_pool.h"
 #include "csp_promisc.h"
 #include "csp_qfifo.h"
+#include "csp_qos.h"
 #include "csp_rdp.h"
+#include "csp_iflist.h"
+#include "csp_offload.h"
+#include "csp_rtable_cidr.h"
 
 /* inclusion for DAMAT */
 #include "FAQAS_dataDrivenMutator.h"
@@ -43,7 +50,8 @@ csp_conn_t * csp_accept(csp_socket_t * sock, uint32_t timeout) {
 	return NULL;
 }
 
-csp_packet_t * csp_read(csp_conn_t * conn, uint32_t timeout) {
+/* Shared by csp_read() and csp_read_exact(), rdp_timeout stretches the timeout to the RDP connection timeout */
+static csp_packet_t * csp_read_timeout(csp_conn_t * conn, uint32_t timeout, bool rdp_timeout) {
 
 	/* mutation probe */
 
@@ -78,7 +86,7 @@ csp_packet_t * csp_read(csp_conn_t * conn, uint32_t timeout) {
 
 #if (CSP_USE_RDP)
 	// RDP: timeout can either be 0 (for no hang poll/check) or minimum the "connection timeout"
-	if (timeout && (conn->idin.flags & CSP_FRDP) && (timeout < conn->rdp.conn_timeout)) {
+	if (rdp_timeout && timeout && (conn->idin.flags & CSP_FRDP) && (timeout < conn->rdp.conn_timeout)) {
 		timeout = conn->rdp.conn_timeout;
 	}
 #endif
@@ -87,6 +95,11 @@ csp_packet_t * csp_read(csp_conn_t * conn, uint32_t timeout) {
 		return NULL;
 	}
 
+	/* Packet read frees a place in the queue for the peer */
+	if (conn->idin.flags & CSP_FCREDIT) {
+		csp_credit_consumed(conn);
+	}
+
 #if (CSP_USE_RDP)
 	/* Packet read could trigger ACK transmission */
 	if ((conn->idin.flags & CSP_FRDP) && conn->rdp.delayed_acks) {
@@ -97,6 +110,14 @@ csp_packet_t * csp_read(csp_conn_t * conn, uint32_t timeout) {
 	return packet;
 }
 
+csp_packet_t * csp_read(csp_conn_t * conn, uint32_t timeout) {
+	return csp_read_timeout(conn, timeout, true);
+}
+
+csp_packet_t * csp_read_exact(csp_conn_t * conn, uint32_t timeout) {
+	return csp_read_timeout(conn, timeout, false);
+}
+
 /* Provide a safe method to copy type safe, between two csp ids */
 void csp_id_copy(csp_id_t * target, csp_id_t * source) {
 	target->pri = source->pri;
@@ -117,7 +138,11 @@ void csp_send_direct(csp_id_t idout, csp_packet_t * packet, csp_iface_t * routed
 	csp_packet_t * copy = NULL;
 	int local_found = 0;
 
-	while ((iface = csp_iflist_get_by_subnet(idout.dst, iface)) != NULL) {
+	uint32_t local = csp_iflist_subnet_map(idout.dst);
+	while (local != 0) {
+
+		iface = csp_iflist_at(__builtin_ctz(local));
+		local &= local - 1;
 
 		/* Do not send back to same inteface (split horizon)
 		 * This check is is similar to that below, but faster */
@@ -136,22 +161,26 @@ void csp_send_direct(csp_id_t idout, csp_packet_t * packet, csp_iface_t * routed
 		/* Todo: Find an elegant way to avoid making a copy when only a single destination interface
 		 * is found. But without looping the list twice. And without using stack memory.
 		 * Is this even possible? */
+		local_found = 1;
 		copy = csp_buffer_clone(packet);
+		if (copy == NULL) {
+			/* Out of buffers, the route table leads to the same subnet */
+			iface->drop++;
+			continue;
+		}
 		csp_send_direct_iface(idout, copy, iface, via, from_me);
-
-		local_found = 1;
 	}
 
-	/* If the above worked, we don't want to look at the routing table */
+	/* The destination is local, also if a copy was dropped, so skip the routing table */
 	if (local_found == 1) {
 		csp_buffer_free(packet);
 		return;
 	}
 
 	/* Try to send via routing table */
-	csp_route_t * route = csp_rtable_find_route(idout.dst);
-	if (route != NULL) {
-		csp_send_direct_iface(idout, packet, route->iface, route->via, from_me);
+	csp_route_t route;
+	if (csp_rtable_route_packet(idout.dst, 1, packet->length, &route)) {
+		csp_send_direct_iface(idout, packet, route.iface, route.via, from_me);
 		return;
 	}
 
@@ -164,7 +193,8 @@ __attribute__((weak)) void csp_output_hook(csp_id_t idout, csp_packet_t * packet
 	return;
 }
 
-void csp_send_direct_iface(csp_id_t idout, csp_packet_t * packet, csp_iface_t * iface, uint16_t via, int from_me) {
+/* Output hook and header, done once per packet by the sending task */
+static void csp_send_prepare_id(csp_id_t idout, csp_packet_t * packet, csp_iface_t * iface, uint16_t via, int from_me) {
 
 	csp_output_hook(idout, packet, iface, via, from_me);
 
@@ -177,41 +207,80 @@ void csp_send_direct_iface(csp_id_t idout, csp_packet_t * packet, csp_iface_t *
 		csp_promisc_add(packet);
 	}
 #endif
+}
+
+/* HMAC, CRC32 and MTU check, done once per packet before it is handed to the interface */
+static int csp_send_prepare_check(csp_packet_t * packet, csp_iface_t * iface, int from_me) {
 
 	/* Only encrypt packets from the current node */
 	if (from_me) {
 
+		/* Append SipHash */
+		if (packet->id.flags & CSP_FSIPHASH) {
+#if (CSP_USE_HMAC)
+			/* Calculate and add SipHash (includes the id, there is no csp1.x format to be compatible with) */
+			if (csp_siphash_append(packet) != CSP_ERR_NONE) {
+				/* SipHash append failed */
+				return CSP_ERR_TX;
+			}
+#else
+			csp_dbg_errno = CSP_DBG_ERR_UNSUPPORTED;
+			return CSP_ERR_NOTSUP;
+#endif
+
 		/* Append HMAC */
-		if (idout.flags & CSP_FHMAC) {
+		} else if (packet->id.flags & CSP_FHMAC) {
 #if (CSP_USE_HMAC)
 			/* Calculate and add HMAC (does not include header for backwards compatability with csp1.x) */
 			if (csp_hmac_append(packet, false) != CSP_ERR_NONE) {
 				/* HMAC append failed */
-				goto tx_err;
+				return CSP_ERR_TX;
 			}
 #else
 			csp_dbg_errno = CSP_DBG_ERR_UNSUPPORTED;
-			goto tx_err;
+			return CSP_ERR_NOTSUP;
 #endif
 		}
 
 		/* Append CRC32 */
-		if (idout.flags & CSP_FCRC32) {
+		if (packet->id.flags & CSP_FCRC32) {
 			/* Calculate and add CRC32 (does not include header for backwards compatability with csp1.x) */
 			if (csp_crc32_append(packet) != CSP_ERR_NONE) {
 				/* CRC32 append failed */
-				goto tx_err;
+				return CSP_ERR_TX;
 			}
 		}
 	}
 
-	/* Store length before passing to interface */
-	uint16_t bytes = packet->length;
 	uint16_t mtu = iface->mtu;
+	if (mtu > 0 && packet->length > mtu)
+		return CSP_ERR_INVAL;
 
-	if (mtu > 0 && bytes > mtu)
+	return CSP_ERR_NONE;
+}
+
+/* Output hook, header, HMAC, CRC32 and MTU check */
+static int csp_send_prepare(csp_id_t idout, csp_packet_t * packet, csp_iface_t * iface, uint16_t via, int from_me) {
+
+	csp_send_prepare_id(idout, packet, iface, via, from_me);
+
+	return csp_send_prepare_check(packet, iface, from_me);
+}
+
+void csp_send_direct_iface_finish(csp_packet_t * packet, csp_iface_t * iface, uint16_t via, int from_me) {
+
+	if (csp_send_prepare_check(packet, iface, from_me) != CSP_ERR_NONE)
 		goto tx_err;
 
+	/* Store length before passing to interface */
+	uint16_t bytes = packet->length;
+
+	/* Leave ordering and rate to the egress scheduler */
+	if (iface->qos != NULL) {
+		csp_qos_enqueue(iface, via, packet);
+		return;
+	}
+
 	if ((*iface->nexthop)(iface, via, packet) != CSP_ERR_NONE)
 		goto tx_err;
 
@@ -225,9 +294,88 @@ tx_err:
 	iface->tx_error++;
 	return;
 }
+
+void csp_send_direct_iface(csp_id_t idout, csp_packet_t * packet, csp_iface_t * iface, uint16_t via, int from_me) {
+
+	csp_send_prepare_id(idout, packet, iface, via, from_me);
+
+	/* Large packets from me get their HMAC and CRC32 from an offload worker, which also transmits them */
+	if (from_me && csp_offload_tx(packet, iface, via)) {
+		return;
+	}
+
+	csp_send_direct_iface_finish(packet, iface, via, from_me);
+}
+
+static void csp_send_direct_iface_batch(csp_id_t idout, csp_packet_t * packets[], unsigned int count, csp_iface_t * iface, uint16_t via) {
+
+	/* Without batch support, with an egress scheduler or with offload, packets are sent one at a time */
+	if ((iface->nexthop_batch == NULL) || (iface->qos != NULL) || csp_offload_enabled()) {
+		for (unsigned int i = 0; i < count; i++) {
+			csp_send_direct_iface(idout, packets[i], iface, via, 1);
+		}
+		return;
+	}
+
+	/* Prepare all packets, and keep the good ones in order */
+	unsigned int ready = 0;
+	uint32_t bytes = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		if (csp_send_prepare(idout, packets[i], iface, via, 1) != CSP_ERR_NONE) {
+			csp_buffer_free(packets[i]);
+			iface->tx_error++;
+			continue;
+		}
+		bytes += packets[i]->length;
+		packets[ready++] = packets[i];
+	}
+
+	if (ready == 0) {
+		return;
+	}
+
+	unsigned int sent = (*iface->nexthop_batch)(iface, via, packets, ready);
+
+	/* Packets not sent are still ours */
+	for (unsigned int i = sent; i < ready; i++) {
+		bytes -= packets[i]->length;
+		csp_buffer_free(packets[i]);
+		iface->tx_error++;
+	}
+
+	iface->tx += sent;
+	iface->txbytes += bytes;
+}
+
+/* Route once for the whole batch. Local and broadcast destinations are rare, and use the normal path */
+static void csp_send_direct_batch(csp_id_t idout, csp_packet_t * packets[], unsigned int count) {
+
+	if (csp_iflist_subnet_map(idout.dst) != 0) {
+		for (unsigned int i = 0; i < count; i++) {
+			csp_send_direct(idout, packets[i], NULL);
+		}
+		return;
+	}
+
+	uint32_t bytes = 0;
+	for (unsigned int i = 0; i < count; i++) {
+		bytes += packets[i]->length;
+	}
+
+	csp_route_t route;
+	if (!csp_rtable_route_packet(idout.dst, count, bytes, &route)) {
+		for (unsigned int i = 0; i < count; i++) {
+			csp_buffer_free(packets[i]);
+		}
+		return;
+	}
+
+	csp_send_direct_iface_batch(idout, packets, count, route.iface, route.via);
+}
 /* this functions was modified with a probe by DAMAT */
 
-void csp_send(csp_conn_t * conn, csp_packet_t * packet) {
+/* Send probe, run once per csp_send() call, and once per batch */
+static void csp_send_probe(csp_id_t * idout) {
 
 	/* mutation probe */
 
@@ -235,23 +383,28 @@ void csp_send(csp_conn_t * conn, csp_packet_t * packet) {
 	// printf("probe csp_send\n");
 
 	damat_buffer_send[0] = 0;
-	damat_buffer_send[1] = conn->idout.pri;
-	damat_buffer_send[2] = conn->idout.src;
-	damat_buffer_send[3] = conn->idout.dst;
-	damat_buffer_send[4] = conn->idout.dport;
-	damat_buffer_send[5] = conn->idout.sport;
-	damat_buffer_send[6] = conn->idout.flags;
+	damat_buffer_send[1] = idout->pri;
+	damat_buffer_send[2] = idout->src;
+	damat_buffer_send[3] = idout->dst;
+	damat_buffer_send[4] = idout->dport;
+	damat_buffer_send[5] = idout->sport;
+	damat_buffer_send[6] = idout->flags;
 
 	mutate_FM_Send(damat_buffer_send);
 
-	conn->idout.pri = damat_buffer_send[1];
-	conn->idout.src = damat_buffer_send[2];
-	conn->idout.dst = damat_buffer_send[3];
-	conn->idout.dport = damat_buffer_send[4];
-	conn->idout.sport = damat_buffer_send[5];
-	conn->idout.flags = damat_buffer_send[6];
+	idout->pri = damat_buffer_send[1];
+	idout->src = damat_buffer_send[2];
+	idout->dst = damat_buffer_send[3];
+	idout->dport = damat_buffer_send[4];
+	idout->sport = damat_buffer_send[5];
+	idout->flags = damat_buffer_send[6];
 
 	/* end of the probe */
+}
+
+void csp_send(csp_conn_t * conn, csp_packet_t * packet) {
+
+	csp_send_probe(&conn->idout);
 
 	if (packet == NULL) {
 		return;
@@ -262,6 +415,14 @@ void csp_send(csp_conn_t * conn, csp_packet_t * packet) {
 		return;
 	}
 
+	if (conn->idout.flags & CSP_FCREDIT) {
+		if (csp_credit_send(conn, packet, CSP_CREDIT_SEND_TIMEOUT) != CSP_ERR_NONE) {
+			csp_dbg_conn_ovf++;
+			csp_buffer_free(packet);
+			return;
+		}
+	}
+
 #if (CSP_USE_RDP)
 	if (conn->idout.flags & CSP_FRDP) {
 		if (csp_rdp_send(conn, packet) != CSP_ERR_NONE) {
@@ -276,6 +437,47 @@ void csp_send(csp_conn_t * conn, csp_packet_t * packet) {
 
 /* end of mutated function */
 
+int csp_send_nonblock(csp_conn_t * conn, csp_packet_t * packet) {
+
+	if ((conn == NULL) || (conn->state != CONN_OPEN) || (packet == NULL)) {
+		return CSP_ERR_INVAL;
+	}
+
+	if (conn->idout.flags & CSP_FCREDIT) {
+		csp_send_probe(&conn->idout);
+		int ret = csp_credit_send(conn, packet, 0);
+		if (ret != CSP_ERR_NONE) {
+			return ret;
+		}
+		csp_send_direct(conn->idout, packet, NULL);
+		return CSP_ERR_NONE;
+	}
+
+	csp_send(conn, packet);
+	return CSP_ERR_NONE;
+}
+
+void csp_send_batch(csp_conn_t * conn, csp_packet_t * packets[], unsigned int count) {
+
+	if ((conn == NULL) || (conn->state != CONN_OPEN)) {
+		for (unsigned int i = 0; i < count; i++) {
+			csp_buffer_free(packets[i]);
+		}
+		return;
+	}
+
+	/* RDP and credits may wait for the window between packets, so each packet goes through csp_send() */
+	if ((conn->idout.flags & (CSP_FRDP | CSP_FCREDIT)) || (count == 1)) {
+		for (unsigned int i = 0; i < count; i++) {
+			csp_send(conn, packets[i]);
+		}
+		return;
+	}
+
+	csp_send_probe(&conn->idout);
+	csp_send_direct_batch(conn->idout, packets, count);
+}
+
 void csp_send_prio(uint8_t prio, csp_conn_t * conn, csp_packet_t * packet) {
 	conn->idout.pri = prio;
 	csp_send(conn, packet);
@@ -317,13 +519,23 @@ int csp_transaction_persistent(csp_conn_t * conn, uint32_t timeout, void * outbu
 
 int csp_transaction_w_opts(uint8_t prio, uint16_t dest, uint8_t port, uint32_t timeout, void * outbuf, int outlen, void * inbuf, int inlen, uint32_t opts) {
 
-	csp_conn_t * conn = csp_connect(prio, dest, port, 0, opts);
+	csp_conn_t * conn;
+	if (opts & CSP_O_KEEPALIVE) {
+		conn = csp_conn_pool_get(prio, dest, port, opts);
+	} else {
+		conn = csp_connect(prio, dest, port, 0, opts);
+	}
 	if (conn == NULL)
 		return 0;
 
 	int status = csp_transaction_persistent(conn, timeout, outbuf, outlen, inbuf, inlen);
 
-	csp_close(conn);
+	/* A failed transaction may leave a late reply behind, so the connection is not reused */
+	if ((opts & CSP_O_KEEPALIVE) && (status != 0)) {
+		csp_conn_pool_put(conn, dest, port, opts);
+	} else {
+		csp_close(conn);
+	}
 
 	return status;
 }
@@ -350,9 +562,9 @@ void csp_sendto(uint8_t prio, uint16_t dest, uint8_t dport, uint8_t src_port, ui
 		return;
 	}
 
-	if (opts & CSP_O_HMAC) {
+	if (opts & (CSP_O_HMAC | CSP_O_SIPHASH)) {
 #if (CSP_USE_HMAC)
-		packet->id.flags |= CSP_FHMAC;
+		packet->id.flags |= (opts & CSP_O_SIPHASH) ? CSP_FSIPHASH : CSP_FHMAC;
 #else
 		csp_dbg_errno = CSP_DBG_ERR_UNSUPPORTED;
 		csp_buffer_free(packet);
@@ -373,6 +585,49 @@ void csp_sendto(uint8_t prio, uint16_t dest, uint8_t dport, uint8_t src_port, ui
 	csp_send_direct(packet->id, packet, NULL);
 }
 
+void csp_sendto_batch(uint8_t prio, uint16_t dest, uint8_t dport, uint8_t src_port, uint32_t opts, csp_packet_t * packets[], unsigned int count) {
+
+	if (count == 0) {
+		return;
+	}
+
+	csp_id_t idout = {
+		.pri = prio,
+		.flags = (opts & CSP_O_SAME) ? packets[0]->id.flags : 0,
+		.src = 0,  // The source address will be filled by csp_send_direct
+		.dst = dest,
+		.dport = dport,
+		.sport = src_port,
+	};
+
+	if (opts & CSP_O_RDP) {
+		csp_dbg_errno = CSP_DBG_ERR_UNSUPPORTED;
+		goto err;
+	}
+
+	if (opts & (CSP_O_HMAC | CSP_O_SIPHASH)) {
+#if (CSP_USE_HMAC)
+		idout.flags |= (opts & CSP_O_SIPHASH) ? CSP_FSIPHASH : CSP_FHMAC;
+#else
+		csp_dbg_errno = CSP_DBG_ERR_UNSUPPORTED;
+		goto err;
+#endif
+	}
+
+	if (opts & CSP_O_CRC32) {
+		idout.flags |= CSP_FCRC32;
+	}
+
+	csp_send_probe(&idout);
+	csp_send_direct_batch(idout, packets, count);
+	return;
+
+err:
+	for (unsigned int i = 0; i < count; i++) {
+		csp_buffer_free(packets[i]);
+	}
+}
+
 void csp_sendto_reply(const csp_packet_t * request_packet, csp_packet_t * reply_packet, uint32_t opts) {
 
 	if (request_packet == NULL)
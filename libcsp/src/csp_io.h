@@ -14,3 +14,16 @@
 
 void csp_send_direct(csp_id_t idout, csp_packet_t * packet, csp_iface_t * routed_from);
 void csp_send_direct_iface(csp_id_t idout, csp_packet_t * packet, csp_iface_t * iface, uint16_t via, int from_me);
+
+/**
+ * Second half of csp_send_direct_iface(): HMAC, CRC32, MTU check and transmission. Also called by the offload workers.
+ * @param packet packet with the id already copied, consumed
+ * @param from_me 1 if from me, 0 if routed message
+ */
+void csp_send_direct_iface_finish(csp_packet_t * packet, csp_iface_t * iface, uint16_t via, int from_me);
+
+/**
+ * csp_read(), but without stretching \a timeout to the RDP connection timeout. Used by csp_async_poll(), which
+ * waits for its own deadlines.
+ */
+csp_packet_t * csp_read_exact(csp_conn_t * conn, uint32_t timeout);
@@ -0,0 +1,173 @@
+
+
+#include "csp_offload.h"
+
+#include <csp/csp.h>
+#include <csp/csp_crc32.h>
+#include <csp/arch/csp_queue.h>
+#include <csp/crypto/csp_hmac.h>
+#include <csp/crypto/csp_siphash.h>
+
+#include "csp_io.h"
+#include "csp_qfifo.h"
+#include "csp_semaphore.h"
+
+/* Flows are hashed into buckets, and every bucket is served by one worker */
+#define CSP_OFFLOAD_FLOW_BITS 5
+#define CSP_OFFLOAD_FLOWS (1 << CSP_OFFLOAD_FLOW_BITS)
+
+typedef struct {
+	csp_packet_t * packet;
+	csp_iface_t * iface;
+	uint16_t via;
+	uint8_t tx;
+	uint8_t flow;
+} csp_offload_job_t;
+
+static csp_static_queue_t csp_offload_queue[CSP_OFFLOAD_WORKERS] __attribute__((section(".noinit")));
+static csp_queue_handle_t csp_offload_queue_handle[CSP_OFFLOAD_WORKERS] __attribute__((section(".noinit")));
+static char csp_offload_queue_buffer[CSP_OFFLOAD_WORKERS][sizeof(csp_offload_job_t) * CSP_OFFLOAD_QUEUE_LEN] __attribute__((section(".noinit")));
+
+/* Packets of each flow at a worker. Incoming is counted by the router, outgoing by the senders */
+static uint16_t csp_offload_rx_pending[CSP_OFFLOAD_FLOWS];
+static uint16_t csp_offload_tx_pending[CSP_OFFLOAD_FLOWS];
+
+/* The task running csp_route_work(), it must never wait for a worker */
+static void * csp_offload_router;
+
+void csp_offload_init(void) {
+
+	for (unsigned int i = 0; i < CSP_OFFLOAD_WORKERS; i++) {
+		csp_offload_queue_handle[i] = csp_queue_create_static(CSP_OFFLOAD_QUEUE_LEN, sizeof(csp_offload_job_t), csp_offload_queue_buffer[i], &csp_offload_queue[i]);
+	}
+}
+
+void csp_offload_set_router(void) {
+	__atomic_store_n(&csp_offload_router, csp_task_self(), __ATOMIC_RELAXED);
+}
+
+bool csp_offload_enabled(void) {
+	return (csp_conf.offload_threshold != 0);
+}
+
+static unsigned int csp_offload_flow(uint16_t peer, uint8_t peer_port, uint8_t port) {
+
+	uint32_t key = ((uint32_t)peer << 12) | ((uint32_t)(peer_port & 0x3f) << 6) | (port & 0x3f);
+	return (key * 0x9e3779b1) >> (32 - CSP_OFFLOAD_FLOW_BITS);
+}
+
+static csp_queue_handle_t csp_offload_worker(unsigned int flow) {
+	return csp_offload_queue_handle[flow % CSP_OFFLOAD_WORKERS];
+}
+
+/* Large packets with work to do, and anything that would otherwise overtake packets of its flow at a worker */
+static bool csp_offload_wanted(const csp_packet_t * packet, uint16_t pending) {
+
+	if (pending > 0) {
+		return true;
+	}
+
+	if (!csp_offload_enabled()) {
+		return false;
+	}
+
+	return ((packet->id.flags & (CSP_FCRC32 | CSP_FHMAC | CSP_FSIPHASH)) && (packet->length >= csp_conf.offload_threshold));
+}
+
+/* Same checks as the router, for one packet */
+static int csp_offload_verify(csp_packet_t * packet) {
+
+	if (packet->id.flags & CSP_FCRC32) {
+		if (csp_crc32_verify(packet) != CSP_ERR_NONE) {
+			return CSP_ERR_CRC32;
+		}
+	}
+
+#if (CSP_USE_HMAC)
+	if (packet->id.flags & CSP_FSIPHASH) {
+		return csp_siphash_verify(packet);
+	}
+	if (packet->id.flags & CSP_FHMAC) {
+		return csp_hmac_verify(packet, false);
+	}
+#endif
+
+	return CSP_ERR_NONE;
+}
+
+bool csp_offload_rx(csp_iface_t * iface, csp_packet_t * packet) {
+
+	unsigned int flow = csp_offload_flow(packet->id.src, packet->id.sport, packet->id.dport);
+	if (!csp_offload_wanted(packet, __atomic_load_n(&csp_offload_rx_pending[flow], __ATOMIC_ACQUIRE))) {
+		return false;
+	}
+
+	/* The router never waits for a worker, the worker may be waiting for the router */
+	__atomic_add_fetch(&csp_offload_rx_pending[flow], 1, __ATOMIC_RELAXED);
+	const csp_offload_job_t job = {.packet = packet, .iface = iface, .tx = 0, .flow = flow};
+	if (csp_queue_enqueue(csp_offload_worker(flow), &job, 0) != CSP_QUEUE_OK) {
+		if (__atomic_sub_fetch(&csp_offload_rx_pending[flow], 1, __ATOMIC_RELEASE) == 0) {
+			return false;
+		}
+		iface->drop++;
+		csp_buffer_free(packet);
+	}
+
+	return true;
+}
+
+void csp_offload_rx_done(csp_packet_t * packet) {
+
+	unsigned int flow = csp_offload_flow(packet->id.src, packet->id.sport, packet->id.dport);
+	__atomic_sub_fetch(&csp_offload_rx_pending[flow], 1, __ATOMIC_RELEASE);
+}
+
+bool csp_offload_tx(csp_packet_t * packet, csp_iface_t * iface, uint16_t via) {
+
+	unsigned int flow = csp_offload_flow(packet->id.dst, packet->id.dport, packet->id.sport);
+	if (!csp_offload_wanted(packet, __atomic_load_n(&csp_offload_tx_pending[flow], __ATOMIC_ACQUIRE))) {
+		return false;
+	}
+
+	__atomic_add_fetch(&csp_offload_tx_pending[flow], 1, __ATOMIC_RELAXED);
+
+	/* Control packets and retransmits from the router must not wait for a worker, that may wait for the router */
+	uint32_t timeout = (csp_task_self() == __atomic_load_n(&csp_offload_router, __ATOMIC_RELAXED)) ? 0 : CSP_OFFLOAD_TX_TIMEOUT;
+
+	const csp_offload_job_t job = {.packet = packet, .iface = iface, .via = via, .tx = 1, .flow = flow};
+	if (csp_queue_enqueue(csp_offload_worker(flow), &job, timeout) != CSP_QUEUE_OK) {
+		/* Without packets of the flow at a worker, the caller can transmit it in order */
+		if (__atomic_sub_fetch(&csp_offload_tx_pending[flow], 1, __ATOMIC_RELEASE) == 0) {
+			return false;
+		}
+		iface->tx_error++;
+		csp_buffer_free(packet);
+	}
+
+	return true;
+}
+
+int csp_offload_work(unsigned int worker, uint32_t timeout) {
+
+	if (worker >= CSP_OFFLOAD_WORKERS) {
+		return CSP_ERR_INVAL;
+	}
+
+	csp_offload_job_t job;
+	if (csp_queue_dequeue(csp_offload_queue_handle[worker], &job, timeout) != CSP_QUEUE_OK) {
+		return CSP_ERR_TIMEDOUT;
+	}
+
+	if (job.tx) {
+		/* Transmit before the flow is released, so later packets from the sender cannot overtake */
+		csp_send_direct_iface_finish(job.packet, job.iface, job.via, 1);
+		__atomic_sub_fetch(&csp_offload_tx_pending[job.flow], 1, __ATOMIC_RELEASE);
+	} else if (csp_qfifo_write_checked(job.packet, job.iface, csp_offload_verify(job.packet)) != CSP_ERR_NONE) {
+		/* The router is overloaded, release the flow as if the packet had been delivered */
+		csp_offload_rx_done(job.packet);
+		job.iface->drop++;
+		csp_buffer_free(job.packet);
+	}
+
+	return CSP_ERR_NONE;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <csp/csp_offload.h>
+#include <csp/csp_interface.h>
+
+/**
+ * Create the worker queues
+ */
+void csp_offload_init(void);
+
+/**
+ * Remember the calling task as the router, called by csp_route_work()
+ */
+void csp_offload_set_router(void);
+
+/**
+ * @return true if csp_conf.offload_threshold is set
+ */
+bool csp_offload_enabled(void);
+
+/**
+ * Hand incoming packet to me to a worker for verification, called by the router.
+ * The worker returns it with csp_qfifo_write_checked(), and the router must then call csp_offload_rx_done().
+ * @param iface incoming interface
+ * @param packet packet, already counted and deduplicated
+ * @return true if the packet was taken (queued or dropped), false if the router verifies it
+ */
+bool csp_offload_rx(csp_iface_t * iface, csp_packet_t * packet);
+
+/**
+ * Account for a packet returned by a worker, called by the router before delivering it
+ * @param packet packet from csp_qfifo_write_checked()
+ */
+void csp_offload_rx_done(csp_packet_t * packet);
+
+/**
+ * Hand outgoing packet from me to a worker, which appends HMAC and CRC32 and transmits it.
+ * The router task does not wait for room at the worker.
+ * @param packet packet with the id already copied
+ * @param iface outgoing interface
+ * @param via next hop address
+ * @return true if the packet was taken (queued or dropped), false if the caller transmits it
+ */
+bool csp_offload_tx(csp_packet_t * packet, csp_iface_t * iface, uint16_t via);
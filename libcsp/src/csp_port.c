@@ -16,6 +16,7 @@ typedef enum {
 	PORT_CLOSED = 0,
 	PORT_OPEN = 1,
 	PORT_OPEN_CB = 2,
+	PORT_OPEN_GROUP = 3,
 } csp_port_state_t;
 
 typedef struct {
@@ -29,6 +30,14 @@ typedef struct {
 /* We rely on the .bss section to clear this, so there is no csp_port_init() function */
 static csp_port_t ports[CSP_PORT_MAX_BIND + 2] = {0};
 
+/* Multicast group membership, one entry per (port, socket) */
+typedef struct {
+	uint8_t port;
+	csp_socket_t * socket;
+} csp_port_member_t;
+
+static csp_port_member_t members[CSP_PORT_MAX_GROUP_MEMBERS] = {0};
+
 csp_callback_t csp_port_get_callback(unsigned int port) {
 	
 	if (port > CSP_PORT_MAX_BIND) {
@@ -40,8 +49,8 @@ csp_callback_t csp_port_get_callback(unsigned int port) {
 		return ports[port].callback;
 	}
 
-	/* If it's open socket, then return no callback */
-	if (ports[port].state == PORT_OPEN) {
+	/* If it's open socket or group, then return no callback */
+	if ((ports[port].state == PORT_OPEN) || (ports[port].state == PORT_OPEN_GROUP)) {
 		return NULL;
 	}
 
@@ -63,7 +72,7 @@ csp_socket_t * csp_port_get_socket(unsigned int port) {
 		return ports[port].socket;
 	}
 
-	if (ports[port].state == PORT_OPEN_CB) {
+	if ((ports[port].state == PORT_OPEN_CB) || (ports[port].state == PORT_OPEN_GROUP)) {
 		return NULL;
 	}
 
@@ -79,6 +88,16 @@ int csp_listen(csp_socket_t * socket, size_t backlog) {
 	return CSP_ERR_NONE;
 }
 
+int csp_socket_set_rx_pool(csp_socket_t * socket, csp_buffer_pool_t * pool) {
+
+	if (socket == NULL) {
+		return CSP_ERR_INVAL;
+	}
+
+	socket->rx_pool = pool;
+	return CSP_ERR_NONE;
+}
+
 int csp_bind(csp_socket_t * socket, uint8_t port) {
 
 	if (socket == NULL)
@@ -129,3 +148,92 @@ int csp_bind_callback(csp_callback_t callback, uint8_t port) {
 	return 0;
 
 }
+
+unsigned int csp_port_get_group(unsigned int port, csp_socket_t ** sockets, uint32_t * opts) {
+
+	if ((port > CSP_PORT_MAX_BIND) || (ports[port].state != PORT_OPEN_GROUP)) {
+		return 0;
+	}
+
+	unsigned int count = 0;
+	*opts = CSP_SO_NONE;
+
+	for (unsigned int i = 0; i < CSP_PORT_MAX_GROUP_MEMBERS; i++) {
+		if ((members[i].socket != NULL) && (members[i].port == port)) {
+			sockets[count++] = members[i].socket;
+			*opts |= members[i].socket->opts;
+		}
+	}
+
+	return count;
+}
+
+int csp_join_group(csp_socket_t * socket, uint8_t port) {
+
+	if ((socket == NULL) || (socket->rx_queue == NULL) || !(socket->opts & CSP_SO_CONN_LESS)) {
+		return CSP_ERR_INVAL;
+	}
+
+	if (port > CSP_PORT_MAX_BIND) {
+		csp_dbg_errno = CSP_DBG_ERR_INVALID_BIND_PORT;
+		return CSP_ERR_INVAL;
+	}
+
+	if ((ports[port].state != PORT_CLOSED) && (ports[port].state != PORT_OPEN_GROUP)) {
+		csp_dbg_errno = CSP_DBG_ERR_PORT_ALREADY_IN_USE;
+		return CSP_ERR_USED;
+	}
+
+	csp_port_member_t * free_entry = NULL;
+	for (unsigned int i = 0; i < CSP_PORT_MAX_GROUP_MEMBERS; i++) {
+		if (members[i].socket == NULL) {
+			if (free_entry == NULL) {
+				free_entry = &members[i];
+			}
+		} else if ((members[i].socket == socket) && (members[i].port == port)) {
+			return CSP_ERR_ALREADY;
+		}
+	}
+
+	if (free_entry == NULL) {
+		return CSP_ERR_NOMEM;
+	}
+
+	free_entry->port = port;
+	free_entry->socket = socket;
+	ports[port].state = PORT_OPEN_GROUP;
+
+	return CSP_ERR_NONE;
+}
+
+int csp_leave_group(csp_socket_t * socket, uint8_t port) {
+
+	if ((socket == NULL) || (port > CSP_PORT_MAX_BIND)) {
+		return CSP_ERR_INVAL;
+	}
+
+	int found = 0;
+	int remaining = 0;
+	for (unsigned int i = 0; i < CSP_PORT_MAX_GROUP_MEMBERS; i++) {
+		if ((members[i].socket == NULL) || (members[i].port != port)) {
+			continue;
+		}
+		if (members[i].socket == socket) {
+			members[i].socket = NULL;
+			found = 1;
+		} else {
+			remaining++;
+		}
+	}
+
+	if (!found) {
+		return CSP_ERR_INVAL;
+	}
+
+	/* Last member closes the port */
+	if (remaining == 0) {
+		ports[port].state = PORT_CLOSED;
+	}
+
+	return CSP_ERR_NONE;
+}
@@ -5,4 +5,17 @@
 #include <csp/csp_types.h>
 
 csp_socket_t * csp_port_get_socket(unsigned int dport);
-csp_callback_t csp_port_get_callback(unsigned int port);
\ No newline at end of file
+csp_callback_t csp_port_get_callback(unsigned int port);
+
+#ifndef CSP_PORT_MAX_GROUP_MEMBERS
+#define CSP_PORT_MAX_GROUP_MEMBERS 8  //! Total number of multicast group memberships, across all ports
+#endif
+
+/**
+ * Get the members of a multicast group
+ * @param port port number
+ * @param sockets output, must hold #CSP_PORT_MAX_GROUP_MEMBERS sockets
+ * @param opts output, socket options of all members or'ed together
+ * @return number of members, 0 if the port is not a group
+ */
+unsigned int csp_port_get_group(unsigned int port, csp_socket_t ** sockets, uint32_t * opts);
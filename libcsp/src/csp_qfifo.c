@@ -5,6 +5,7 @@
 #include <csp/arch/csp_queue.h>
 #include <csp/csp_debug.h>
 #include <csp/csp_buffer.h>
+#include <csp/csp_offload.h>
 #include <csp_autoconfig.h>
 
 static csp_static_queue_t qfifo_queue __attribute__((section(".noinit")));
@@ -15,9 +16,9 @@ void csp_qfifo_init(void) {
 	qfifo_queue_handle = csp_queue_create_static(CSP_QFIFO_LEN, sizeof(csp_qfifo_t), qfifo_queue_buffer, &qfifo_queue);
 }
 
-int csp_qfifo_read(csp_qfifo_t * input) {
+int csp_qfifo_read(csp_qfifo_t * input, uint32_t timeout) {
 
-	if (csp_queue_dequeue(qfifo_queue_handle, input, FIFO_TIMEOUT) != CSP_QUEUE_OK)
+	if (csp_queue_dequeue(qfifo_queue_handle, input, timeout) != CSP_QUEUE_OK)
 		return CSP_ERR_TIMEDOUT;
 
 	return CSP_ERR_NONE;
@@ -44,6 +45,7 @@ void csp_qfifo_write(csp_packet_t * packet, csp_iface_t * iface, void * pxTaskWo
 	csp_qfifo_t queue_element;
 	queue_element.iface = iface;
 	queue_element.packet = packet;
+	queue_element.check = CSP_QFIFO_UNCHECKED;
 
 	if (pxTaskWoken == NULL)
 		result = csp_queue_enqueue(qfifo_queue_handle, &queue_element, 1);
@@ -60,7 +62,18 @@ void csp_qfifo_write(csp_packet_t * packet, csp_iface_t * iface, void * pxTaskWo
 	}
 }
 
+int csp_qfifo_write_checked(csp_packet_t * packet, csp_iface_t * iface, int check) {
+
+	const csp_qfifo_t queue_element = {.iface = iface, .packet = packet, .check = check};
+	if (csp_queue_enqueue(qfifo_queue_handle, &queue_element, CSP_OFFLOAD_RX_TIMEOUT) != CSP_QUEUE_OK) {
+		csp_dbg_conn_ovf++;
+		return CSP_ERR_TIMEDOUT;
+	}
+
+	return CSP_ERR_NONE;
+}
+
 void csp_qfifo_wake_up(void) {
-	const csp_qfifo_t queue_element = {.iface = NULL, .packet = NULL};
+	const csp_qfifo_t queue_element = {.iface = NULL, .packet = NULL, .check = CSP_QFIFO_UNCHECKED};
 	csp_queue_enqueue(qfifo_queue_handle, &queue_element, 0);
 }
@@ -15,17 +15,32 @@
  */
 void csp_qfifo_init(void);
 
+/** Router queue item not verified yet, see csp_qfifo_t.check */
+#define CSP_QFIFO_UNCHECKED 1
+
 typedef struct {
 	csp_iface_t * iface;
 	csp_packet_t * packet;
+	int check;  //!< #CSP_QFIFO_UNCHECKED, or the CRC32 and HMAC result from an offload worker
 } csp_qfifo_t;
 
 /**
  * Read next packet from router input queue
  * @param input pointer to router queue item element
+ * @param timeout timeout in mS to wait for a packet, e.g. #FIFO_TIMEOUT
  * @return CSP_ERR type
  */
-int csp_qfifo_read(csp_qfifo_t * input);
+int csp_qfifo_read(csp_qfifo_t * input, uint32_t timeout);
+
+/**
+ * Return a packet verified by an offload worker to the router.
+ * Waits up to #CSP_OFFLOAD_RX_TIMEOUT for room in the queue, the router must not wait for the worker.
+ * @param packet packet, already counted and deduplicated by the router
+ * @param iface incoming interface
+ * @param check result of the CRC32 and HMAC verification
+ * @return #CSP_ERR_NONE if queued, #CSP_ERR_TIMEDOUT if the caller keeps the packet
+ */
+int csp_qfifo_write_checked(csp_packet_t * packet, csp_iface_t * iface, int check);
 
 /**
  * Wake up any task (e.g. router) waiting on messages.
@@ -0,0 +1,303 @@
+
+
+#include "csp_qos.h"
+
+#include <string.h>
+
+#include <csp/csp.h>
+#include <csp/csp_debug.h>
+#include <csp/csp_iflist.h>
+#include <csp/arch/csp_time.h>
+
+#include "csp_qfifo.h"
+
+/* Number of attached schedulers, lets the router skip the interface walk */
+static unsigned int csp_qos_count = 0;
+
+/* Set when the router knows about the backlog and will come back for it */
+static uint8_t csp_qos_armed = 0;
+
+static bool csp_qos_backlog(csp_qos_t * qos) {
+
+	for (int c = 0; c < CSP_QOS_CLASSES; c++) {
+		if ((qos->head[c].packet != NULL) || (csp_queue_size(qos->queue[c]) > 0)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void csp_qos_refill(csp_qos_t * qos) {
+
+	uint32_t now = csp_get_ms();
+	uint32_t elapsed = now - qos->last_refill;
+	qos->last_refill = now;
+
+	int64_t max = (int64_t)qos->burst * 1000;
+	qos->tokens += (int64_t)elapsed * qos->rate;
+	if (qos->tokens > max) {
+		qos->tokens = max;
+	}
+}
+
+/**
+ * Select the next class to serve.
+ * Strict priority, except that a class which has waited for starvation_limit packets goes first.
+ * @return class number, or -1 if all queues are empty
+ */
+static int csp_qos_pick(csp_qos_t * qos) {
+
+	int pick = -1;
+
+	for (int c = 0; c < CSP_QOS_CLASSES; c++) {
+
+		if (qos->head[c].packet == NULL) {
+			if (csp_queue_dequeue(qos->queue[c], &qos->head[c], 0) != CSP_QUEUE_OK) {
+				qos->head[c].packet = NULL;
+				continue;
+			}
+		}
+
+		if (pick < 0) {
+			pick = c;
+		} else if ((qos->starvation_limit > 0) &&
+				   (qos->waited[c] >= qos->starvation_limit) &&
+				   (qos->waited[pick] < qos->starvation_limit)) {
+			pick = c;
+		}
+	}
+
+	return pick;
+}
+
+static void csp_qos_transmit(csp_iface_t * iface, uint16_t via, csp_packet_t * packet, csp_qos_stats_t * stats) {
+
+	uint16_t bytes = packet->length;
+
+	if ((*iface->nexthop)(iface, via, packet) != CSP_ERR_NONE) {
+		csp_buffer_free(packet);
+		iface->tx_error++;
+		return;
+	}
+
+	iface->tx++;
+	iface->txbytes += bytes;
+	stats->sent++;
+	stats->bytes += bytes;
+}
+
+/**
+ * Transmit queued packets, as long as the token bucket allows.
+ * Only one task dispatches at a time, others leave their packet in the queue for it.
+ * @return true if packets are left waiting for tokens
+ */
+static bool csp_qos_dispatch(csp_iface_t * iface, csp_qos_t * qos) {
+
+	do {
+
+		if (__atomic_test_and_set(&qos->busy, __ATOMIC_ACQUIRE)) {
+			/* Another task is dispatching, and will pick up our packet */
+			return false;
+		}
+
+		bool blocked = false;
+		int c;
+
+		if (qos->rate > 0) {
+			csp_qos_refill(qos);
+		}
+
+		while ((c = csp_qos_pick(qos)) >= 0) {
+
+			csp_qos_item_t item = qos->head[c];
+
+			if (qos->rate > 0) {
+				/* Packets larger than the bucket are let through on a full bucket, and leave it in debt */
+				int64_t cost = ((int64_t)item.packet->length + qos->overhead) * 1000;
+				int64_t need = cost;
+				if (need > (int64_t)qos->burst * 1000) {
+					need = (int64_t)qos->burst * 1000;
+				}
+				if (qos->tokens < need) {
+					qos->deficit = need - qos->tokens;
+					blocked = true;
+					break;
+				}
+				qos->tokens -= cost;
+			}
+
+			qos->head[c].packet = NULL;
+
+			/* Age the classes that were passed over */
+			for (int i = 0; i < CSP_QOS_CLASSES; i++) {
+				if ((i != c) && (qos->head[i].packet != NULL) && (qos->waited[i] < UINT8_MAX)) {
+					qos->waited[i]++;
+				}
+			}
+			qos->waited[c] = 0;
+
+			csp_qos_transmit(iface, item.via, item.packet, &qos->stats[c]);
+		}
+
+		__atomic_clear(&qos->busy, __ATOMIC_RELEASE);
+
+		if (blocked) {
+			return true;
+		}
+
+		/* A packet may have been queued after our last pick, while its sender saw us busy */
+	} while (csp_qos_backlog(qos));
+
+	return false;
+}
+
+void csp_qos_enqueue(csp_iface_t * iface, uint16_t via, csp_packet_t * packet) {
+
+	csp_qos_t * qos = iface->qos;
+
+	unsigned int c = packet->id.pri;
+	if (c >= CSP_QOS_CLASSES) {
+		c = CSP_QOS_CLASSES - 1;
+	}
+
+	csp_qos_item_t item = {.packet = packet, .via = via};
+	if (csp_queue_enqueue(qos->queue[c], &item, 0) != CSP_QUEUE_OK) {
+		qos->stats[c].dropped++;
+		iface->drop++;
+		csp_buffer_free(packet);
+		return;
+	}
+	qos->stats[c].enqueued++;
+
+	/* Let the router release the backlog, if it is not already doing so */
+	if (csp_qos_dispatch(iface, qos) && !csp_qos_armed) {
+		csp_qos_armed = 1;
+		csp_qfifo_wake_up();
+	}
+}
+
+uint32_t csp_qos_work(uint32_t timeout) {
+
+	if (csp_qos_count == 0) {
+		return timeout;
+	}
+
+	uint8_t armed = 0;
+
+	for (csp_iface_t * iface = csp_iflist_get(); iface != NULL; iface = iface->next) {
+
+		csp_qos_t * qos = iface->qos;
+		if (qos == NULL) {
+			continue;
+		}
+
+		uint32_t wait;
+		if (csp_qos_dispatch(iface, qos)) {
+			/* Time until the bucket holds enough tokens */
+			wait = (qos->deficit + qos->rate - 1) / qos->rate;
+		} else if (csp_qos_backlog(qos)) {
+			/* Another task is dispatching, check back soon */
+			wait = 1;
+		} else {
+			continue;
+		}
+
+		armed = 1;
+		if (wait < 1) {
+			wait = 1;
+		}
+		if (wait < timeout) {
+			timeout = wait;
+		}
+	}
+
+	csp_qos_armed = armed;
+
+	return timeout;
+}
+
+int csp_qos_attach(csp_iface_t * iface, csp_qos_t * qos) {
+
+	if ((iface == NULL) || (qos == NULL)) {
+		csp_dbg_errno = CSP_DBG_ERR_INVALID_POINTER;
+		return CSP_ERR_INVAL;
+	}
+
+	if (iface->qos != NULL) {
+		return CSP_ERR_ALREADY;
+	}
+
+	for (int c = 0; c < CSP_QOS_CLASSES; c++) {
+		qos->queue[c] = csp_queue_create_static(CSP_QOS_QUEUE_LEN, sizeof(csp_qos_item_t), qos->queue_buffer[c], &qos->queue_static[c]);
+		if (qos->queue[c] == NULL) {
+			return CSP_ERR_NOMEM;
+		}
+		qos->head[c].packet = NULL;
+		qos->waited[c] = 0;
+	}
+
+	memset(qos->stats, 0, sizeof(qos->stats));
+	qos->tokens = (int64_t)qos->burst * 1000;
+	qos->deficit = 0;
+	qos->last_refill = csp_get_ms();
+	qos->busy = 0;
+
+	iface->qos = qos;
+	csp_qos_count++;
+
+	return CSP_ERR_NONE;
+}
+
+void csp_qos_detach(csp_iface_t * iface) {
+
+	if ((iface == NULL) || (iface->qos == NULL)) {
+		return;
+	}
+
+	csp_qos_t * qos = iface->qos;
+	iface->qos = NULL;
+	csp_qos_count--;
+
+	for (int c = 0; c < CSP_QOS_CLASSES; c++) {
+		if (qos->head[c].packet != NULL) {
+			csp_buffer_free(qos->head[c].packet);
+			qos->head[c].packet = NULL;
+		}
+		csp_qos_item_t item;
+		while (csp_queue_dequeue(qos->queue[c], &item, 0) == CSP_QUEUE_OK) {
+			csp_buffer_free(item.packet);
+		}
+	}
+}
+
+void csp_qos_reset_stats(csp_iface_t * iface) {
+
+	if ((iface == NULL) || (iface->qos == NULL)) {
+		return;
+	}
+
+	memset(iface->qos->stats, 0, sizeof(iface->qos->stats));
+}
+
+#if (CSP_ENABLE_CSP_PRINT)
+
+void csp_qos_print(void) {
+
+	for (csp_iface_t * iface = csp_iflist_get(); iface != NULL; iface = iface->next) {
+
+		csp_qos_t * qos = iface->qos;
+		if (qos == NULL) {
+			continue;
+		}
+
+		csp_print("%-10s rate: %" PRIu32 " burst: %" PRIu32 " overhead: %" PRIu16 " starvation: %u\r\n",
+				  iface->name, qos->rate, qos->burst, qos->overhead, qos->starvation_limit);
+		for (int c = 0; c < CSP_QOS_CLASSES; c++) {
+			csp_print("           prio %d enq: %05" PRIu32 " sent: %05" PRIu32 " drop: %05" PRIu32 " bytes: %" PRIu32 "\r\n",
+					  c, qos->stats[c].enqueued, qos->stats[c].sent, qos->stats[c].dropped, qos->stats[c].bytes);
+		}
+	}
+}
+
+#endif
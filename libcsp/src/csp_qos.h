@@ -0,0 +1,19 @@
+#pragma once
+
+#include <csp/csp_qos.h>
+
+/**
+ * Queue packet on the interface scheduler and transmit what the token bucket allows
+ * @param iface outgoing interface, with a scheduler attached
+ * @param via next hop address
+ * @param packet packet to send, ownership is always taken
+ */
+void csp_qos_enqueue(csp_iface_t * iface, uint16_t via, csp_packet_t * packet);
+
+/**
+ * Release shaped packets on all interfaces
+ * Called by the router task.
+ * @param timeout max time the router intends to sleep
+ * @return time until the next packet can be released, or \a timeout if sooner/nothing is waiting
+ */
+uint32_t csp_qos_work(uint32_t timeout);
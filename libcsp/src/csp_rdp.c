@@ -50,6 +50,7 @@ typedef struct __attribute__((__packed__)) {
 } rdp_header_t;
 
 static int csp_rdp_close_internal(csp_conn_t * conn, uint8_t closed_by, bool send_rst);
+static int csp_rdp_connect_start(csp_conn_t * conn);
 
 /**
  * RDP Headers:
@@ -145,7 +146,7 @@ static int csp_rdp_send_cmp(csp_conn_t * conn, csp_packet_t * packet, int flags,
 		csp_packet_t * rdp_packet = csp_buffer_clone(packet);
 		if (rdp_packet == NULL) return CSP_ERR_NOMEM;
 		rdp_packet->timestamp_tx = csp_get_ms();
-		csp_rdp_queue_tx_add(conn, rdp_packet);
+		csp_rdp_queue_tx_add(conn, rdp_packet, seq_nr);
 	}
 
 	/* Send control messages with high priority */
@@ -183,31 +184,24 @@ static int csp_rdp_send_eack(csp_conn_t * conn) {
 	packet_eack->length = 0;
 
 	/* Loop through RX queue */
-	int i, count;
-	csp_packet_t * packet;
-	count = csp_rdp_queue_rx_size();
 	unsigned int space_available = 100 - (packet_eack->length + sizeof(rdp_header_t));
 
-	for (i = 0; i < count; i++) {
+	for (unsigned int i = 1; i <= CSP_RDP_RX_RING; i++) {
 
-		packet = csp_rdp_queue_rx_get(conn);
-		if (packet == NULL) {
-			break;
+		uint16_t seq_nr = conn->rdp.rcv_cur + i;
+		if (csp_rdp_queue_rx_get(conn, seq_nr) == NULL) {
+			continue;
 		}
 
 		/* Add seq nr to EACK packet */
-		rdp_header_t * header = csp_rdp_header_ref(packet);
 		if (space_available >= sizeof(uint16_t)) {
-			packet_eack->data16[packet_eack->length / sizeof(uint16_t)] = htobe16(header->seq_nr);
+			packet_eack->data16[packet_eack->length / sizeof(uint16_t)] = htobe16(seq_nr);
 			packet_eack->length += sizeof(uint16_t);
 			space_available -= sizeof(uint16_t);
-			csp_rdp_protocol("RDP %p: Added EACK nr %u\n", conn, header->seq_nr);
+			csp_rdp_protocol("RDP %p: Added EACK nr %u\n", conn, seq_nr);
 		} else {
-			csp_rdp_protocol("RDP %p: Skipping EACK nr %u\n", conn, header->seq_nr);
+			csp_rdp_protocol("RDP %p: Skipping EACK nr %u\n", conn, seq_nr);
 		}
-
-		/* Requeue */
-		csp_rdp_queue_rx_add(conn, packet);
 	}
 
 	return csp_rdp_send_cmp(conn, packet_eack, RDP_ACK | RDP_EAK, conn->rdp.snd_nxt, conn->rdp.rcv_cur);
@@ -256,122 +250,61 @@ static inline int csp_rdp_receive_data(csp_conn_t * conn, csp_packet_t * packet)
 
 static inline void csp_rdp_rx_queue_flush(csp_conn_t * conn) {
 
-	/* Loop through RX queue */
-	int i, count;
-	csp_packet_t * packet;
-
-front:
-	count = csp_rdp_queue_rx_size();
-	for (i = 0; i < count; i++) {
+	/* Check there is room in the RX queue:
+	 * We don't hold a lock on the queue, so we require at least two spaces to be free
+	 * to hopefully avoid posting packets on a full queue */
+	while (csp_queue_free(conn->rx_queue) > 2) {
 
-		/* Check there is room in the RX queue:
-		 * We don't hold a lock on the queue, so we require at least two spaces to be free
-		 * to hopefully avoid posting packets on a full queue */
-		if (csp_queue_free(conn->rx_queue) <= 2)
-			return;
-
-		packet = csp_rdp_queue_rx_get(conn);
+		/* Deliver the next segment in sequence, if it has arrived */
+		csp_packet_t * packet = csp_rdp_queue_rx_remove(conn, conn->rdp.rcv_cur + 1);
 		if (packet == NULL) {
-			break;
+			return;
 		}
 
-		rdp_header_t * header = csp_rdp_header_ref(packet);
-		csp_rdp_protocol("RDP %p: RX Queue deliver matching Element, seq %u\n", conn, header->seq_nr);
-
-		/* If the matching packet was found: */
-		if (header->seq_nr == (uint16_t)(conn->rdp.rcv_cur + 1)) {
-			csp_rdp_protocol("RDP %p: Deliver seq %u", conn, header->seq_nr);
-			if (csp_rdp_receive_data(conn, packet) != CSP_ERR_NONE) {
-				csp_rdp_error("RDP lost packet internally, stream corrupted!\n");
-				csp_buffer_free(packet);
-			}
-			conn->rdp.rcv_cur++;
-
-			/* Loop from first element again */
-			goto front;
-
-			/* Otherwise, requeue */
-		} else {
-			csp_rdp_queue_rx_add(conn, packet);
+		csp_rdp_protocol("RDP %p: Deliver seq %u", conn, (uint16_t)(conn->rdp.rcv_cur + 1));
+		if (csp_rdp_receive_data(conn, packet) != CSP_ERR_NONE) {
+			csp_rdp_error("RDP lost packet internally, stream corrupted!\n");
+			csp_buffer_free(packet);
 		}
+		conn->rdp.rcv_cur++;
 	}
 }
 
-static inline bool csp_rdp_seq_in_rx_queue(csp_conn_t * conn, uint16_t seq_nr) {
+static void csp_rdp_flush_eack(csp_conn_t * conn, csp_packet_t * eack_packet) {
 
-	/* Loop through RX queue */
-	int i, count;
-	csp_packet_t * packet;
-	count = csp_rdp_queue_rx_size();
-	for (i = 0; i < count; i++) {
+	/* Free the acknowledged elements, and find the newest one */
+	const uint16_t snd_nxt = conn->rdp.snd_nxt;
+	uint16_t eack_max = conn->rdp.snd_una;
+	for (int j = 0; j < (int)((eack_packet->length - sizeof(rdp_header_t)) / sizeof(uint16_t)); j++) {
 
-		packet = csp_rdp_queue_rx_get(conn);
-		if (packet == NULL) {
-			break;
+		uint16_t seq_nr = be16toh(eack_packet->data16[j]);
+		if (!csp_rdp_seq_before(seq_nr, snd_nxt) || csp_rdp_seq_before(seq_nr, conn->rdp.snd_una)) {
+			continue;
 		}
 
-		csp_rdp_queue_rx_add(conn, packet);
-
-		rdp_header_t * header = csp_rdp_header_ref((csp_packet_t *)packet);
-		csp_rdp_protocol("RDP %p: RX Queue exists matching Element, seq %u\n", conn, header->seq_nr);
+		if (csp_rdp_queue_tx_get(conn, seq_nr) != NULL) {
+			csp_rdp_protocol("RDP %p: TX Element %u freed\n", conn, seq_nr);
+			csp_rdp_queue_tx_free(conn, seq_nr);
+		}
 
-		/* If the matching packet was found, deliver */
-		if (header->seq_nr == seq_nr) {
-			csp_rdp_protocol("RDP %p: We have a match\n", conn);
-			return true;
+		if (csp_rdp_seq_after(seq_nr, eack_max)) {
+			eack_max = seq_nr;
 		}
 	}
 
-	return false;
-}
-
-static inline int csp_rdp_rx_queue_add(csp_conn_t * conn, csp_packet_t * packet, uint16_t seq_nr) {
-
-	if (csp_rdp_seq_in_rx_queue(conn, seq_nr))
-		return -1;
-	csp_rdp_queue_rx_add(conn, packet);
-	return 0;
-}
-
-static void csp_rdp_flush_eack(csp_conn_t * conn, csp_packet_t * eack_packet) {
-
-	/* Loop through TX queue */
-	int i, j, count;
-	csp_packet_t * packet;
-	count = csp_rdp_queue_tx_size();
-	for (i = 0; i < count; i++) {
+	/* Elements before an EACK'ed one are probably lost, retransmit them now */
+	const uint32_t time_now = csp_get_ms();
+	for (uint16_t seq_nr = conn->rdp.snd_una; csp_rdp_seq_before(seq_nr, eack_max); seq_nr++) {
 
-		packet = csp_rdp_queue_tx_get(conn);
+		csp_packet_t * packet = csp_rdp_queue_tx_get(conn, seq_nr);
 		if (packet == NULL) {
-			break;
-		}
-
-		rdp_header_t * header = csp_rdp_header_ref((csp_packet_t *)packet);
-		csp_rdp_protocol("RDP %p: EACK compare element, time %" PRIu32 ", seq %u\n", conn, packet->timestamp_tx, be16toh(header->seq_nr));
-
-		/* Look for this element in EACKs */
-		int match = 0;
-		for (j = 0; j < (int)((eack_packet->length - sizeof(rdp_header_t)) / sizeof(uint16_t)); j++) {
-			if (be16toh(eack_packet->data16[j]) == be16toh(header->seq_nr))
-				match = 1;
-
-			/* Enable this if you want EACK's to trigger retransmission */
-			if (be16toh(eack_packet->data16[j]) > be16toh(header->seq_nr)) {
-				uint32_t time_now = csp_get_ms();
-				if (csp_rdp_time_after(time_now, packet->rdp_quarantine)) {
-					packet->timestamp_tx = time_now - conn->rdp.packet_timeout - 1;
-					packet->rdp_quarantine = time_now + conn->rdp.packet_timeout / 2;
-				}
-			}
+			continue;
 		}
 
-		if (match == 0) {
-			/* If not found, put back on tx queue */
-			csp_rdp_queue_tx_add(conn, packet);
-		} else {
-			/* Found, free */
-			csp_rdp_protocol("RDP %p: TX Element %u freed\n", conn, be16toh(header->seq_nr));
-			csp_buffer_free(packet);
+		csp_rdp_protocol("RDP %p: EACK compare element, time %" PRIu32 ", seq %u\n", conn, packet->timestamp_tx, seq_nr);
+		if (csp_rdp_time_after(time_now, packet->rdp_quarantine)) {
+			packet->timestamp_tx = time_now - conn->rdp.packet_timeout - 1;
+			packet->rdp_quarantine = time_now + conn->rdp.packet_timeout / 2;
 		}
 	}
 }
@@ -415,7 +348,8 @@ static inline bool csp_rdp_is_conn_ready_for_tx(csp_conn_t * conn) {
 	if (csp_rdp_seq_after(conn->rdp.snd_nxt, conn->rdp.snd_una + conn->rdp.window_size - 1)) {
 		return false;
 	}
-	return true;
+	// Check the retransmission ring has been released by the router
+	return csp_rdp_queue_tx_space(conn, conn->rdp.snd_nxt);
 }
 
 /**
@@ -452,29 +386,38 @@ void csp_rdp_check_timeouts(csp_conn_t * conn) {
 		return;
 	}
 
+	/**
+	 * CONNECT TIMEOUT:
+	 * A non-blocking connect has no task waiting for the SYN/ACK, so give up here.
+	 */
+	if ((conn->rdp.state == RDP_SYN_SENT) && (conn->opts & CSP_O_NONBLOCK)) {
+		if (csp_rdp_time_after(time_now, conn->timestamp + conn->rdp.conn_timeout)) {
+			csp_rdp_error("RDP %p: Connect timed out\n", conn);
+			csp_rdp_close_internal(conn, CSP_RDP_CLOSED_BY_PROTOCOL, false);
+			return;
+		}
+	}
+
 	/**
 	 * MESSAGE TIMEOUT:
 	 * Check each outgoing message for TX timeout
 	 */
-	int count = csp_rdp_queue_tx_size();
-	for (int i = 0; i < count; i++) {
 
-		csp_packet_t * packet;
-		packet = csp_rdp_queue_tx_get(conn);
+	/* Free acked elements, they are not retransmitted */
+	csp_rdp_queue_tx_ack(conn, conn->rdp.snd_una);
+
+	const uint16_t snd_nxt = conn->rdp.snd_nxt;
+	uint16_t seq_nr = conn->rdp.tx_tail;
+	for (unsigned int i = 0; (i < CSP_RDP_TX_RING) && csp_rdp_seq_before(seq_nr, snd_nxt); i++, seq_nr++) {
+
+		csp_packet_t * packet = csp_rdp_queue_tx_get(conn, seq_nr);
 		if (packet == NULL) {
-			break;
+			continue;
 		}
 
 		/* Get header */
 		rdp_header_t * header = csp_rdp_header_ref((csp_packet_t *)packet);
 
-		/* If acked, do not retransmit */
-		if (csp_rdp_seq_before(be16toh(header->seq_nr), conn->rdp.snd_una)) {
-			csp_rdp_protocol("RDP %p: TX Element Free, time %" PRIu32 ", seq %u, una %u\n", conn, packet->timestamp_tx, be16toh(header->seq_nr), conn->rdp.snd_una);
-			csp_buffer_free(packet);
-			continue;
-		}
-
 		/* Check timestamp and retransmit if needed */
 		if (csp_rdp_time_after(time_now, packet->timestamp_tx + conn->rdp.packet_timeout)) {
 			csp_rdp_protocol("RDP %p: TX Element timed out, retransmitting seq %u\n", conn, be16toh(header->seq_nr));
@@ -487,9 +430,6 @@ void csp_rdp_check_timeouts(csp_conn_t * conn) {
 			csp_packet_t * new_packet = csp_buffer_clone(packet);
 			csp_send_direct(conn->idout, new_packet, NULL);
 		}
-
-		/* Requeue the TX element */
-		csp_rdp_queue_tx_add(conn, packet);
 	}
 
 	if (conn->rdp.state == RDP_OPEN) {
@@ -587,6 +527,7 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 			conn->rdp.snd_iss = (uint16_t)rand_r(&seed);
 			conn->rdp.snd_nxt = conn->rdp.snd_iss + 1;
 			conn->rdp.snd_una = conn->rdp.snd_iss;
+			csp_rdp_queue_tx_reset(conn, conn->rdp.snd_una);
 
 			/* Store RX seq. */
 			conn->rdp.rcv_cur = rx_header->seq_nr;
@@ -649,6 +590,21 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 			if ((rx_header->flags & RDP_ACK)) {
 				csp_rdp_error("RDP %p: Half-open connection found, send RST and wake Tx task\n", conn);
 				csp_rdp_send_cmp(conn, NULL, RDP_RST, conn->rdp.snd_nxt, conn->rdp.rcv_cur);
+
+				/* Nobody waits to retry a non-blocking connect, so retry from here */
+				if (conn->opts & CSP_O_NONBLOCK) {
+					if (conn->rdp.syn_retry) {
+						conn->rdp.syn_retry = 0;
+						csp_rdp_queue_flush(conn);
+						if (csp_rdp_connect_start(conn) == CSP_ERR_NONE) {
+							goto discard_open;
+						}
+					}
+					csp_rdp_error("RDP %p: Connection stayed half-open, even after RST and retry!\n", conn);
+					csp_rdp_close_internal(conn, CSP_RDP_CLOSED_BY_PROTOCOL, false);
+					goto discard_open;
+				}
+
 				csp_bin_sem_post(&conn->rdp.tx_wait);
 
 				goto discard_open;
@@ -727,8 +683,9 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 				}
 			}
 
-			/* Store current ack'ed sequence number */
+			/* Store current ack'ed sequence number, and release the acked elements to the sending task */
 			conn->rdp.snd_una = rx_header->ack_nr + 1;
+			csp_rdp_queue_tx_ack(conn, conn->rdp.snd_una);
 
 			/* We have an EACK */
 			if ((rx_header->flags & RDP_EAK)) {
@@ -743,8 +700,8 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 
 			/* If message is not in sequence, send EACK and store packet */
 			if (rx_header->seq_nr != (uint16_t)(conn->rdp.rcv_cur + 1)) {
-				if (csp_rdp_rx_queue_add(conn, packet, rx_header->seq_nr) != 0) {
-					csp_rdp_protocol("RDP %p: Duplicate sequence number\n", conn);
+				if (csp_rdp_queue_rx_add(conn, packet, rx_header->seq_nr) != CSP_ERR_NONE) {
+					csp_rdp_protocol("RDP %p: Duplicate sequence number, or beyond the reorder buffer\n", conn);
 					csp_rdp_check_ack(conn);
 					goto discard_open;
 				}
@@ -759,7 +716,8 @@ bool csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 			if (csp_rdp_receive_data(conn, packet) != CSP_ERR_NONE)
 				goto discard_open;
 
-			/* Update last received packet */
+			/* Update last received packet, dropping a stored duplicate of it */
+			csp_buffer_free(csp_rdp_queue_rx_remove(conn, seq_nr));
 			conn->rdp.rcv_cur = seq_nr;
 
 			/* Only ACK the message if there is room for a full window in the RX buffer.
@@ -819,9 +777,7 @@ accepted_open:
 	return close_connection;
 }
 
-int csp_rdp_connect(csp_conn_t * conn) {
-
-	int retry = 1;
+static void csp_rdp_connect_setup(csp_conn_t * conn) {
 
 	conn->rdp.window_size = csp_rdp_window_size;
 	conn->rdp.conn_timeout = csp_rdp_conn_timeout;
@@ -830,8 +786,11 @@ int csp_rdp_connect(csp_conn_t * conn) {
 	conn->rdp.ack_timeout = csp_rdp_ack_timeout;
 	conn->rdp.ack_delay_count = csp_rdp_ack_delay_count;
 	conn->rdp.ack_timestamp = csp_get_ms();
+}
+
+/* Send SYN and enter SYN-SENT, the router task completes the handshake */
+static int csp_rdp_connect_start(csp_conn_t * conn) {
 
-retry:
 	csp_rdp_protocol("RDP %p: Active connect, conn state %u\n", conn, conn->rdp.state);
 
 	if (conn->rdp.state == RDP_OPEN) {
@@ -844,6 +803,7 @@ retry:
 	conn->rdp.snd_iss = (uint16_t)rand_r(&seed);
 	conn->rdp.snd_nxt = conn->rdp.snd_iss + 1;
 	conn->rdp.snd_una = conn->rdp.snd_iss;
+	csp_rdp_queue_tx_reset(conn, conn->rdp.snd_una);
 
 	csp_rdp_protocol("RDP %p: AC: Sending SYN\n", conn);
 
@@ -851,9 +811,26 @@ retry:
 	csp_bin_sem_wait(&conn->rdp.tx_wait, 0);
 
 	/* Send SYN message */
+	conn->timestamp = csp_get_ms();
 	conn->rdp.state = RDP_SYN_SENT;
-	if (csp_rdp_send_syn(conn) != CSP_ERR_NONE)
-		goto error;
+	return csp_rdp_send_syn(conn);
+}
+
+int csp_rdp_connect(csp_conn_t * conn) {
+
+	int retry = 1;
+
+	csp_rdp_connect_setup(conn);
+
+retry:
+	switch (csp_rdp_connect_start(conn)) {
+		case CSP_ERR_NONE:
+			break;
+		case CSP_ERR_ALREADY:
+			return CSP_ERR_ALREADY;
+		default:
+			goto error;
+	}
 
 	/* Wait for router task to release semaphore */
 	csp_rdp_protocol("RDP %p: AC: Waiting for SYN/ACK reply...\n", conn);
@@ -882,6 +859,45 @@ error:
 	return CSP_ERR_TIMEDOUT;
 }
 
+int csp_rdp_connect_nonblock(csp_conn_t * conn) {
+
+	csp_rdp_connect_setup(conn);
+	conn->rdp.syn_retry = 1;
+
+	int ret = csp_rdp_connect_start(conn);
+	if (ret == CSP_ERR_ALREADY) {
+		return ret;
+	}
+	if (ret != CSP_ERR_NONE) {
+		csp_rdp_close_internal(conn, CSP_RDP_CLOSED_BY_PROTOCOL, false);
+		return CSP_ERR_TIMEDOUT;
+	}
+
+	return CSP_ERR_NONE;
+}
+
+int csp_rdp_connect_wait(csp_conn_t * conn, uint32_t timeout) {
+
+	const uint32_t start = csp_get_ms();
+
+	for (;;) {
+
+		if (conn->rdp.state == RDP_OPEN) {
+			return CSP_ERR_NONE;
+		}
+		if (conn->rdp.state != RDP_SYN_SENT) {
+			return CSP_ERR_TIMEDOUT;
+		}
+
+		/* The router task posts the semaphore on every state change of the handshake */
+		uint32_t elapsed = csp_get_ms() - start;
+		if (elapsed >= timeout) {
+			return CSP_ERR_AGAIN;
+		}
+		csp_bin_sem_wait(&conn->rdp.tx_wait, timeout - elapsed);
+	}
+}
+
 int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet) {
 
 	if (conn->rdp.state != RDP_OPEN) {
@@ -921,7 +937,7 @@ int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet) {
 
 	rdp_packet->timestamp_tx = csp_get_ms();
 	rdp_packet->rdp_quarantine = 0;
-	csp_rdp_queue_tx_add(conn, rdp_packet);
+	csp_rdp_queue_tx_add(conn, rdp_packet, conn->rdp.snd_nxt);
 
 	csp_rdp_protocol(
 		"RDP %p: Sending  in S %u: syn %u, ack %u, eack %u, "
@@ -942,6 +958,10 @@ void csp_rdp_init(csp_conn_t * conn) {
 	conn->rdp.conn_timeout = csp_rdp_conn_timeout;
 	conn->rdp.packet_timeout = csp_rdp_packet_timeout;
 
+	/* Connections are not initialized memory, start with empty queues */
+	memset(conn->rdp.tx_ring, 0, sizeof(conn->rdp.tx_ring));
+	memset(conn->rdp.rx_ring, 0, sizeof(conn->rdp.rx_ring));
+
 	/* Create a binary semaphore to wait on for tasks */
 	csp_bin_sem_init(&conn->rdp.tx_wait);
 }
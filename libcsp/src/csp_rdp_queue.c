@@ -1,108 +1,123 @@
-#include <csp/arch/csp_queue.h>
-#include <csp/csp_types.h>
-#include <csp/csp.h>
+#include "csp_rdp_queue.h"
 
-static csp_queue_handle_t tx_queue;
-static csp_static_queue_t tx_queue_static; /* Static storage for rx queue */
-static char tx_queue_static_data[sizeof(csp_packet_t *) * CSP_RDP_MAX_WINDOW * 2];
+#include <csp/csp.h>
 
-static csp_queue_handle_t rx_queue;
-static csp_static_queue_t rx_queue_static; /* Static storage for rx queue */
-static char rx_queue_static_data[sizeof(csp_packet_t *) * CSP_RDP_MAX_WINDOW * 2];
+#include "csp_conn.h"
 
-void csp_rdp_queue_init(void) {
+#if (CSP_USE_RDP)
 
-	/* Create TX queue */
-	tx_queue = csp_queue_create_static(CSP_RDP_MAX_WINDOW * 2, sizeof(csp_packet_t *), tx_queue_static_data, &tx_queue_static);
+/* Both rings are indexed by sequence number. The TX ring holds [tx_tail, snd_nxt), the RX ring (rcv_cur, rcv_cur + CSP_RDP_RX_RING] */
 
-	/* Create RX queue */
-	rx_queue = csp_queue_create_static(CSP_RDP_MAX_WINDOW * 2, sizeof(csp_packet_t *), rx_queue_static_data, &rx_queue_static);
+static inline csp_packet_t ** csp_rdp_queue_tx_slot(csp_conn_t * conn, uint16_t seq_nr) {
+	return &conn->rdp.tx_ring[seq_nr & (CSP_RDP_TX_RING - 1)];
+}
 
+static inline csp_packet_t ** csp_rdp_queue_rx_slot(csp_conn_t * conn, uint16_t seq_nr) {
+	return &conn->rdp.rx_ring[seq_nr & (CSP_RDP_RX_RING - 1)];
 }
 
 void csp_rdp_queue_flush(csp_conn_t * conn) {
 
-   	csp_packet_t * packet;
+	for (unsigned int i = 0; i < CSP_RDP_TX_RING; i++) {
+		csp_buffer_free(__atomic_exchange_n(&conn->rdp.tx_ring[i], NULL, __ATOMIC_ACQ_REL));
+	}
+
+	for (unsigned int i = 0; i < CSP_RDP_RX_RING; i++) {
+		csp_buffer_free(conn->rdp.rx_ring[i]);
+		conn->rdp.rx_ring[i] = NULL;
+	}
+}
+
+void csp_rdp_queue_tx_reset(csp_conn_t * conn, uint16_t seq_nr) {
+	__atomic_store_n(&conn->rdp.tx_tail, seq_nr, __ATOMIC_RELEASE);
+}
 
-    /* Empty TX queue */
-    while (csp_queue_dequeue(tx_queue, &packet, 0) == CSP_QUEUE_OK) {
-        if (packet == NULL) {
-            continue;
-        }
+bool csp_rdp_queue_tx_space(csp_conn_t * conn, uint16_t seq_nr) {
 
-        if ((conn == NULL) || (conn == packet->conn)) {
-            csp_buffer_free(packet);
-        }
-    }
+	/* The slot is free once the router has released the segment one ring length before */
+	uint16_t tail = __atomic_load_n(&conn->rdp.tx_tail, __ATOMIC_ACQUIRE);
+	return (uint16_t)(seq_nr - tail) < CSP_RDP_TX_RING;
+}
 
-    /* Empty RX queue */
-    while (csp_queue_dequeue(rx_queue, &packet, 0) == CSP_QUEUE_OK) {
-        if (packet == NULL) {
-            continue;
-        }
+void csp_rdp_queue_tx_add(csp_conn_t * conn, csp_packet_t * packet, uint16_t seq_nr) {
 
-        if ((conn == NULL) || (conn == packet->conn)) {
-            csp_buffer_free(packet);
-        }
-    }
+	csp_packet_t ** slot = csp_rdp_queue_tx_slot(conn, seq_nr);
+	if (!csp_rdp_queue_tx_space(conn, seq_nr) || (__atomic_load_n(slot, __ATOMIC_ACQUIRE) != NULL)) {
+		csp_buffer_free(packet);
+		return;
+	}
 
+	__atomic_store_n(slot, packet, __ATOMIC_RELEASE);
 }
 
-int csp_rdp_queue_tx_size(void) {
-    return csp_queue_size(tx_queue);
+csp_packet_t * csp_rdp_queue_tx_get(csp_conn_t * conn, uint16_t seq_nr) {
+
+	/* Outside the ring, the slot belongs to another sequence number (e.g. a stale EACK) */
+	if (!csp_rdp_queue_tx_space(conn, seq_nr)) {
+		return NULL;
+	}
+	return __atomic_load_n(csp_rdp_queue_tx_slot(conn, seq_nr), __ATOMIC_ACQUIRE);
 }
 
-void csp_rdp_queue_tx_add(csp_conn_t * conn, csp_packet_t * packet) {
-    packet->conn = conn;
-    if (csp_queue_enqueue(tx_queue, &packet, 0) != CSP_QUEUE_OK) {
-		csp_buffer_free(packet);
-    }
+void csp_rdp_queue_tx_free(csp_conn_t * conn, uint16_t seq_nr) {
+
+	if (!csp_rdp_queue_tx_space(conn, seq_nr)) {
+		return;
+	}
+	csp_buffer_free(__atomic_exchange_n(csp_rdp_queue_tx_slot(conn, seq_nr), NULL, __ATOMIC_ACQ_REL));
 }
 
-csp_packet_t * csp_rdp_queue_tx_get(csp_conn_t * conn) {
-    csp_packet_t * packet;
-    int size = csp_queue_size(tx_queue);
-    while(size--) {
-        if (csp_queue_dequeue(tx_queue, &packet, 0) != CSP_QUEUE_OK) {
-            return NULL;
-        }
-
-        if (packet->conn == conn) {    
-            return packet;
-        } else {
-            csp_rdp_queue_tx_add(conn, packet);
-        }
-    }
-    return NULL;    
+void csp_rdp_queue_tx_ack(csp_conn_t * conn, uint16_t snd_una) {
+
+	uint16_t tail = conn->rdp.tx_tail;
+	uint16_t count = snd_una - tail;
+	if ((count == 0) || (count > UINT16_MAX / 2)) {
+		return;
+	}
+
+	/* Every slot is visited at most once, even if the peer acknowledged far ahead */
+	if (count > CSP_RDP_TX_RING) {
+		count = CSP_RDP_TX_RING;
+	}
+	for (uint16_t i = 0; i < count; i++) {
+		csp_buffer_free(__atomic_exchange_n(csp_rdp_queue_tx_slot(conn, tail + i), NULL, __ATOMIC_ACQ_REL));
+	}
+
+	/* Publish the free slots to the sending task */
+	csp_rdp_queue_tx_reset(conn, snd_una);
 }
 
-int csp_rdp_queue_rx_size(void) {
-    return csp_queue_size(rx_queue);
+int csp_rdp_queue_rx_add(csp_conn_t * conn, csp_packet_t * packet, uint16_t seq_nr) {
+
+	/* Segments beyond the ring are retransmitted by the peer later */
+	if ((uint16_t)(seq_nr - conn->rdp.rcv_cur - 1) >= CSP_RDP_RX_RING) {
+		return CSP_ERR_NOBUFS;
+	}
+
+	csp_packet_t ** slot = csp_rdp_queue_rx_slot(conn, seq_nr);
+	if (*slot != NULL) {
+		return CSP_ERR_ALREADY;
+	}
+
+	*slot = packet;
+	return CSP_ERR_NONE;
 }
 
-void csp_rdp_queue_rx_add(csp_conn_t * conn, csp_packet_t * packet) {
-    packet->conn = conn;
-    if (csp_queue_enqueue(rx_queue, &packet, 0) != CSP_QUEUE_OK) {
-        csp_buffer_free(packet);
-    }
+csp_packet_t * csp_rdp_queue_rx_get(csp_conn_t * conn, uint16_t seq_nr) {
+
+	if ((uint16_t)(seq_nr - conn->rdp.rcv_cur - 1) >= CSP_RDP_RX_RING) {
+		return NULL;
+	}
+	return *csp_rdp_queue_rx_slot(conn, seq_nr);
 }
 
-csp_packet_t * csp_rdp_queue_rx_get(csp_conn_t * conn) {
-    csp_packet_t * packet;
-    int size = csp_queue_size(rx_queue);
-    while(size--) {
-        if (csp_queue_dequeue(rx_queue, &packet, 0) != CSP_QUEUE_OK) {
-            return NULL;
-        }
-
-        if (packet->conn == conn) {
-            return packet;
-        } else {
-            csp_rdp_queue_rx_add(conn, packet);
-        }
-    }
-    return NULL;
-    
+csp_packet_t * csp_rdp_queue_rx_remove(csp_conn_t * conn, uint16_t seq_nr) {
+
+	csp_packet_t * packet = csp_rdp_queue_rx_get(conn, seq_nr);
+	if (packet != NULL) {
+		*csp_rdp_queue_rx_slot(conn, seq_nr) = NULL;
+	}
+	return packet;
 }
 
-		
\ No newline at end of file
+#endif
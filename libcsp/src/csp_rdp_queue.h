@@ -2,13 +2,18 @@
 
 #include <csp/csp_types.h>
 
-void csp_rdp_queue_init(void);
+/* Per connection RDP queues. The TX ring is written by the sending task and drained by the router task,
+ * the RX ring is only used by the router task. */
+
 void csp_rdp_queue_flush(csp_conn_t * conn);
 
-int csp_rdp_queue_tx_size(void);
-void csp_rdp_queue_tx_add(csp_conn_t * conn, csp_packet_t * packet);
-csp_packet_t * csp_rdp_queue_tx_get(csp_conn_t * conn);
+void csp_rdp_queue_tx_reset(csp_conn_t * conn, uint16_t seq_nr);
+bool csp_rdp_queue_tx_space(csp_conn_t * conn, uint16_t seq_nr);
+void csp_rdp_queue_tx_add(csp_conn_t * conn, csp_packet_t * packet, uint16_t seq_nr);
+csp_packet_t * csp_rdp_queue_tx_get(csp_conn_t * conn, uint16_t seq_nr);
+void csp_rdp_queue_tx_free(csp_conn_t * conn, uint16_t seq_nr);
+void csp_rdp_queue_tx_ack(csp_conn_t * conn, uint16_t snd_una);
 
-int csp_rdp_queue_rx_size(void);
-void csp_rdp_queue_rx_add(csp_conn_t * conn, csp_packet_t * packet);
-csp_packet_t * csp_rdp_queue_rx_get(csp_conn_t * conn);
\ No newline at end of file
+int csp_rdp_queue_rx_add(csp_conn_t * conn, csp_packet_t * packet, uint16_t seq_nr);
+csp_packet_t * csp_rdp_queue_rx_get(csp_conn_t * conn, uint16_t seq_nr);
+csp_packet_t * csp_rdp_queue_rx_remove(csp_conn_t * conn, uint16_t seq_nr);
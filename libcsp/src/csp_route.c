@@ -8,17 +8,33 @@
 #include <endian.h>
 #include <csp/arch/csp_queue.h>
 #include <csp/crypto/csp_hmac.h>
+#include <csp/crypto/csp_siphash.h>
 #include <csp/csp_id.h>
 
 #include "csp_port.h"
 #include "csp_conn.h"
+#include "csp_credit.h"
 #include "csp_io.h"
+#include "csp_offload.h"
 #include "csp_promisc.h"
 #include "csp_qfifo.h"
+#include "csp_qos.h"
 #include "csp_dedup.h"
 #include "csp_rdp.h"
+#include "csp_iflist.h"
 #include <csp/csp_debug.h>
-#include <csp/csp_iflist.h>
+
+/** Maximum number of queued packets taken by one csp_route_work() call, and verified together */
+#ifndef CSP_ROUTE_BATCH
+#define CSP_ROUTE_BATCH 8
+#endif
+
+/* Packet to me, with the result of its CRC32 and HMAC verification */
+typedef struct {
+	csp_iface_t * iface;
+	csp_packet_t * packet;
+	int check;  // CSP_QFIFO_UNCHECKED until verified here or by an offload worker
+} csp_route_pending_t;
 
 /**
  * Check supported packet options
@@ -30,8 +46,8 @@ static int csp_route_check_options(csp_iface_t * iface, csp_packet_t * packet) {
 
 
 #if (CSP_USE_HMAC == 0)
-	/* Drop HMAC packets */
-	if (packet->id.flags & CSP_FHMAC) {
+	/* Drop HMAC and SipHash packets */
+	if (packet->id.flags & (CSP_FHMAC | CSP_FSIPHASH)) {
 		csp_dbg_errno = CSP_DBG_ERR_UNSUPPORTED;
 		iface->autherr++;
 		return CSP_ERR_NOTSUP;
@@ -50,19 +66,19 @@ static int csp_route_check_options(csp_iface_t * iface, csp_packet_t * packet) {
 }
 
 /**
- * Helper function to decrypt, check auth and CRC32
+ * Helper function to check auth and CRC32 requirements
  * @param security_opts either socket_opts or conn_opts
  * @param iface pointer to incoming interface
  * @param packet pointer to packet
+ * @param check result of the CRC32 and HMAC verification done by csp_route_verify()
  * @return #CSP_ERR_NONE on success, otherwise an error code.
  */
-static int csp_route_security_check(uint32_t security_opts, csp_iface_t * iface, csp_packet_t * packet) {
+static int csp_route_security_check(uint32_t security_opts, csp_iface_t * iface, csp_packet_t * packet, int check) {
 
 
 	/* CRC32 verified packet */
 	if (packet->id.flags & CSP_FCRC32) {
-		/* Verify CRC32 (does not include header for backwards compatability with csp1.x) */
-		if (csp_crc32_verify(packet) != CSP_ERR_NONE) {
+		if (check == CSP_ERR_CRC32) {
 			iface->rx_error++;
 			return CSP_ERR_CRC32;
 		}
@@ -72,15 +88,18 @@ static int csp_route_security_check(uint32_t security_opts, csp_iface_t * iface,
 	}
 
 #if (CSP_USE_HMAC)
-	/* HMAC authenticated packet */
-	if (packet->id.flags & CSP_FHMAC) {
-		/* Verify HMAC (does not include header for backwards compatability with csp1.x) */
-		if (csp_hmac_verify(packet, false) != CSP_ERR_NONE) {
+	/* HMAC or SipHash authenticated packet, either satisfies CSP_SO_HMACREQ */
+	if (packet->id.flags & (CSP_FHMAC | CSP_FSIPHASH)) {
+		if (check == CSP_ERR_HMAC) {
 			/* HMAC failed */
 			iface->autherr++;
 			return CSP_ERR_HMAC;
 		}
-	} else if (security_opts & CSP_SO_HMACREQ) {
+		if ((security_opts & CSP_SO_SIPHASHREQ) && !(packet->id.flags & CSP_FSIPHASH)) {
+			iface->autherr++;
+			return CSP_ERR_HMAC;
+		}
+	} else if (security_opts & (CSP_SO_HMACREQ | CSP_SO_SIPHASHREQ)) {
 		iface->autherr++;
 		return CSP_ERR_HMAC;
 	}
@@ -105,29 +124,29 @@ __attribute__((weak)) void csp_input_hook(csp_iface_t * iface, csp_packet_t * pa
 				   packet->id.sport, packet->id.pri, packet->id.flags, packet->length, iface->name);
 }
 
-int csp_route_work(void) {
-
-	csp_qfifo_t input;
-	csp_packet_t * packet;
-	csp_conn_t * conn;
-	csp_socket_t * socket;
+/* Move the packet to the receive pool of the application, if the socket has one */
+static int csp_route_to_pool(csp_buffer_pool_t * pool, csp_packet_t ** packet) {
 
-#if (CSP_USE_RDP)
-	/* Check connection timeouts (currently only for RDP) */
-	csp_conn_check_timeouts();
-#endif
-
-	/* Get next packet to route */
-	if (csp_qfifo_read(&input) != CSP_ERR_NONE) {
-		return CSP_ERR_TIMEDOUT;
+	if (pool == NULL) {
+		return CSP_ERR_NONE;
 	}
 
-	packet = input.packet;
-	if (packet == NULL) {
-		return CSP_ERR_TIMEDOUT;
+	*packet = csp_buffer_pool_move(pool, *packet);
+	if (*packet == NULL) {
+		csp_dbg_conn_ovf++;
+		return CSP_ERR_NOBUFS;
 	}
 
-	csp_input_hook(input.iface, packet);
+	return CSP_ERR_NONE;
+}
+
+/**
+ * First stage: count, deduplicate and forward
+ * @return true if the packet is to me, and should be delivered
+ */
+static bool csp_route_input(csp_iface_t * iface, csp_packet_t * packet) {
+
+	csp_input_hook(iface, packet);
 
 	/* Here there be promiscuous mode */
 #if (CSP_USE_PROMISC)
@@ -135,12 +154,12 @@ int csp_route_work(void) {
 #endif
 
 	/* Count the message */
-	input.iface->rx++;
-	input.iface->rxbytes += packet->length;
+	iface->rx++;
+	iface->rxbytes += packet->length;
 
 	/* The packet is to me, if the address matches that of the incoming interface,
 	 * or the address matches the broadcast address of the incoming interface */
-	int is_to_me = ((input.iface->addr == packet->id.dst) || (csp_id_is_broadcast(packet->id.dst, input.iface->netmask)));
+	int is_to_me = ((iface->addr == packet->id.dst) || (csp_iflist_is_broadcast(packet->id.dst, iface)));
 
 	/* Deduplication */
 	if ((csp_conf.dedup == CSP_DEDUP_ALL) ||
@@ -148,9 +167,10 @@ int csp_route_work(void) {
 		((!is_to_me) && (csp_conf.dedup == CSP_DEDUP_FWD))) {
 		if (csp_dedup_is_duplicate(packet)) {
 			/* Discard packet */
-			input.iface->drop++;
+			iface->drop++;
+			iface->dup++;
 			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
+			return false;
 		}
 	}
 
@@ -158,15 +178,118 @@ int csp_route_work(void) {
 	if (!is_to_me) {
 
 		/* Otherwise, actually send the message */
-		csp_send_direct(packet->id, packet, input.iface);
-		return CSP_ERR_NONE;
+		csp_send_direct(packet->id, packet, iface);
+		return false;
 
 	}
 
 	/* Discard packets with unsupported options */
-	if (csp_route_check_options(input.iface, packet) != CSP_ERR_NONE) {
+	if (csp_route_check_options(iface, packet) != CSP_ERR_NONE) {
 		csp_buffer_free(packet);
-		return CSP_ERR_NONE;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Second stage: verify CRC32 and HMAC or SipHash of the packets to me.
+ * HMACs are verified together, which lets the SHA1 engine hash them side by side.
+ */
+static void csp_route_verify(csp_route_pending_t pending[], unsigned int count) {
+
+#if (CSP_USE_HMAC)
+	csp_packet_t * hmac_packets[CSP_ROUTE_BATCH];
+	unsigned int hmac_index[CSP_ROUTE_BATCH];
+	int hmac_results[CSP_ROUTE_BATCH];
+	unsigned int hmac_count = 0;
+#endif
+
+	for (unsigned int i = 0; i < count; i++) {
+
+		csp_packet_t * packet = pending[i].packet;
+		if (pending[i].check != CSP_QFIFO_UNCHECKED) {
+			continue;
+		}
+		pending[i].check = CSP_ERR_NONE;
+
+		/* Verify CRC32 (does not include header for backwards compatability with csp1.x) */
+		if (packet->id.flags & CSP_FCRC32) {
+			if (csp_crc32_verify(packet) != CSP_ERR_NONE) {
+				pending[i].check = CSP_ERR_CRC32;
+				continue;
+			}
+		}
+
+#if (CSP_USE_HMAC)
+		/* HMAC is checked after the CRC32 is stripped, SipHash takes precedence if both flags are set */
+		if (packet->id.flags & CSP_FSIPHASH) {
+			pending[i].check = csp_siphash_verify(packet);
+		} else if (packet->id.flags & CSP_FHMAC) {
+			hmac_packets[hmac_count] = packet;
+			hmac_index[hmac_count++] = i;
+		}
+#endif
+	}
+
+#if (CSP_USE_HMAC)
+	/* Verify HMAC (does not include header for backwards compatability with csp1.x) */
+	csp_hmac_verify_batch(hmac_packets, hmac_count, false, hmac_results);
+	for (unsigned int i = 0; i < hmac_count; i++) {
+		pending[hmac_index[i]].check = hmac_results[i];
+	}
+#endif
+}
+
+/**
+ * Third stage: deliver to ping, groups, callbacks, sockets and connections
+ */
+static void csp_route_deliver(csp_iface_t * iface, csp_packet_t * packet, int check) {
+
+	csp_conn_t * conn;
+	csp_socket_t * socket;
+
+	/**
+	 * Ping fast path: echo the request buffer in place.
+	 * RDP pings need a connection, and take the normal path.
+	 */
+	if (csp_conf.fast_ping && (packet->id.dport == CSP_PING) && !(packet->id.flags & CSP_FRDP)) {
+
+		if (csp_route_security_check(CSP_SO_NONE, iface, packet, check) < 0) {
+			csp_buffer_free(packet);
+			return;
+		}
+
+		csp_sendto_reply(packet, packet, CSP_O_SAME);
+		return;
+	}
+
+	/**
+	 * Multicast groups: each member gets a reference to the same buffer
+	 */
+	csp_socket_t * group[CSP_PORT_MAX_GROUP_MEMBERS];
+	uint32_t group_opts;
+	unsigned int group_count = csp_port_get_group(packet->id.dport, group, &group_opts);
+	if (group_count > 0) {
+
+		/* One check for all members, meeting the strictest requirements */
+		if (csp_route_security_check(group_opts, iface, packet, check) < 0) {
+			csp_buffer_free(packet);
+			return;
+		}
+
+		for (unsigned int i = 0; i < group_count; i++) {
+			/* The last member takes over the router's reference */
+			if (i < group_count - 1) {
+				csp_buffer_refc_inc(packet);
+			}
+			if (csp_queue_enqueue(group[i]->rx_queue, &packet, 0) != CSP_QUEUE_OK) {
+				csp_dbg_conn_ovf++;
+				csp_buffer_free(packet);
+			}
+		}
+
+		return;
 	}
 
 	/**
@@ -175,13 +298,13 @@ int csp_route_work(void) {
 	csp_callback_t callback = csp_port_get_callback(packet->id.dport);
 	if (callback) {
 
-		if (csp_route_security_check(CSP_SO_NONE, input.iface, packet) < 0) {
+		if (csp_route_security_check(CSP_SO_NONE, iface, packet, check) < 0) {
 			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
+			return;
 		}
 
 		callback(packet);
-		return CSP_ERR_NONE;
+		return;
 	}
 
 	/**
@@ -194,18 +317,27 @@ int csp_route_work(void) {
 	/* If the socket is connection-less, deliver now */
 	if (socket && (socket->opts & CSP_SO_CONN_LESS)) {
 
-		if (csp_route_security_check(socket->opts, input.iface, packet) < 0) {
+		if (csp_route_security_check(socket->opts, iface, packet, check) < 0) {
 			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
+			return;
+		}
+
+		/* There is no connection to grant credits for, only pass data on */
+		if ((packet->id.flags & CSP_FCREDIT) && !csp_credit_strip(packet)) {
+			return;
+		}
+
+		if (csp_route_to_pool(socket->rx_pool, &packet) != CSP_ERR_NONE) {
+			return;
 		}
 
 		if (csp_queue_enqueue(socket->rx_queue, &packet, 0) != CSP_QUEUE_OK) {
 			csp_dbg_conn_ovf++;
 			csp_buffer_free(packet);
-			return 0;
+			return;
 		}
 		
-		return CSP_ERR_NONE;
+		return;
 	}
 
 	/* Search for an existing connection */
@@ -217,13 +349,19 @@ int csp_route_work(void) {
 		/* Reject packet if no matching socket is found */
 		if (!socket) {
 			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
+			return;
+		}
+
+		/* Grants and probes to a closed connection must not open a new one */
+		if ((packet->id.flags & CSP_FCREDIT) && !csp_credit_has_data(packet)) {
+			csp_buffer_free(packet);
+			return;
 		}
 
 		/* Run security check on incoming packet */
-		if (csp_route_security_check(socket->opts, input.iface, packet) < 0) {
+		if (csp_route_security_check(socket->opts, iface, packet, check) < 0) {
 			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
+			return;
 		}
 
 		/* New incoming connection accepted */
@@ -241,20 +379,21 @@ int csp_route_work(void) {
 		if (!conn) {
 			csp_dbg_conn_out++;
 			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
+			return;
 		}
 
-		/* Store the socket queue and options */
+		/* Store the socket queue, options and pool */
 		conn->dest_socket = socket;
 		conn->opts = socket->opts;
+		conn->rx_pool = socket->rx_pool;
 
 		/* Packet to existing connection */
 	} else {
 
 		/* Run security check on incoming packet */
-		if (csp_route_security_check(conn->opts, input.iface, packet) < 0) {
+		if (csp_route_security_check(conn->opts, iface, packet, check) < 0) {
 			csp_buffer_free(packet);
-			return CSP_ERR_NONE;
+			return;
 		}
 	}
 
@@ -265,15 +404,25 @@ int csp_route_work(void) {
 		if (close_connection) {
 			csp_close(conn);
 		}
-		return CSP_ERR_NONE;
+		return;
 	}
 #endif
 
+	/* Strip credit trailer, grants and probes stop here */
+	if (packet->id.flags & CSP_FCREDIT) {
+		if (!csp_credit_new_packet(conn, packet)) {
+			return;
+		}
+	}
+
 	/* Otherwise, enqueue directly */
 	if (csp_conn_enqueue_packet(conn, packet) < 0) {
+		if (packet->id.flags & CSP_FCREDIT) {
+			csp_credit_dropped(conn);
+		}
 		csp_dbg_conn_ovf++;
 		csp_buffer_free(packet);
-		return CSP_ERR_NONE;
+		return;
 	}
 
 	/* Try to queue up the new connection pointer */
@@ -281,12 +430,64 @@ int csp_route_work(void) {
 		if (csp_queue_enqueue(conn->dest_socket->rx_queue, &conn, 0) != CSP_QUEUE_OK) {
 			csp_dbg_conn_ovf++;
 			csp_close(conn);
-			return CSP_ERR_NONE;
+			return;
 		}
 
 		/* Ensure that this connection will not be posted to this socket again */
 		conn->dest_socket = NULL;
 	}
+}
+
+int csp_route_work(void) {
+
+	csp_qfifo_t input;
+	csp_route_pending_t pending[CSP_ROUTE_BATCH];
+	unsigned int count = 0;
+
+	/* Packets sent from here must not wait for offload workers */
+	csp_offload_set_router();
+
+#if (CSP_USE_RDP)
+	/* Check connection timeouts (currently only for RDP) */
+	csp_conn_check_timeouts();
+#endif
+
+	/* Release shaped egress traffic, and wake up in time for the next packet */
+	uint32_t timeout = csp_qos_work(FIFO_TIMEOUT);
+
+	/* Get next packet to route */
+	if (csp_qfifo_read(&input, timeout) != CSP_ERR_NONE) {
+		return CSP_ERR_TIMEDOUT;
+	}
+
+	if (input.packet == NULL) {
+		return CSP_ERR_TIMEDOUT;
+	}
+
+	/* Take what else is already queued, so packets to me can be verified together */
+	unsigned int reads = 0;
+	do {
+		if (input.packet == NULL) {
+			continue;
+		}
+
+		/* Verified by an offload worker, already through the first stage */
+		if (input.check != CSP_QFIFO_UNCHECKED) {
+			csp_offload_rx_done(input.packet);
+		} else if (!csp_route_input(input.iface, input.packet) || csp_offload_rx(input.iface, input.packet)) {
+			continue;
+		}
+
+		pending[count].iface = input.iface;
+		pending[count].packet = input.packet;
+		pending[count++].check = input.check;
+	} while ((++reads < CSP_ROUTE_BATCH) && (csp_qfifo_read(&input, 0) == CSP_ERR_NONE));
+
+	csp_route_verify(pending, count);
+
+	for (unsigned int i = 0; i < count; i++) {
+		csp_route_deliver(pending[i].iface, pending[i].packet, pending[i].check);
+	}
 
 	return CSP_ERR_NONE;
 }
@@ -1,84 +1,518 @@
-
+#include "csp_rtable_cidr.h"
 
 #include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 
-#include <csp/csp_rtable.h>
+#include <csp/csp.h>
 #include <csp/csp_debug.h>
 #include <csp/csp_id.h>
 
-/* Definition of routing table */
-static csp_route_t rtable[CSP_RTABLE_SIZE] = {0};
+#include "csp_semaphore.h"
+
+/**
+ * Routing table.
+ *
+ * Routes are kept sorted by network address and netmask. Since CIDR subnets are either nested or disjoint, one
+ * sweep over the sorted routes splits the address space into ranges, each served by its most specific route.
+ * Lookups are a binary search over these ranges, O(log n) regardless of the netmasks in use.
+ *
+ * There are two copies of the table. Lookups use the active copy without locking. Changes are made to the
+ * other (shadow) copy, which is then published with a single atomic pointer store. The previously active copy is
+ * only reused by the next change, once its last reader has left.
+ */
+typedef struct {
+	csp_route_t * routes;
+	csp_rtable_range_t * ranges;  // Up to 2 per route, also used as scratch while sorting
+	unsigned int capacity;
+	unsigned int count;
+	unsigned int range_count;
+	unsigned int host_bits;       // Host bits the table was sorted for
+	unsigned int readers;         // Lookups running on this copy
+	bool draining;                // A writer waits for readers to leave
+} csp_rtable_t;
+
+#define CSP_RTABLE_NO_ROUTE 0xFFFF
+
+/* Default storage */
+static csp_route_t rtable_routes[2][CSP_RTABLE_SIZE];
+static csp_rtable_range_t rtable_ranges[2][2 * CSP_RTABLE_SIZE];
+
+static csp_rtable_t rtable[2] = {
+	{.routes = rtable_routes[0], .ranges = rtable_ranges[0], .capacity = CSP_RTABLE_SIZE},
+	{.routes = rtable_routes[1], .ranges = rtable_ranges[1], .capacity = CSP_RTABLE_SIZE},
+};
+
+static csp_rtable_t * rtable_active = &rtable[0];
+
+/* Serializes changes */
+static csp_bin_sem_t rtable_lock;
+
+/* Posted by the last reader to leave a draining copy */
+static csp_bin_sem_t rtable_drained;
+
+/* Table being edited, between csp_rtable_edit_begin() and commit/abort */
+static csp_rtable_t * rtable_edit = NULL;
+
+/* Lookup statistics, counted with relaxed atomics */
+static uint32_t rtable_hits[CSP_RTABLE_HIST_LEN];
+static uint32_t rtable_misses;
+
+static inline uint16_t csp_rtable_hostmask(unsigned int host_bits, uint16_t netmask) {
+	return (1 << (host_bits - netmask)) - 1;
+}
 
-static int rtable_inptr = 0;
+static inline uint16_t csp_rtable_network(unsigned int host_bits, const csp_route_t * route) {
+	return route->address & ~csp_rtable_hostmask(host_bits, route->netmask);
+}
 
-static csp_route_t * csp_rtable_find_exact(uint16_t addr, uint16_t netmask) {
+/* Sort order: network address, then shortest netmask first, so enclosing subnets come before the ones they contain */
+static int csp_rtable_compare(unsigned int host_bits, const csp_route_t * a, const csp_route_t * b) {
 
-	/* Start search */
-	for (int i = 0; i < rtable_inptr; i++) {
-		if (rtable[i].address == addr && rtable[i].netmask == netmask) {
-			return &rtable[i];
+	uint16_t network_a = csp_rtable_network(host_bits, a);
+	uint16_t network_b = csp_rtable_network(host_bits, b);
+	if (network_a != network_b) {
+		return (network_a < network_b) ? -1 : 1;
+	}
+	if (a->netmask != b->netmask) {
+		return (a->netmask < b->netmask) ? -1 : 1;
+	}
+	return 0;
+}
+
+/* qsort() has no context argument, only used with rtable_lock taken */
+static const csp_rtable_t * rtable_sort_table;
+
+static int csp_rtable_compare_index(const void * a, const void * b) {
+
+	uint16_t index_a = *(const uint16_t *)a;
+	uint16_t index_b = *(const uint16_t *)b;
+
+	int res = csp_rtable_compare(rtable_sort_table->host_bits, &rtable_sort_table->routes[index_a], &rtable_sort_table->routes[index_b]);
+	if (res != 0) {
+		return res;
+	}
+
+	/* Keep insertion order within a subnet, so the latest route wins */
+	return (index_a < index_b) ? -1 : 1;
+}
+
+/**
+ * Sort routes and remove duplicates.
+ * Of several routes to the same subnet, the last one added is kept.
+ */
+static void csp_rtable_normalize(csp_rtable_t * table) {
+
+	uint16_t * order = (uint16_t *)table->ranges;
+	for (unsigned int i = 0; i < table->count; i++) {
+		order[i] = i;
+	}
+
+	rtable_sort_table = table;
+	qsort(order, table->count, sizeof(uint16_t), csp_rtable_compare_index);
+
+	/* Apply the permutation in place, following its cycles */
+	for (unsigned int i = 0; i < table->count; i++) {
+		if (order[i] == i) {
+			continue;
+		}
+		csp_route_t tmp = table->routes[i];
+		unsigned int j = i;
+		while (order[j] != i) {
+			unsigned int src = order[j];
+			table->routes[j] = table->routes[src];
+			order[j] = j;
+			j = src;
 		}
+		table->routes[j] = tmp;
+		order[j] = j;
 	}
 
-	return NULL;
+	/* Remove duplicates, keeping the last */
+	unsigned int out = 0;
+	for (unsigned int i = 0; i < table->count; i++) {
+		if ((i + 1 < table->count) && (csp_rtable_compare(table->host_bits, &table->routes[i], &table->routes[i + 1]) == 0)) {
+			continue;
+		}
+		table->routes[out++] = table->routes[i];
+	}
+	table->count = out;
+}
+
+/* Add a range to the lookup index, merging with the previous range if possible */
+static void csp_rtable_emit(csp_rtable_t * table, uint32_t start, uint16_t route) {
+
+	if ((table->range_count > 0) && (table->ranges[table->range_count - 1].start == start)) {
+		/* Superseded by a more specific route starting at the same address */
+		table->range_count--;
+	}
+
+	if (table->range_count == 0) {
+		/* Addresses before the first range have no route */
+		if (route == CSP_RTABLE_NO_ROUTE) {
+			return;
+		}
+	} else if (table->ranges[table->range_count - 1].route == route) {
+		return;
+	}
+
+	table->ranges[table->range_count].start = start;
+	table->ranges[table->range_count].route = route;
+	table->range_count++;
 }
 
-csp_route_t * csp_rtable_find_route(uint16_t addr) {
+static void csp_rtable_build_index(csp_rtable_t * table) {
+
+	const unsigned int host_bits = table->host_bits;
+	const uint32_t max_addr = (1 << host_bits) - 1;
 
-	/* Remember best result */
-	int best_result = -1;
-	uint16_t best_result_mask = 0;
+	/* Nested subnets have distinct netmasks, so the stack holds at most host_bits + 1 routes */
+	uint16_t stack[16 + 1];
+	unsigned int depth = 0;
 
-	/* Start search */
-	for (int i = 0; i < rtable_inptr; i++) {
+	table->range_count = 0;
 
-		uint16_t hostbits = (1 << (csp_id_get_host_bits() - rtable[i].netmask)) - 1;
-		uint16_t netbits = ~hostbits;
+	for (unsigned int i = 0; i < table->count; i++) {
 
-		/* Match network addresses */
-		uint16_t net_a = rtable[i].address & netbits;
-		uint16_t net_b = addr & netbits;
+		uint32_t start = csp_rtable_network(host_bits, &table->routes[i]);
 
-		/* We have a match */
-		if (net_a == net_b) {
-			if (rtable[i].netmask >= best_result_mask) {
-				best_result = i;
-				best_result_mask = rtable[i].netmask;
+		/* Close the subnets ending before this one */
+		while (depth > 0) {
+			const csp_route_t * top = &table->routes[stack[depth - 1]];
+			uint32_t end = csp_rtable_network(host_bits, top) | csp_rtable_hostmask(host_bits, top->netmask);
+			if (end >= start) {
+				break;
 			}
+			depth--;
+			csp_rtable_emit(table, end + 1, (depth > 0) ? stack[depth - 1] : CSP_RTABLE_NO_ROUTE);
 		}
+
+		stack[depth++] = i;
+		csp_rtable_emit(table, start, i);
 	}
 
-	if (best_result > -1) {
-		return &rtable[best_result];
+	while (depth > 0) {
+		const csp_route_t * top = &table->routes[stack[depth - 1]];
+		uint32_t end = csp_rtable_network(host_bits, top) | csp_rtable_hostmask(host_bits, top->netmask);
+		depth--;
+		if (end < max_addr) {
+			csp_rtable_emit(table, end + 1, (depth > 0) ? stack[depth - 1] : CSP_RTABLE_NO_ROUTE);
+		}
+	}
+}
+
+static void csp_rtable_read_unlock(csp_rtable_t * table) {
+
+	/* Sequentially consistent, pairs with the draining flag in csp_rtable_drain() */
+	if ((__atomic_sub_fetch(&table->readers, 1, __ATOMIC_SEQ_CST) == 0) &&
+		__atomic_load_n(&table->draining, __ATOMIC_SEQ_CST)) {
+		csp_bin_sem_post(&rtable_drained);
+	}
+}
+
+static csp_rtable_t * csp_rtable_read_lock(void) {
+
+	for (;;) {
+		csp_rtable_t * table = __atomic_load_n(&rtable_active, __ATOMIC_SEQ_CST);
+		__atomic_fetch_add(&table->readers, 1, __ATOMIC_SEQ_CST);
+		/* The table may have been taken for editing, before we registered */
+		if (__atomic_load_n(&rtable_active, __ATOMIC_SEQ_CST) == table) {
+			return table;
+		}
+		csp_rtable_read_unlock(table);
+	}
+}
+
+/* Wait for lookups still running on a copy that is no longer active, called with rtable_lock held */
+static void csp_rtable_drain(csp_rtable_t * table) {
+
+	__atomic_store_n(&table->draining, true, __ATOMIC_SEQ_CST);
+
+	/* A post left over from an earlier drain only causes one more check */
+	while (__atomic_load_n(&table->readers, __ATOMIC_SEQ_CST) > 0) {
+		csp_bin_sem_wait(&rtable_drained, CSP_MAX_TIMEOUT);
+	}
+
+	__atomic_store_n(&table->draining, false, __ATOMIC_SEQ_CST);
+}
+
+static const csp_route_t * csp_rtable_search(const csp_rtable_t * table, uint16_t addr) {
+
+	/* Find the last range starting at or before addr */
+	unsigned int lo = 0;
+	unsigned int hi = table->range_count;
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		if (table->ranges[mid].start <= addr) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if ((lo == 0) || (addr > (1 << table->host_bits) - 1)) {
+		return NULL;
+	}
+
+	uint16_t route = table->ranges[lo - 1].route;
+	if (route == CSP_RTABLE_NO_ROUTE) {
+		return NULL;
+	}
+
+	return &table->routes[route];
+}
+
+/* Find the route for exactly this subnet, in a normalized table */
+static const csp_route_t * csp_rtable_search_exact(const csp_rtable_t * table, const csp_route_t * route) {
+
+	unsigned int lo = 0;
+	unsigned int hi = table->count;
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		int res = csp_rtable_compare(table->host_bits, &table->routes[mid], route);
+		if (res == 0) {
+			return &table->routes[mid];
+		}
+		if (res < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
 	}
 
 	return NULL;
 }
 
-int csp_rtable_set_internal(uint16_t address, uint16_t netmask, csp_iface_t * ifc, uint16_t via) {
+static const csp_route_t * csp_rtable_search_count(const csp_rtable_t * table, uint16_t addr) {
+
+	const csp_route_t * found = csp_rtable_search(table, addr);
+	if (found == NULL) {
+		__atomic_fetch_add(&rtable_misses, 1, __ATOMIC_RELAXED);
+	} else if (found->netmask < CSP_RTABLE_HIST_LEN) {
+		__atomic_fetch_add(&rtable_hits[found->netmask], 1, __ATOMIC_RELAXED);
+	}
+
+	return found;
+}
+
+bool csp_rtable_lookup(uint16_t addr, csp_route_t * route) {
+
+	csp_rtable_t * table = csp_rtable_read_lock();
+	const csp_route_t * found = csp_rtable_search_count(table, addr);
+	if (found != NULL) {
+		*route = *found;
+	}
+	csp_rtable_read_unlock(table);
+
+	return (found != NULL);
+}
+
+bool csp_rtable_route_packet(uint16_t addr, uint32_t packets, uint32_t bytes, csp_route_t * route) {
+
+	csp_rtable_t * table = csp_rtable_read_lock();
+	csp_route_t * found = (csp_route_t *)csp_rtable_search_count(table, addr);
+	if (found != NULL) {
+		__atomic_fetch_add(&found->packets, packets, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&found->bytes, bytes, __ATOMIC_RELAXED);
+		*route = *found;
+	}
+	csp_rtable_read_unlock(table);
+
+	return (found != NULL);
+}
+
+csp_route_t csp_rtable_find_route(uint16_t addr) {
 
-	/* First see if the entry exists */
-	csp_route_t * entry = csp_rtable_find_exact(address, netmask);
+	csp_route_t route = {.iface = NULL};
+	csp_rtable_lookup(addr, &route);
 
-	/* If not, create a new one */
-	if (!entry) {
-		entry = &rtable[rtable_inptr++];
-		if (rtable_inptr == CSP_RTABLE_SIZE)
-			rtable_inptr = CSP_RTABLE_SIZE;
+	return route;
+}
+
+/* Copy the routes without their counters, which lookups on the active copy may be updating */
+static void csp_rtable_copy_routes(csp_rtable_t * table, const csp_rtable_t * from) {
+
+	for (unsigned int i = 0; i < from->count; i++) {
+		csp_route_t * route = &table->routes[i];
+		route->address = from->routes[i].address;
+		route->netmask = from->routes[i].netmask;
+		route->via = from->routes[i].via;
+		route->iface = from->routes[i].iface;
+		route->packets = 0;
+		route->bytes = 0;
 	}
+	table->count = from->count;
+}
 
-	/* Fill in the data */
+/* Add the counters of a drained copy to the routes to the same subnets in the active copy */
+static void csp_rtable_carry_counters(csp_rtable_t * table, const csp_rtable_t * old) {
+
+	if (old->host_bits != table->host_bits) {
+		return;
+	}
+
+	for (unsigned int i = 0; i < table->count; i++) {
+		const csp_route_t * route = csp_rtable_search_exact(old, &table->routes[i]);
+		if (route != NULL) {
+			__atomic_fetch_add(&table->routes[i].packets, route->packets, __ATOMIC_RELAXED);
+			__atomic_fetch_add(&table->routes[i].bytes, route->bytes, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+void csp_rtable_init(void) {
+
+	/* Lookups never sort, so both copies must match the header version from the start */
+	rtable[0].host_bits = csp_id_get_host_bits();
+	rtable[1].host_bits = csp_id_get_host_bits();
+
+	csp_bin_sem_init(&rtable_lock);
+	csp_bin_sem_init(&rtable_drained);
+	csp_bin_sem_wait(&rtable_drained, 0);
+}
+
+int csp_rtable_edit_begin(bool clear) {
+
+	if (csp_bin_sem_wait(&rtable_lock, CSP_MAX_TIMEOUT) != CSP_SEMAPHORE_OK) {
+		return CSP_ERR_TIMEDOUT;
+	}
+
+	csp_rtable_t * active = __atomic_load_n(&rtable_active, __ATOMIC_ACQUIRE);
+	csp_rtable_t * shadow = (active == &rtable[0]) ? &rtable[1] : &rtable[0];
+
+	/* Deferred reclamation: wait for lookups still running on the shadow copy since it was last active */
+	csp_rtable_drain(shadow);
+
+	if (clear) {
+		shadow->count = 0;
+	} else {
+		csp_rtable_copy_routes(shadow, active);
+	}
+	shadow->host_bits = csp_id_get_host_bits();
+
+	rtable_edit = shadow;
+
+	return CSP_ERR_NONE;
+}
+
+int csp_rtable_edit_set(uint16_t address, uint16_t netmask, csp_iface_t * ifc, uint16_t via) {
+
+	csp_rtable_t * table = rtable_edit;
+
+	if (table->count >= table->capacity) {
+		/* Entries may replace existing routes, make room by removing duplicates */
+		csp_rtable_normalize(table);
+		if (table->count >= table->capacity) {
+			csp_dbg_errno = CSP_DBG_ERR_INVALID_RTABLE_ENTRY;
+			return CSP_ERR_NOMEM;
+		}
+	}
+
+	csp_route_t * entry = &table->routes[table->count++];
 	entry->address = address;
 	entry->netmask = netmask;
 	entry->iface = ifc;
 	entry->via = via;
+	entry->packets = 0;
+	entry->bytes = 0;
+
+	return CSP_ERR_NONE;
+}
+
+void csp_rtable_edit_commit(void) {
+
+	csp_rtable_t * table = rtable_edit;
+
+	csp_rtable_normalize(table);
+	csp_rtable_build_index(table);
+
+	/* Publish */
+	csp_rtable_t * active = __atomic_load_n(&rtable_active, __ATOMIC_ACQUIRE);
+	__atomic_store_n(&rtable_active, table, __ATOMIC_SEQ_CST);
+
+	/* Lookups still running on the old copy count there, so carry over once they have left */
+	csp_rtable_drain(active);
+	csp_rtable_carry_counters(table, active);
+
+	rtable_edit = NULL;
+	csp_bin_sem_post(&rtable_lock);
+}
+
+void csp_rtable_edit_abort(void) {
+	rtable_edit = NULL;
+	csp_bin_sem_post(&rtable_lock);
+}
+
+int csp_rtable_set_storage(void * storage, size_t size) {
+
+	if (storage == NULL) {
+		csp_dbg_errno = CSP_DBG_ERR_INVALID_POINTER;
+		return CSP_ERR_INVAL;
+	}
+
+	/* Align for the route entries, the ranges follow them */
+	uintptr_t addr = (uintptr_t)storage;
+	uintptr_t aligned = (addr + sizeof(void *) - 1) & ~(uintptr_t)(sizeof(void *) - 1);
+	if (size < (aligned - addr)) {
+		return CSP_ERR_NOMEM;
+	}
+	size -= (aligned - addr);
+
+	/* Room for both copies of the table */
+	const size_t entry_size = sizeof(csp_route_t) + 2 * sizeof(csp_rtable_range_t);
+	unsigned int capacity = size / (2 * entry_size);
+	if (capacity > CSP_RTABLE_NO_ROUTE) {
+		capacity = CSP_RTABLE_NO_ROUTE;
+	}
+
+	if (csp_bin_sem_wait(&rtable_lock, CSP_MAX_TIMEOUT) != CSP_SEMAPHORE_OK) {
+		return CSP_ERR_TIMEDOUT;
+	}
+
+	csp_rtable_t * active = __atomic_load_n(&rtable_active, __ATOMIC_ACQUIRE);
+	csp_rtable_t * shadow = (active == &rtable[0]) ? &rtable[1] : &rtable[0];
+
+	if (capacity < active->count) {
+		csp_bin_sem_post(&rtable_lock);
+		return CSP_ERR_NOMEM;
+	}
+
+	csp_rtable_drain(shadow);
+
+	/* Move the active routes to the shadow copy in the new storage, and publish it */
+	uint8_t * mem = (void *)aligned;
+	shadow->routes = (void *)mem;
+	mem += capacity * sizeof(csp_route_t);
+	shadow->ranges = (void *)mem;
+	mem += 2 * capacity * sizeof(csp_rtable_range_t);
+	shadow->capacity = capacity;
+
+	csp_rtable_copy_routes(shadow, active);
+	shadow->host_bits = csp_id_get_host_bits();
+	csp_rtable_normalize(shadow);
+	csp_rtable_build_index(shadow);
+	__atomic_store_n(&rtable_active, shadow, __ATOMIC_SEQ_CST);
+
+	/* The old copy moves to the new storage, once its readers have left */
+	csp_rtable_drain(active);
+	csp_rtable_carry_counters(shadow, active);
+
+	active->routes = (void *)mem;
+	mem += capacity * sizeof(csp_route_t);
+	active->ranges = (void *)mem;
+	active->capacity = capacity;
+	active->count = 0;
+	active->range_count = 0;
+
+	csp_bin_sem_post(&rtable_lock);
 
 	return CSP_ERR_NONE;
 }
 
 void csp_rtable_free(void) {
-	memset(rtable, 0, sizeof(rtable));
+	if (csp_rtable_edit_begin(true) == CSP_ERR_NONE) {
+		csp_rtable_edit_commit();
+	}
 }
 
 void csp_rtable_clear(void) {
@@ -93,17 +527,61 @@ int csp_rtable_set(uint16_t address, int netmask, csp_iface_t * ifc, uint16_t vi
 
 	/* Validates options */
 	if ((ifc == NULL) || (netmask > (int)csp_id_get_host_bits())) {
-		csp_dbg_errno = CSP_DBG_ERR_INVALID_RTABLE_ENTRY; 
+		csp_dbg_errno = CSP_DBG_ERR_INVALID_RTABLE_ENTRY;
 		return CSP_ERR_INVAL;
 	}
 
-	return csp_rtable_set_internal(address, netmask, ifc, via);
+	int res = csp_rtable_edit_begin(false);
+	if (res != CSP_ERR_NONE) {
+		return res;
+	}
+
+	res = csp_rtable_edit_set(address, netmask, ifc, via);
+	if (res != CSP_ERR_NONE) {
+		csp_rtable_edit_abort();
+		return res;
+	}
+
+	csp_rtable_edit_commit();
+
+	return CSP_ERR_NONE;
 }
 
 void csp_rtable_iterate(csp_rtable_iterator_t iter, void * ctx) {
-	for (int i = 0; i < rtable_inptr; i++) {
-		iter(ctx, &rtable[i]);
+
+	csp_rtable_t * table = csp_rtable_read_lock();
+
+	for (unsigned int i = 0; i < table->count; i++) {
+		if (!iter(ctx, &table->routes[i])) {
+			break;
+		}
+	}
+
+	csp_rtable_read_unlock(table);
+}
+
+void csp_rtable_get_stats(csp_rtable_stats_t * stats) {
+
+	for (unsigned int i = 0; i < CSP_RTABLE_HIST_LEN; i++) {
+		stats->hits[i] = __atomic_load_n(&rtable_hits[i], __ATOMIC_RELAXED);
+	}
+	stats->misses = __atomic_load_n(&rtable_misses, __ATOMIC_RELAXED);
+}
+
+void csp_rtable_reset_stats(void) {
+
+	for (unsigned int i = 0; i < CSP_RTABLE_HIST_LEN; i++) {
+		__atomic_store_n(&rtable_hits[i], 0, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&rtable_misses, 0, __ATOMIC_RELAXED);
+
+	/* Counters are only carried from the active table, so the shadow copy needs no reset */
+	csp_rtable_t * table = csp_rtable_read_lock();
+	for (unsigned int i = 0; i < table->count; i++) {
+		__atomic_store_n(&table->routes[i].packets, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&table->routes[i].bytes, 0, __ATOMIC_RELAXED);
 	}
+	csp_rtable_read_unlock(table);
 }
 
 #if (CSP_ENABLE_CSP_PRINT)
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <csp/csp_rtable.h>
+
+/**
+ * Init routing table locks
+ */
+void csp_rtable_init(void);
+
+/**
+ * Find route to destination address, and count packets of \a bytes in total on it
+ * @param addr destination address
+ * @param packets number of packets
+ * @param bytes total length of the packets
+ * @param route output, copy of the matching route
+ * @return true if a route matches
+ */
+bool csp_rtable_route_packet(uint16_t addr, uint32_t packets, uint32_t bytes, csp_route_t * route);
+
+/**
+ * Start a routing table change.
+ * Changes are made to a copy of the table, lookups continue on the current table until the change is committed.
+ * Only one change can be in progress, others wait in this call.
+ * @param clear start from an empty table, instead of a copy of the current
+ * @return #CSP_ERR_NONE on success, otherwise an error code.
+ */
+int csp_rtable_edit_begin(bool clear);
+
+/**
+ * Add or replace route in the table being changed, the entry must be validated by the caller
+ * @return #CSP_ERR_NONE on success, #CSP_ERR_NOMEM if the table is full.
+ */
+int csp_rtable_edit_set(uint16_t address, uint16_t netmask, csp_iface_t * ifc, uint16_t via);
+
+/**
+ * Publish the changed table
+ */
+void csp_rtable_edit_commit(void);
+
+/**
+ * Discard the changed table
+ */
+void csp_rtable_edit_abort(void);
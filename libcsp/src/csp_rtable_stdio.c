@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include <inttypes.h>
 
 #include <csp/csp.h>
@@ -8,66 +9,199 @@
 #include <csp/interfaces/csp_if_lo.h>
 #include <csp_autoconfig.h>
 
-static int csp_rtable_parse(const char * rtable, int dry_run) {
+#include "csp_rtable_cidr.h"
 
+/* Parse decimal number, returns pointer past the digits, or NULL if there are none */
+static const char * csp_rtable_parse_uint(const char * str, const char * end, unsigned int * value) {
+
+	if ((str >= end) || (*str < '0') || (*str > '9')) {
+		return NULL;
+	}
+
+	unsigned int result = 0;
+	while ((str < end) && (*str >= '0') && (*str <= '9')) {
+		result = result * 10 + (*str - '0');
+		if (result > UINT16_MAX) {
+			return NULL;
+		}
+		str++;
+	}
+
+	*value = result;
+	return str;
+}
+
+static const char * csp_rtable_skip_space(const char * str, const char * end) {
+	while ((str < end) && ((*str == ' ') || (*str == '\t') || (*str == '\r'))) {
+		str++;
+	}
+	return str;
+}
+
+static inline bool csp_rtable_is_separator(char c) {
+	return (c == ',') || (c == '\n');
+}
+
+/**
+ * Parse routes in one pass, and add them to the table being changed.
+ * @param dry_run only validate the entries
+ * @return number of entries, or an error code
+ */
+static int csp_rtable_parse(const char * str, size_t len, int dry_run) {
+
+	const char * end = str + len;
 	int valid_entries = 0;
 
-	/* Copy string before running strtok */
-	const size_t str_len = strnlen(rtable, 100);
-	char rtable_copy[str_len + 1];
-	strncpy(rtable_copy, rtable, str_len);
-	rtable_copy[str_len] = 0;
-
-	/* Get first token */
-	char * saveptr;
-	char * str = strtok_r(rtable_copy, ",", &saveptr);
-	while ((str) && (strlen(str) > 1)) {
-		unsigned int address, via;
-		int netmask;
-		char name[15];
-		if (sscanf(str, "%u/%d %14s %u", &address, &netmask, name, &via) == 4) {
-		} else if (sscanf(str, "%u/%d %14s", &address, &netmask, name) == 3) {
-			via = CSP_NO_VIA_ADDRESS;
-		} else if (sscanf(str, "%u %14s %u", &address, name, &via) == 3) {
-			netmask = csp_id_get_host_bits();
-		} else if (sscanf(str, "%u %14s", &address, name) == 2) {
-			netmask = csp_id_get_host_bits();
-			via = CSP_NO_VIA_ADDRESS;
-		} else {
-			// invalid entry
-			name[0] = 0;
+	while (str < end) {
+
+		str = csp_rtable_skip_space(str, end);
+
+		/* Empty entry */
+		if ((str >= end) || csp_rtable_is_separator(*str)) {
+			str++;
+			continue;
+		}
+
+		unsigned int address;
+		unsigned int netmask = csp_id_get_host_bits();
+		unsigned int via = CSP_NO_VIA_ADDRESS;
+		char name[CSP_IFLIST_NAME_MAX + 1];
+
+		str = csp_rtable_parse_uint(str, end, &address);
+		if (str == NULL) {
+			goto invalid;
+		}
+
+		if ((str < end) && (*str == '/')) {
+			str = csp_rtable_parse_uint(str + 1, end, &netmask);
+			if (str == NULL) {
+				goto invalid;
+			}
+		}
+
+		/* Interface name */
+		const char * name_begin = csp_rtable_skip_space(str, end);
+		if (name_begin == str) {
+			goto invalid;
+		}
+		str = name_begin;
+		while ((str < end) && (*str != ' ') && (*str != '\t') && (*str != '\r') && !csp_rtable_is_separator(*str)) {
+			str++;
+		}
+		size_t name_len = str - name_begin;
+		if ((name_len == 0) || (name_len > CSP_IFLIST_NAME_MAX)) {
+			goto invalid;
+		}
+		memcpy(name, name_begin, name_len);
+		name[name_len] = 0;
+
+		/* Optional via address */
+		str = csp_rtable_skip_space(str, end);
+		if ((str < end) && !csp_rtable_is_separator(*str)) {
+			str = csp_rtable_parse_uint(str, end, &via);
+			if (str == NULL) {
+				goto invalid;
+			}
+			str = csp_rtable_skip_space(str, end);
+		}
+
+		if ((str < end) && !csp_rtable_is_separator(*str)) {
+			goto invalid;
 		}
-		name[sizeof(name) - 1] = 0;
 
 		csp_iface_t * ifc = csp_iflist_get_by_name(name);
-		if ((address > csp_id_get_max_nodeid()) || (netmask > (int)csp_id_get_host_bits()) || (ifc == NULL)) {
-			csp_dbg_errno = CSP_DBG_ERR_INVALID_RTABLE_ENTRY; 
-			return CSP_ERR_INVAL;
+		if ((address > csp_id_get_max_nodeid()) || (netmask > csp_id_get_host_bits()) || (ifc == NULL)) {
+			goto invalid;
 		}
 
 		if (dry_run == 0) {
-			int res = csp_rtable_set(address, netmask, ifc, via);
+			int res = csp_rtable_edit_set(address, netmask, ifc, via);
 			if (res != CSP_ERR_NONE) {
-				csp_dbg_errno = CSP_DBG_ERR_INVALID_RTABLE_ENTRY;
 				return res;
 			}
 		}
 		valid_entries++;
-		str = strtok_r(NULL, ",", &saveptr);
 	}
 
 	return valid_entries;
+
+invalid:
+	csp_dbg_errno = CSP_DBG_ERR_INVALID_RTABLE_ENTRY;
+	return CSP_ERR_INVAL;
 }
 
-int csp_rtable_load(const char * rtable) {
-	return csp_rtable_parse(rtable, 0);
+int csp_rtable_import(const char * buffer, size_t len, bool replace) {
+
+	int res = csp_rtable_edit_begin(replace);
+	if (res != CSP_ERR_NONE) {
+		return res;
+	}
+
+	res = csp_rtable_parse(buffer, len, 0);
+	if (res < 0) {
+		csp_rtable_edit_abort();
+		return res;
+	}
+
+	csp_rtable_edit_commit();
+	return res;
 }
 
-int csp_rtable_check(const char * rtable) {
-	return csp_rtable_parse(rtable, 1);
+int csp_rtable_import_file(const char * path, bool replace) {
+
+	FILE * fp = fopen(path, "r");
+	if (fp == NULL) {
+		return CSP_ERR_INVAL;
+	}
+
+	int res = csp_rtable_edit_begin(replace);
+	if (res != CSP_ERR_NONE) {
+		fclose(fp);
+		return res;
+	}
+
+	int entries = 0;
+	char line[128];
+	while (fgets(line, sizeof(line), fp) != NULL) {
+
+		size_t len = strlen(line);
+		if ((len == sizeof(line) - 1) && (line[len - 1] != '\n')) {
+			/* A full buffer is a complete line if the newline or the end of the file follows */
+			int next = fgetc(fp);
+			if ((next != '\n') && (next != EOF)) {
+				/* Line too long */
+				csp_dbg_errno = CSP_DBG_ERR_INVALID_RTABLE_ENTRY;
+				entries = CSP_ERR_INVAL;
+				break;
+			}
+		}
+
+		res = csp_rtable_parse(line, len, 0);
+		if (res < 0) {
+			entries = res;
+			break;
+		}
+		entries += res;
+	}
+
+	fclose(fp);
+
+	if (entries < 0) {
+		csp_rtable_edit_abort();
+		return entries;
+	}
+
+	csp_rtable_edit_commit();
+	return entries;
 }
 
+int csp_rtable_load(const char * rtable) {
+	return csp_rtable_import(rtable, strlen(rtable), false);
+}
 
+int csp_rtable_check(const char * rtable) {
+	return csp_rtable_parse(rtable, strlen(rtable), 1);
+}
 
 typedef struct {
 	char * buffer;
@@ -38,3 +38,9 @@ int csp_bin_sem_wait(csp_bin_sem_t * sem, unsigned int timeout);
  * @return #CSP_SEMAPHORE_OK on success, otherwise #CSP_SEMAPHORE_ERROR
  */
 int csp_bin_sem_post(csp_bin_sem_t * sem);
+
+/**
+ * Identify the calling task
+ * @return handle of the calling task, only to compare with other results of this function
+ */
+void * csp_task_self(void);
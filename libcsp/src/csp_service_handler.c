@@ -92,6 +92,59 @@ static int do_cmp_route_set_v2(struct csp_cmp_message * cmp) {
 	return CSP_ERR_NONE;
 }
 
+typedef struct {
+	struct csp_cmp_message * cmp;
+	unsigned int index;
+	unsigned int total;
+} csp_cmp_route_stats_ctx_t;
+
+static bool do_cmp_route_stats_route(void * vctx, csp_route_t * route) {
+
+	csp_cmp_route_stats_ctx_t * ctx = vctx;
+	struct csp_cmp_message * cmp = ctx->cmp;
+
+	if ((ctx->total >= ctx->index) && (cmp->route_stats.count < CSP_CMP_ROUTE_STATS_MAX)) {
+		unsigned int i = cmp->route_stats.count++;
+		cmp->route_stats.route[i].address = htobe16(route->address);
+		cmp->route_stats.route[i].netmask = route->netmask;
+		cmp->route_stats.route[i].via = htobe16(route->via);
+		cmp->route_stats.route[i].packets = htobe32(__atomic_load_n(&route->packets, __ATOMIC_RELAXED));
+		cmp->route_stats.route[i].bytes = htobe32(__atomic_load_n(&route->bytes, __ATOMIC_RELAXED));
+	}
+	ctx->total++;
+
+	return true;
+}
+
+static int do_cmp_route_stats(struct csp_cmp_message * cmp) {
+
+	csp_cmp_route_stats_ctx_t ctx = {.cmp = cmp, .index = be16toh(cmp->route_stats.index), .total = 0};
+
+	cmp->route_stats.count = 0;
+	csp_rtable_iterate(do_cmp_route_stats_route, &ctx);
+
+	csp_rtable_stats_t stats;
+	csp_rtable_get_stats(&stats);
+
+	cmp->route_stats.total = htobe16(ctx.total);
+	cmp->route_stats.misses = htobe32(stats.misses);
+
+	return CSP_ERR_NONE;
+}
+
+static int do_cmp_route_hits(struct csp_cmp_message * cmp) {
+
+	csp_rtable_stats_t stats;
+	csp_rtable_get_stats(&stats);
+
+	cmp->route_hits.misses = htobe32(stats.misses);
+	for (unsigned int i = 0; i < CSP_RTABLE_HIST_LEN; i++) {
+		cmp->route_hits.hits[i] = htobe32(stats.hits[i]);
+	}
+
+	return CSP_ERR_NONE;
+}
+
 static int do_cmp_if_stats(struct csp_cmp_message * cmp) {
 
 	csp_iface_t * ifc = csp_iflist_get_by_name(cmp->if_stats.interface);
@@ -190,6 +243,16 @@ static int csp_cmp_handler(csp_packet_t * packet) {
 			packet->length = CMP_SIZE(if_stats);
 			break;
 
+		case CSP_CMP_ROUTE_STATS:
+			ret = do_cmp_route_stats(cmp);
+			packet->length = CMP_SIZE(route_stats);
+			break;
+
+		case CSP_CMP_ROUTE_HITS:
+			ret = do_cmp_route_hits(cmp);
+			packet->length = CMP_SIZE(route_hits);
+			break;
+
 		case CSP_CMP_PEEK:
 			ret = do_cmp_peek(cmp);
 			break;
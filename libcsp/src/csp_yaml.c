@@ -86,8 +86,8 @@ static void csp_yaml_end_if(struct data_s * data, unsigned int * dfl_addr) {
 			return;
 		}
 
-		iface = malloc(sizeof(csp_iface_t));
-		csp_if_tun_conf_t * ifconf = malloc(sizeof(csp_if_tun_conf_t));
+		iface = calloc(1, sizeof(csp_iface_t));
+		csp_if_tun_conf_t * ifconf = calloc(1, sizeof(csp_if_tun_conf_t));
 		ifconf->tun_dst = atoi(data->destination);
 		ifconf->tun_src = atoi(data->source);
 
@@ -102,8 +102,8 @@ static void csp_yaml_end_if(struct data_s * data, unsigned int * dfl_addr) {
 			return;
 		}
 
-		iface = malloc(sizeof(csp_iface_t));
-		csp_if_udp_conf_t * udp_conf = malloc(sizeof(csp_if_udp_conf_t));
+		iface = calloc(1, sizeof(csp_iface_t));
+		csp_if_udp_conf_t * udp_conf = calloc(1, sizeof(csp_if_udp_conf_t));
 		udp_conf->host = data->server;
 		udp_conf->lport = atoi(data->listen_port);
 		udp_conf->rport = atoi(data->remote_port);
@@ -161,6 +161,9 @@ static void csp_yaml_end_if(struct data_s * data, unsigned int * dfl_addr) {
 	iface->netmask = atoi(data->netmask);
 	iface->name = strdup(data->name);
 
+	/* The interface was added by its driver before the address was known */
+	csp_iflist_update();
+
 	csp_print("  %s addr: %u netmask %u\n", iface->name, iface->addr, iface->netmask);
 
 }
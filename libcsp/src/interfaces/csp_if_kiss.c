@@ -20,13 +20,8 @@
 #define TFESC    0xDD
 #define TNC_DATA 0x00
 
-int csp_kiss_tx(csp_iface_t * iface, uint16_t via, csp_packet_t * packet) {
-
-	csp_kiss_interface_data_t * ifdata = iface->interface_data;
-	void * driver = iface->driver_data;
-
-	/* Lock (before modifying packet) */
-	csp_usart_lock(driver);
+/* Encode and transmit one frame, the driver must be locked */
+static void csp_kiss_tx_frame(csp_kiss_interface_data_t * ifdata, void * driver, csp_packet_t * packet) {
 
 	/* Add CRC32 checksum - the MTU setting ensures there are space */
 	csp_crc32_append(packet);
@@ -56,15 +51,56 @@ int csp_kiss_tx(csp_iface_t * iface, uint16_t via, csp_packet_t * packet) {
 	const unsigned char stop[] = {FEND};
 	ifdata->tx_func(driver, stop, sizeof(stop));
 
-	/* Unlock */
-	csp_usart_unlock(driver);
-
 	/* Free data */
 	csp_buffer_free(packet);
+}
+
+int csp_kiss_tx(csp_iface_t * iface, uint16_t via, csp_packet_t * packet) {
+
+	void * driver = iface->driver_data;
+
+	/* Lock (before modifying packet) */
+	csp_usart_lock(driver);
+
+	csp_kiss_tx_frame(iface->interface_data, driver, packet);
+
+	/* Unlock */
+	csp_usart_unlock(driver);
 
 	return CSP_ERR_NONE;
 }
 
+unsigned int csp_kiss_tx_batch(csp_iface_t * iface, uint16_t via, csp_packet_t * packets[], unsigned int count) {
+
+	void * driver = iface->driver_data;
+
+	/* Frames are sent back to back, under one lock */
+	csp_usart_lock(driver);
+
+	for (unsigned int i = 0; i < count; i++) {
+		csp_kiss_tx_frame(iface->interface_data, driver, packets[i]);
+	}
+
+	csp_usart_unlock(driver);
+
+	return count;
+}
+
+/**
+ * Update the Rx CRC32 with received data, up to but not including the last 4 bytes,
+ * which may turn out to be the checksum.
+ */
+static void csp_kiss_rx_crc(csp_kiss_interface_data_t * ifdata) {
+
+	if (ifdata->rx_length < ifdata->rx_crc_length + sizeof(uint32_t)) {
+		return;
+	}
+
+	unsigned int end = ifdata->rx_length - sizeof(uint32_t);
+	ifdata->rx_crc = csp_crc32_update(ifdata->rx_crc, &ifdata->rx_packet->frame_begin[ifdata->rx_crc_length], end - ifdata->rx_crc_length);
+	ifdata->rx_crc_length = end;
+}
+
 /**
  * Decode received data and eventually route the packet.
  */
@@ -104,8 +140,9 @@ void csp_kiss_rx(csp_iface_t * iface, const uint8_t * buf, size_t len, void * px
 					break;
 				}
 
-				/* Start transfer */
-				csp_id_setup_rx(ifdata->rx_packet);
+				/* Start transfer, CRC32 covers data after the header */
+				ifdata->rx_crc_length = csp_id_setup_rx(ifdata->rx_packet);
+				ifdata->rx_crc = csp_crc32_init();
 				ifdata->rx_length = 0;
 				ifdata->rx_mode = KISS_MODE_STARTED;
 				ifdata->rx_first = true;
@@ -136,7 +173,8 @@ void csp_kiss_rx(csp_iface_t * iface, const uint8_t * buf, size_t len, void * px
 						iface->frame++;
 
 						/* Validate CRC */
-						if (csp_crc32_verify(ifdata->rx_packet) != CSP_ERR_NONE) {
+						csp_kiss_rx_crc(ifdata);
+						if (csp_crc32_verify_precomputed(ifdata->rx_packet, csp_crc32_final(ifdata->rx_crc)) != CSP_ERR_NONE) {
 							iface->rx_error++;
 							ifdata->rx_mode = KISS_MODE_NOT_STARTED;
 							break;
@@ -187,6 +225,11 @@ void csp_kiss_rx(csp_iface_t * iface, const uint8_t * buf, size_t len, void * px
 				break;
 		}
 	}
+
+	/* Checksum what arrived in this chunk, while it is still in cache */
+	if ((ifdata->rx_mode == KISS_MODE_STARTED) || (ifdata->rx_mode == KISS_MODE_ESCAPED)) {
+		csp_kiss_rx_crc(ifdata);
+	}
 }
 
 int csp_kiss_add_interface(csp_iface_t * iface) {
@@ -205,6 +248,8 @@ int csp_kiss_add_interface(csp_iface_t * iface) {
 	ifdata->rx_mode = KISS_MODE_NOT_STARTED;
 	ifdata->rx_first = false;
 	ifdata->rx_packet = NULL;
+	ifdata->rx_crc = csp_crc32_init();
+	ifdata->rx_crc_length = 0;
 
 	const unsigned int max_data_size = csp_buffer_data_size() - sizeof(uint32_t);  // compensate for the added CRC32
 	if ((iface->mtu == 0) || (iface->mtu > max_data_size)) {
@@ -212,6 +257,7 @@ int csp_kiss_add_interface(csp_iface_t * iface) {
 	}
 
 	iface->nexthop = csp_kiss_tx;
+	iface->nexthop_batch = csp_kiss_tx_batch;
 
 	return csp_iflist_add(iface);
 }
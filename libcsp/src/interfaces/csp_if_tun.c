@@ -2,6 +2,37 @@
 #include <csp/csp.h>
 #include <csp/csp_id.h>
 #include <csp/csp_hooks.h>
+#include <csp/crypto/csp_chacha20poly1305.h>
+
+#include <string.h>
+
+/* Nonce on the wire: 4 byte salt and 8 byte counter, the full 12 byte AEAD nonce */
+#define CSP_IF_TUN_NONCE_LENGTH CSP_CHACHA20POLY1305_NONCESIZE
+
+/* Tunnel payload: ciphertext of the inner data and packed inner header, then nonce and tag */
+#define CSP_IF_TUN_OVERHEAD(hdr) ((hdr) + CSP_IF_TUN_NONCE_LENGTH + CSP_CHACHA20POLY1305_TAGSIZE)
+
+/* Largest packed inner header (2.x) */
+#define CSP_IF_TUN_HEADER_MAX 6
+
+/* Take the next nonce counter, fails when the counter is exhausted or no salt is set */
+static int csp_if_tun_next_nonce(csp_if_tun_conf_t * ifconf, uint8_t * nonce) {
+
+	if (ifconf->salt == 0) {
+		return CSP_ERR_INVAL;
+	}
+
+	uint64_t counter = __atomic_load_n(&ifconf->tx_counter, __ATOMIC_RELAXED);
+	do {
+		if (counter == UINT64_MAX) {
+			return CSP_ERR_TX;
+		}
+	} while (!__atomic_compare_exchange_n(&ifconf->tx_counter, &counter, counter + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	memcpy(nonce, &ifconf->salt, sizeof(ifconf->salt));
+	memcpy(&nonce[sizeof(ifconf->salt)], &counter, sizeof(counter));
+	return CSP_ERR_NONE;
+}
 
 __attribute__((weak)) int csp_crypto_decrypt(uint8_t * ciphertext_in, uint8_t ciphertext_len, uint8_t * msg_out) {
 	return -1;
@@ -11,10 +42,102 @@ __attribute__((weak)) int csp_crypto_encrypt(uint8_t * msg_begin, uint8_t msg_le
 	return -1;
 }
 
+/* In place: the tunnel packet is the inner packet, with the inner header and trailer in its tailroom */
+static int csp_if_tun_tx_aead(csp_iface_t * iface, csp_packet_t * packet) {
+
+	csp_if_tun_conf_t * ifconf = iface->driver_data;
+	uint8_t nonce[CSP_CHACHA20POLY1305_NONCESIZE] = {0};
+
+	if (packet->id.dst == ifconf->tun_src) {
+
+		/**
+		 * Incomming tunnel packet
+		 */
+		unsigned int hdr = csp_id_setup_rx(packet);
+		if (packet->length < CSP_IF_TUN_OVERHEAD(hdr)) {
+			csp_buffer_free(packet);
+			iface->rx_error++;
+			return CSP_ERR_NONE;
+		}
+
+		uint16_t length = packet->length - CSP_IF_TUN_OVERHEAD(hdr);
+		uint8_t * trailer = &packet->data[length + hdr];
+		memcpy(nonce, trailer, CSP_IF_TUN_NONCE_LENGTH);
+
+		if (csp_chacha20poly1305_decrypt(ifconf->key, nonce, NULL, 0, packet->data, length + hdr, trailer + CSP_IF_TUN_NONCE_LENGTH) != CSP_ERR_NONE) {
+			csp_buffer_free(packet);
+			iface->rx_error++;
+			iface->autherr++;
+			return CSP_ERR_NONE;
+		}
+
+		/* Move the inner header back in front of the data */
+		memcpy(packet->frame_begin, &packet->data[length], hdr);
+		packet->frame_length = length + hdr;
+
+		if (csp_id_strip(packet) != 0) {
+			csp_buffer_free(packet);
+			iface->rx_error++;
+			return CSP_ERR_NONE;
+		}
+
+		/* Send new packet */
+		csp_qfifo_write(packet, iface, NULL);
+
+	} else {
+
+		/**
+		 * Outgoing tunnel packet
+		 */
+
+		/* Apply CSP header */
+		csp_id_prepend(packet);
+
+		unsigned int hdr = packet->frame_length - packet->length;
+		if (packet->length + CSP_IF_TUN_OVERHEAD(hdr) > csp_buffer_data_size()) {
+			return CSP_ERR_TX;
+		}
+
+		/* Never reuse a nonce under the same key */
+		if (csp_if_tun_next_nonce(ifconf, nonce) != CSP_ERR_NONE) {
+			return CSP_ERR_TX;
+		}
+
+		/* Encrypt data and packed header, the header area is reused for the tunnel header */
+		uint16_t length = packet->length;
+		memcpy(&packet->data[length], packet->frame_begin, hdr);
+		uint8_t * trailer = &packet->data[length + hdr];
+		csp_chacha20poly1305_encrypt(ifconf->key, nonce, NULL, 0, packet->data, length + hdr, trailer + CSP_IF_TUN_NONCE_LENGTH);
+		memcpy(trailer, nonce, CSP_IF_TUN_NONCE_LENGTH);
+
+		/* Create tunnel header */
+		packet->id.dst = ifconf->tun_dst;
+		packet->id.src = ifconf->tun_src;
+		packet->id.sport = 0;
+		packet->id.dport = 0;
+		packet->id.flags = 0;
+		packet->length = length + CSP_IF_TUN_OVERHEAD(hdr);
+
+		/* Apply CSP header */
+		csp_id_prepend(packet);
+
+		/* Send new packet */
+		csp_qfifo_write(packet, iface, NULL);
+
+	}
+
+	return CSP_ERR_NONE;
+
+}
+
 static int csp_if_tun_tx(csp_iface_t * iface, uint16_t via, csp_packet_t * packet) {
 
 	csp_if_tun_conf_t * ifconf = iface->driver_data;
 
+	if (ifconf->key != NULL) {
+		return csp_if_tun_tx_aead(iface, packet);
+	}
+
 	/* Allocate new frame */
 	csp_packet_t * new_packet = csp_buffer_get(packet->frame_length);
 	if (new_packet == NULL) {
@@ -112,12 +235,16 @@ void csp_if_tun_init(csp_iface_t * iface, csp_if_tun_conf_t * ifconf) {
 
 	iface->driver_data = ifconf;
 
-	/* MTU is datasize */
+	/* MTU is datasize, less room for the in place encryption */
 	iface->mtu = csp_buffer_data_size();
+	if (ifconf->key != NULL) {
+		iface->mtu -= CSP_IF_TUN_OVERHEAD(CSP_IF_TUN_HEADER_MAX);
+	}
 
 	/* Regsiter interface */
 	iface->name = "TUN",
 	iface->nexthop = csp_if_tun_tx,
+	iface->nexthop_batch = NULL,
 	csp_iflist_add(iface);
 
 }
@@ -133,5 +133,6 @@ void csp_if_udp_init(csp_iface_t * iface, csp_if_udp_conf_t * ifconf) {
 	/* Regsiter interface */
 	iface->name = "UDP",
 	iface->nexthop = csp_if_udp_tx,
+	iface->nexthop_batch = NULL,
 	csp_iflist_add(iface);
 }
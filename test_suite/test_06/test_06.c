@@ -0,0 +1,167 @@
+#include <csp/csp_debug.h>
+#include <endian.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <csp/csp.h>
+#include <csp/csp_crc32.h>
+#include <csp/csp_id.h>
+
+/* Checks that csp_crc32_verify() accepts both checksum variants on random
+ * CSP 1 and CSP 2 frames: over the data only, and over header and data
+ * (walked as header checksum combined with the data checksum). Single bit
+ * flips in the data, the checksum and, for header checksums, the header must
+ * be rejected. */
+
+#define FRAMES 2000
+
+static unsigned int failures = 0;
+
+/* Random id within the field widths of the header version */
+static void random_id(csp_packet_t *packet) {
+
+  unsigned int flag_bits = (csp_conf.version == 2) ? 6 : 8;
+
+  packet->id.pri = rand() & 0x3;
+  packet->id.dst = rand() % (csp_id_get_max_nodeid() + 1);
+  packet->id.src = rand() % (csp_id_get_max_nodeid() + 1);
+  packet->id.dport = rand() % (csp_id_get_max_port() + 1);
+  packet->id.sport = rand() % (csp_id_get_max_port() + 1);
+  packet->id.flags = rand() & ((1 << flag_bits) - 1);
+}
+
+/* Flip one bit of the header, by flipping it in the unpacked id */
+static void flip_header_bit(csp_packet_t *packet) {
+
+  unsigned int node_bits = (csp_conf.version == 2) ? 14 : 5;
+  unsigned int flag_bits = (csp_conf.version == 2) ? 6 : 8;
+
+  switch (rand() % 6) {
+  case 0:
+    packet->id.pri ^= 1 << (rand() % 2);
+    break;
+  case 1:
+    packet->id.dst ^= 1 << (rand() % node_bits);
+    break;
+  case 2:
+    packet->id.src ^= 1 << (rand() % node_bits);
+    break;
+  case 3:
+    packet->id.dport ^= 1 << (rand() % 6);
+    break;
+  case 4:
+    packet->id.sport ^= 1 << (rand() % 6);
+    break;
+  default:
+    packet->id.flags ^= 1 << (rand() % flag_bits);
+    break;
+  }
+}
+
+/* Build a random frame, with a checksum over the data or over header and data */
+static csp_packet_t *random_frame(int with_header, uint8_t *data,
+                                  uint16_t *length, csp_id_t *id) {
+
+  csp_packet_t *packet = csp_buffer_get(0);
+  if (packet == NULL) {
+    csp_print("out of buffers\n");
+    exit(1);
+  }
+
+  random_id(packet);
+  packet->length = rand() % (csp_buffer_data_size() - sizeof(uint32_t) + 1);
+  for (unsigned int i = 0; i < packet->length; i++) {
+    packet->data[i] = rand();
+  }
+
+  uint32_t crc;
+  if (with_header) {
+    csp_id_prepend(packet);
+    crc = csp_crc32_memory(packet->frame_begin, packet->frame_length);
+  } else {
+    crc = csp_crc32_memory(packet->data, packet->length);
+  }
+  crc = htobe32(crc);
+  memcpy(&packet->data[packet->length], &crc, sizeof(crc));
+  packet->length += sizeof(crc);
+
+  memcpy(data, packet->data, packet->length);
+  *length = packet->length;
+  *id = packet->id;
+
+  return packet;
+}
+
+static void restore_frame(csp_packet_t *packet, const uint8_t *data,
+                          uint16_t length, const csp_id_t *id) {
+  memcpy(packet->data, data, length);
+  packet->length = length;
+  packet->id = *id;
+}
+
+static void test_version(uint8_t version) {
+
+  csp_conf.version = version;
+
+  uint8_t data[CSP_BUFFER_SIZE];
+  uint16_t length;
+  csp_id_t id;
+
+  for (unsigned int n = 0; n < FRAMES; n++) {
+
+    int with_header = n & 1;
+    csp_packet_t *packet = random_frame(with_header, data, &length, &id);
+
+    /* Accepted, and the checksum is stripped */
+    if ((csp_crc32_verify(packet) != CSP_ERR_NONE) ||
+        (packet->length != length - sizeof(uint32_t))) {
+      csp_print("v%u frame %u (header %d, length %u) not accepted\n", version,
+                n, with_header, length);
+      failures++;
+    }
+
+    /* Single bit flip in data or checksum */
+    restore_frame(packet, data, length, &id);
+    unsigned int bit = rand() % (length * 8);
+    packet->data[bit / 8] ^= 1 << (bit % 8);
+    if (csp_crc32_verify(packet) == CSP_ERR_NONE) {
+      csp_print("v%u frame %u (header %d) accepted with bit %u flipped\n",
+                version, n, with_header, bit);
+      failures++;
+    }
+
+    /* Single bit flip in the header */
+    if (with_header) {
+      restore_frame(packet, data, length, &id);
+      flip_header_bit(packet);
+      if (csp_crc32_verify(packet) == CSP_ERR_NONE) {
+        csp_print("v%u frame %u accepted with a header bit flipped\n", version,
+                  n);
+        failures++;
+      }
+    }
+
+    csp_buffer_free(packet);
+  }
+}
+
+int main(void) {
+
+  csp_print("Initialising CSP\n");
+  csp_init();
+
+  srand(6);
+
+  test_version(1);
+  test_version(2);
+
+  if (failures) {
+    csp_print("%u CRC32 checks failed\n", failures);
+    exit(1);
+  }
+
+  csp_print("CRC32 accepted %u frames with both checksums, and rejected all "
+            "bit flips\n",
+            2 * FRAMES);
+  exit(0);
+}